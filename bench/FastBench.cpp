@@ -0,0 +1,224 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+// Time detection and extraction of a 640x480 image through the byte plane
+// (fastDetect, fastScoreHarris, fastExtract) and the bit plane
+// (fastDetectBits, fastScoreHarrisBits, fastExtractBits), batched Harris
+// scoring against one harrisScoreSobel call per point, the 7x7 window
+// and the Shi-Tomasi and FAST scorers, selectLevels and distributeLevels
+// keeping half of the points, detection with 30% of the frame masked,
+// fastRedetect of a tenth of the cells against a full pass, and on ARM
+// the fused fastDetectScoreHarris against detection followed by scoring.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "../include/Fast.h"
+#include "../include/OrbContext.h"
+#include "../include/Select.h"
+#include "../include/Util.h"
+
+static const int width = 640;
+static const int height = 480;
+static const int border = 16;
+static const int repeats = 20;
+
+typedef uint8_t (*image_t)[width];
+
+template <typename F>
+static double best(F f) {
+  double best = 1e9;
+  for (int r = 0; r < repeats; r += 1) {
+    auto begin = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(best,
+        std::chrono::duration<double, std::milli>(end - begin).count());
+  }
+  return best;
+}
+
+int main() {
+  // Rectangles on a flat background, for a realistic density of corners.
+  std::mt19937 rng(1);
+  std::vector<uint8_t> img(width * height, 128);
+  for (int i = 0; i < 400; i += 1) {
+    int x = rng() % width, y = rng() % height;
+    int w = 4 + rng() % 40, h = 4 + rng() % 40;
+    uint8_t value = rng();
+    for (int r = y; r < std::min(y + h, height); r += 1) {
+      std::fill(&img[r*width + x], &img[r*width + std::min(x + w, width)],
+          value);
+    }
+  }
+
+  pislam::OrbContext context(width, height, 0);
+  image_t imgPtr = (image_t)img.data();
+  image_t out = context.scorePlane<width>();
+  uint64_t (*bits)[pislam::fastBitWords(width)] = context.bitPlane<width>();
+  std::vector<pislam::Keypoint> keypoints;
+
+  printf("%d x %d image, best of %d\n", width, height, repeats);
+  for (int threshold : {10, 20, 40}) {
+    double byteDetect = best([&]() {
+      pislam::fastDetect<width, border>(width, height, imgPtr, out, threshold);
+    });
+    double bitDetect = best([&]() {
+      pislam::fastDetectBits<width, border>(width, height, imgPtr, bits,
+          threshold);
+    });
+
+    // Stand-in scores, the same for both planes. fastExtractBits clears
+    // them, so each repeat restores them, which is timed separately and
+    // subtracted.
+    std::vector<uint8_t> scores(width * height);
+    for (int y = 0; y < height; y += 1) {
+      for (int x = 0; x < width; x += 1) {
+        scores[y*width + x] = bits[y][x / 64] >> (x % 64) & 1 ? 1 + x % 7 : 0;
+      }
+    }
+    auto restore = [&]() {
+      for (int y = border; y < height - border; y += 1) {
+        for (int w = 0; w < pislam::fastBitWords(width); w += 1) {
+          for (uint64_t word = bits[y][w]; word; word &= word - 1) {
+            int x = w*64 + __builtin_ctzll(word);
+            out[y][x] = scores[y*width + x];
+          }
+        }
+      }
+    };
+    restore();
+    double byteExtract = best([&]() {
+      keypoints.clear();
+      pislam::fastExtract<width, border>(width, height, out, keypoints,
+          context);
+    });
+    double restoreTime = best(restore);
+    double bitExtract = best([&]() {
+      restore();
+      keypoints.clear();
+      pislam::fastExtractBits<width, border>(width, height, bits, out,
+          keypoints, context);
+    }) - restoreTime;
+
+    printf("threshold %2d  %6zu points  detect byte %6.3f ms  bits %6.3f ms"
+        "  extract byte %6.3f ms  bits %6.3f ms\n", threshold,
+        keypoints.size(), byteDetect, bitDetect, byteExtract, bitExtract);
+
+    // The bottom 30% of the frame, as a vehicle's own body might be.
+    pislam::FastMask mask(width, height);
+    mask.set(0, height * 7 / 10, width, height, false);
+    double maskedDetect = best([&]() {
+      pislam::fastDetect<width, border>(width, height, imgPtr, out, threshold,
+          mask);
+    });
+    printf("              detect masked 30%% %6.3f ms\n", maskedDetect);
+
+    // Every tenth 32x32 cell, as if those had lost their tracks.
+    std::vector<uint8_t> requested(pislam::fastCellCount<5>(width) *
+        pislam::fastCellCount<5>(height));
+    for (size_t i = 0; i < requested.size(); i += 10) {
+      requested[i] = 1;
+    }
+    double fullPass = best([&]() {
+      pislam::fastDetect<width, border>(width, height, imgPtr, out, threshold);
+      pislam::fastScoreHarris<width, border>(width, height, imgPtr, 0, out);
+      keypoints.clear();
+      pislam::fastExtract<width, border>(width, height, out, keypoints,
+          context);
+    });
+    std::fill(out[0], out[height], 0);
+    double redetect = best([&]() {
+      keypoints.clear();
+      pislam::fastRedetectHarris<width, border>(width, height, imgPtr, out,
+          threshold, 0, requested.data(), keypoints);
+    });
+    printf("              full pass %6.3f ms  redetect 10%% of cells %6.3f ms\n",
+        fullPass, redetect);
+
+    double byteScore = best([&]() {
+      pislam::fastDetect<width, border>(width, height, imgPtr, out, threshold);
+      pislam::fastScoreHarris<width, border>(width, height, imgPtr, 0, out);
+    }) - byteDetect;
+    double bitScore = best([&]() {
+      pislam::fastScoreHarrisBits<width, border>(width, height, imgPtr, 0,
+          bits, out);
+    });
+    // one harrisScoreSobel call per point, as before batching
+    double singleScore = best([&]() {
+      for (int y = border; y < height - border; y += 1) {
+        for (int w = 0; w < pislam::fastBitWords(width); w += 1) {
+          for (uint64_t word = bits[y][w]; word; word &= word - 1) {
+            int x = w*64 + __builtin_ctzll(word);
+            out[y][x] = pislam::harrisScoreSobel<width>(imgPtr, x, y, 0);
+          }
+        }
+      }
+    });
+    double score7 = best([&]() {
+      pislam::fastScoreHarrisBits<width, border, 7>(width, height, imgPtr, 0,
+          bits, out);
+    });
+    double shiTomasi = best([&]() {
+      pislam::fastScoreBits<width, border, pislam::ShiTomasiScorer>(width,
+          height, imgPtr, 0, bits, out);
+    });
+    double fastScore = best([&]() {
+      pislam::fastScoreBits<width, border, pislam::FastScorer>(width,
+          height, imgPtr, 0, bits, out);
+    });
+    printf("              score byte %6.3f ms  bits %6.3f ms"
+        "  unbatched %6.3f ms  7x7 %6.3f ms\n", byteScore, bitScore,
+        singleScore, score7);
+    printf("              score bits Shi-Tomasi %6.3f ms  FAST %6.3f ms\n",
+        shiTomasi, fastScore);
+
+    // selectLevels consumes its input, so each repeat copies it, which is
+    // timed separately and subtracted.
+    const pislam::PyramidLevel level = {width, height, 0};
+    std::vector<pislam::Keypoint> selected;
+    double copy = best([&]() { selected = keypoints; });
+    double select = best([&]() {
+      selected = keypoints;
+      pislam::selectLevels(selected, &level, 1, keypoints.size() / 2, context);
+    }) - copy;
+    double distribute = best([&]() {
+      selected = keypoints;
+      pislam::distributeLevels(selected, &level, 1, keypoints.size() / 2,
+          context);
+    }) - copy;
+    printf("              select best half %6.3f ms  distribute %6.3f ms\n",
+        select, distribute);
+
+#if defined(PISLAM_NEON)
+    double twoPass = byteDetect + byteScore;
+    double fused = best([&]() {
+      pislam::fastDetectScoreHarris<width, border>(width, height, imgPtr,
+          threshold, 0, out);
+    });
+    printf("              detect and score two pass %6.3f ms  fused %6.3f ms\n",
+        twoPass, fused);
+#endif
+    std::fill(out[0], out[height], 0);
+  }
+  return 0;
+}
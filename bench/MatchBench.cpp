@@ -0,0 +1,170 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+// Time 1000 x 1000 brute force matching of 256 bit descriptors with the
+// byte lookup table approach and with each SIMD kernel, then radius
+// matching of 1000 keypoints of a 640x480 pyramid through MatchGrid.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "../include/Match.h"
+#include "../include/MatchGrid.h"
+#include "../include/Reference.h"
+
+typedef void (*NearestFn)(const uint32_t *, int, const uint32_t *, int,
+    pislam::NearestMatch *);
+
+static const int count = 1000;
+static const int repeats = 20;
+
+static double elapsed(std::chrono::steady_clock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - begin).count();
+}
+
+// Grid build plus matchRadius for keypoints which moved a few pixels
+// between frames, against the same windows searched exhaustively.
+static void radius(std::mt19937 &rng, const std::vector<uint32_t> &train,
+    int r) {
+  const int w = pislam::matchWords;
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  pislam::pyramidLevels(640, 480, levels);
+
+  std::vector<pislam::Keypoint> trainKeypoints, queryKeypoints;
+  std::vector<uint32_t> query(train);
+  for (int i = 0; i < count; i += 1) {
+    const pislam::PyramidLevel &level = levels[rng() % pislam::pyramidLevelCount];
+    int x = 16 + rng() % (level.width - 32);
+    int y = 16 + rng() % (level.height - 32);
+    trainKeypoints.push_back(pislam::encodeFast(0, x, level.row + y));
+    queryKeypoints.push_back(pislam::encodeFast(0, x + rng() % 9 - 4,
+          level.row + y + rng() % 9 - 4));
+    query[i*w + rng() % w] ^= rng() & rng();
+  }
+
+  pislam::MatchGrid grid(levels, pislam::pyramidLevelCount, r);
+  std::vector<pislam::Match> matches;
+  double best = 1e9, bestBuild = 1e9;
+  for (int k = 0; k < repeats; k += 1) {
+    auto begin = std::chrono::steady_clock::now();
+    grid.build(trainKeypoints, train);
+    bestBuild = std::min(bestBuild, elapsed(begin));
+    matches.clear();
+    pislam::matchRadius(queryKeypoints, query, grid, r, matches);
+    best = std::min(best, elapsed(begin));
+  }
+
+  // exhaustive search of the same windows
+  double exhaustive = 1e9;
+  size_t found = 0;
+  for (int k = 0; k < repeats; k += 1) {
+    auto begin = std::chrono::steady_clock::now();
+    found = 0;
+    for (int i = 0; i < count; i += 1) {
+      int qx = pislam::decodeFastX(queryKeypoints[i]);
+      int qy = pislam::decodeFastY(queryKeypoints[i]);
+      int level = grid.level(qy);
+      pislam::NearestMatch m = {-1, pislam::matchNoDistance,
+        pislam::matchNoDistance};
+      for (int j = 0; j < count; j += 1) {
+        int tx = pislam::decodeFastX(trainKeypoints[j]);
+        int ty = pislam::decodeFastY(trainKeypoints[j]);
+        if (std::abs(tx - qx) <= r && std::abs(ty - qy) <= r &&
+            grid.level(ty) == level) {
+          pislam::matchUpdate(pislam::hammingDistance(&query[i*w],
+                &train[j*w]), j, m);
+        }
+      }
+      found += m.train >= 0 && m.distance < 0.8f * m.second;
+    }
+    exhaustive = std::min(exhaustive, elapsed(begin));
+  }
+
+  printf("radius %d: grid %.3f ms (build %.3f ms), exhaustive %.3f ms, "
+      "%zu matches%s\n", r, best, bestBuild, exhaustive, matches.size(),
+      found == matches.size() ? "" : "  MISMATCH");
+}
+
+static double time(NearestFn fn, const std::vector<uint32_t> &query,
+    const std::vector<uint32_t> &train, std::vector<pislam::NearestMatch> &out) {
+  double best = 1e9;
+  for (int r = 0; r < repeats; r += 1) {
+    auto begin = std::chrono::steady_clock::now();
+    fn(query.data(), count, train.data(), count, out.data());
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(best,
+        std::chrono::duration<double, std::milli>(end - begin).count());
+  }
+  return best;
+}
+
+// Print the time of `fn` relative to `baseline`, or to itself if zero.
+static double report(const char *name, NearestFn fn,
+    const std::vector<uint32_t> &query, const std::vector<uint32_t> &train,
+    const std::vector<pislam::NearestMatch> &expected, double baseline) {
+  std::vector<pislam::NearestMatch> out(count);
+  double ms = time(fn, query, train, out);
+
+  bool same = true;
+  for (int i = 0; i < count; i += 1) {
+    same = same && out[i].train == expected[i].train &&
+      out[i].distance == expected[i].distance &&
+      out[i].second == expected[i].second;
+  }
+  printf("%-8s %8.3f ms %6.1fx%s\n", name, ms, baseline ? baseline / ms : 1.0,
+      same ? "" : "  MISMATCH");
+  return ms;
+}
+
+int main() {
+  std::mt19937 rng(1);
+  std::vector<uint32_t> query(count * pislam::matchWords);
+  std::vector<uint32_t> train(count * pislam::matchWords);
+  for (uint32_t &w : query) w = rng();
+  for (uint32_t &w : train) w = rng();
+
+  std::vector<pislam::NearestMatch> expected(count);
+  pislam::ref::matchNearest(query.data(), count, train.data(), count,
+      expected.data());
+
+  printf("%d x %d matches, best of %d\n", count, count, repeats);
+  double baseline = report("lut", pislam::ref::matchNearest,
+      query, train, expected, 0);
+  report("scalar", pislam::matchNearestScalar, query, train, expected, baseline);
+#if defined(PISLAM_NEON)
+  report("neon", pislam::matchNearestNeon, query, train, expected, baseline);
+#endif
+#if defined(PISLAM_X86)
+  if (pislam::cpuSupportsPopcnt()) {
+    report("popcnt", pislam::matchNearestPopcnt, query, train, expected, baseline);
+  }
+  if (pislam::cpuSupportsAvx2()) {
+    report("avx2", pislam::matchNearestAvx2, query, train, expected, baseline);
+  }
+#endif
+
+  printf("\n");
+  radius(rng, train, 20);
+  return 0;
+}
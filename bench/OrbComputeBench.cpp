@@ -0,0 +1,104 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+// Time orbCompute on 500 to 4000 keypoints of a 640x480 noise image,
+// reusing one OrbContext as a frame loop would, with the unrolled and the
+// table driven BRIEF kernels, and orbComputeSteered.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "../include/Orb.h"
+#include "../include/OrbContext.h"
+#include "../include/OrbSteered.h"
+#include "../include/Util.h"
+
+static const int width = 640;
+static const int height = 480;
+static const int repeats = 20;
+
+typedef uint8_t (*image_t)[width];
+
+template <bool tableBrief>
+static double time(const std::vector<uint8_t> &img,
+    const std::vector<pislam::Keypoint> &points, pislam::OrbContext &context) {
+  std::vector<uint32_t> descriptors;
+  double best = 1e9;
+  for (int r = 0; r < repeats; r += 1) {
+    descriptors.clear();
+    auto begin = std::chrono::steady_clock::now();
+    pislam::orbCompute<width, 8, tableBrief>((image_t)img.data(), points,
+        descriptors, context);
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(best,
+        std::chrono::duration<double, std::milli>(end - begin).count());
+  }
+  return best;
+}
+
+static double timeSteered(const std::vector<uint8_t> &img,
+    const std::vector<pislam::Keypoint> &points) {
+  std::vector<uint32_t> descriptors;
+  std::vector<float> angles;
+  double best = 1e9;
+  for (int r = 0; r < repeats; r += 1) {
+    descriptors.clear();
+    angles.clear();
+    auto begin = std::chrono::steady_clock::now();
+    pislam::orbComputeSteered<width, 8>((image_t)img.data(), points,
+        descriptors, angles);
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(best,
+        std::chrono::duration<double, std::milli>(end - begin).count());
+  }
+  return best;
+}
+
+int main() {
+  std::mt19937 rng(1);
+  std::vector<uint8_t> img(width * height);
+  for (uint8_t &p : img) {
+    p = rng();
+  }
+
+  pislam::OrbContext context;
+
+  printf("%d x %d image, best of %d\n", width, height, repeats);
+  for (int count : {500, 1000, 2000, 4000}) {
+    // in row order, as produced by fastExtract
+    std::vector<pislam::Keypoint> points;
+    for (int i = 0; i < count; i += 1) {
+      points.push_back(pislam::encodeFast(0, 19 + rng() % (width - 38),
+            19 + rng() % (height - 38)));
+    }
+    std::sort(points.begin(), points.end(), [](pislam::Keypoint a, pislam::Keypoint b) {
+      return pislam::decodeFastY(a) < pislam::decodeFastY(b);
+    });
+
+    double unrolled = time<false>(img, points, context);
+    double table = time<true>(img, points, context);
+    double steered = timeSteered(img, points);
+    printf("%5d points  unrolled %8.3f ms  table %8.3f ms  steered %8.3f ms\n",
+        count, unrolled, table, steered);
+  }
+  return 0;
+}
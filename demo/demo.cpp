@@ -20,6 +20,8 @@
 #include "Fast.h"
 #include "Util.h"
 #include "Orb.h"
+#include "OrbContext.h"
+#include "Pyramid.h"
 
 #include <png.h>
 
@@ -50,7 +52,7 @@ static int pyramidLevels[16] = {
 
 int main(int argc, char **argv) {
   if (argc < 2) {
-    std::cerr << "Usage: ./demo pyramid.png" << std::endl;
+    std::cerr << "Usage: ./demo pyramid.png|frame.png" << std::endl;
     return 1;
   }
 
@@ -65,15 +67,39 @@ int main(int argc, char **argv) {
   uint8_t (*img)[IMG_W] = (uint8_t (*)[IMG_W])read_png_file(fname, &width, &height);
 
   assert(width == IMG_W && "Image width does not match compiled width");
-  assert(height == pyramidHeight && "Image height does not match compiled pyramid height");
 
-  uint8_t out[pyramidHeight][IMG_W];
+  // A raw frame is blurred and reduced into a pyramid here, otherwise the
+  // image must already be a pyramid with the dimensions above.
+  bool rawFrame = height == (uint32_t)pyramidLevels[1];
+  if (rawFrame) {
+    pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+    pyramidHeight = pislam::pyramidLevels(width, height, levels);
+    for (int i = 0; i < pislam::pyramidLevelCount; i += 1) {
+      pyramidLevels[2*i] = levels[i].width;
+      pyramidLevels[2*i+1] = levels[i].height;
+    }
+    img = (uint8_t (*)[IMG_W])realloc(img, pyramidHeight*IMG_W);
+  }
+
+  assert((height == pyramidHeight || rawFrame) && "Image height does not match compiled pyramid height");
 
-  std::vector<uint32_t> points;
+  // Scratch memory, including the score plane, is held by the context
+  // and reused, so a frame loop would not touch the allocator.
+  pislam::OrbContext context(IMG_W, pyramidHeight, 4096);
+  uint8_t (*out)[IMG_W] = context.scorePlane<IMG_W>();
+
+  std::vector<pislam::Keypoint> points;
   std::vector<uint32_t> descriptors;
+  points.reserve(4096);
+  descriptors.reserve(4096 * 8);
 
   std::clock_t begin = std::clock();
 
+  if (rawFrame) {
+    pislam::buildPyramid<IMG_W>(width, height, img, img, context);
+    height = pyramidHeight;
+  }
+
   uint32_t pyramidRow = 0;
   for (size_t i = 0; i < sizeof(pyramidLevels)/sizeof(*pyramidLevels); i += 2) {
     uint32_t levelWidth = pyramidLevels[i];
@@ -86,23 +112,21 @@ int main(int argc, char **argv) {
     pislam::fastScoreHarris<IMG_W, 16>(levelWidth, levelHeight, imgPtr, 1 << 15, outPtr);
 
     size_t oldSize = points.size();
-    pislam::fastExtract<IMG_W, 16>(levelWidth, levelHeight, outPtr, points);
+    pislam::fastExtract<IMG_W, 16>(levelWidth, levelHeight, outPtr, points,
+        context);
 
     // Adjust y coordinate to match position in image pyramid.
     for (auto p = points.begin() + oldSize; p < points.end(); ++ p) {
-      uint32_t x = pislam::decodeFastX(*p);
-      uint32_t y = pislam::decodeFastY(*p) + pyramidRow;
-      uint32_t score = pislam::decodeFastScore(*p);
-      *p = pislam::encodeFast(score, x, y);
+      *p = pislam::rencodeFastLevel(*p, pyramidRow, i/2);
     }
 
     pyramidRow += levelHeight;
   }
-  pislam::orbCompute<IMG_W, 8>(img, points, descriptors);
+  pislam::orbCompute<IMG_W, 8>(img, points, descriptors, context);
 
   std::clock_t end = std::clock();
 
-  for (uint32_t point: points) {
+  for (pislam::Keypoint point: points) {
     uint32_t x = pislam::decodeFastX(point);
     uint32_t y = pislam::decodeFastY(point);
     paintPoint(img, x, y);
@@ -49,7 +49,10 @@ bool briefBit(uint8_t base[][vstep]) {
   constexpr int cdx1 = mindx1 > 15 ? 15 : mindx1;
   constexpr int cdy1 = mindy1 > 15 ? 15 : mindy1;
 
-  return base[cdy0][cdx0] < base[cdy1][cdx1];
+  // index through a flat pointer: negative offsets are undefined on the
+  // inner array type and gcc flags them with -Warray-bounds.
+  const uint8_t *p = base[0];
+  return p[cdy0 * vstep + cdx0] < p[cdy1 * vstep + cdx1];
 }
 
 /// Compute BRIEF descriptor at a particular rotation, descretized `[0..30)`.
@@ -0,0 +1,353 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+#ifndef PISLAM_BRIEF_TABLE_H_
+#define PISLAM_BRIEF_TABLE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "Platform.h"
+
+namespace pislam {
+
+/// The 256 point pairs {dx0, dy0, dx1, dy1} of the BRIEF pattern, in the
+/// same order as the bits produced by briefDescribeRot.
+static const int8_t briefPattern[256][4] = {
+  {  8, -3,  9,  5}, {  4,  2,  7,-12}, {-11,  9, -8,  2}, {  7,-12, 12,-13},
+  {  2,-13,  2, 12}, {  1, -7,  1,  6}, { -2,-10, -2, -4}, {-13,-13,-11, -8},
+  {-13, -3,-12, -9}, { 10,  4, 11,  9}, {-13, -8, -8, -9}, {-11,  7, -9, 12},
+  {  7,  7, 12,  6}, { -4, -5, -3,  0}, {-13,  2,-12, -3}, { -9,  0, -7,  5},
+  { 12, -6, 12, -1}, { -3,  6, -2, 12}, { -6,-13, -4, -8}, { 11,-13, 12, -8},
+  {  4,  7,  5,  1}, {  5, -3, 10, -3}, {  3, -7,  6, 12}, { -8, -7, -6, -2},
+  { -2, 11, -1,-10}, {-13, 12, -8, 10}, { -7,  3, -5, -3}, { -4,  2, -3,  7},
+  {-10,-12, -6, 11}, {  5,-12,  6, -7}, {  5, -6,  7, -1}, {  1,  0,  4, -5},
+  {  9, 11, 11,-13}, {  4,  7,  4, 12}, {  2, -1,  4,  4}, { -4,-12, -2,  7},
+  { -8, -5, -7,-10}, {  4, 11,  9, 12}, {  0, -8,  1,-13}, {-13, -2, -8,  2},
+  { -3, -2, -2,  3}, { -6,  9, -4, -9}, {  8, 12, 10,  7}, {  0,  9,  1,  3},
+  {  7, -5, 11,-10}, {-13, -6,-11,  0}, { 10,  7, 12,  1}, { -6, -3, -6, 12},
+  { 10, -9, 12, -4}, {-13,  8, -8,-12}, {-13,  0, -8, -4}, {  3,  3,  7,  8},
+  {  5,  7, 10, -7}, { -1,  7,  1,-12}, {  3,-10,  5,  6}, {  2, -4,  3,-10},
+  {-13,  0,-13,  5}, {-13, -7,-12, 12}, {-13,  3,-11,  8}, { -7, 12, -4,  7},
+  {  6,-10, 12,  8}, { -9, -1, -7, -6}, { -2, -5,  0, 12}, {-12,  5, -7,  5},
+  {  3,-10,  8,-13}, { -7, -7, -4,  5}, { -3, -2, -1, -7}, {  2,  9,  5,-11},
+  {-11,-13, -5,-13}, { -1,  6,  0, -1}, {  5, -3,  5,  2}, { -4,-13, -4, 12},
+  { -9, -6, -9,  6}, {-12,-10, -8, -4}, { 10,  2, 12, -3}, {  7, 12, 12, 12},
+  { -7,-13, -6,  5}, { -4,  9, -3,  4}, {  7, -1, 12,  2}, { -7,  6, -5,  1},
+  {-13, 11,-12,  5}, { -3,  7, -2, -6}, {  7, -8, 12, -7}, {-13, -7,-11,-12},
+  {  1, -3, 12, 12}, {  2, -6,  3,  0}, { -4,  3, -2,-13}, { -1,-13,  1,  9},
+  {  7,  1,  8, -6}, {  1, -1,  3, 12}, {  9,  1, 12,  6}, { -1, -9, -1,  3},
+  {-13,-13,-10,  5}, {  7,  7, 10, 12}, { 12, -5, 12,  9}, {  6,  3,  7, 11},
+  {  5,-13,  6, 10}, {  2,-12,  2,  3}, {  3,  8,  4, -6}, {  2,  6, 12,-13},
+  {  9,-12, 10,  3}, { -8,  4, -7,  9}, {-11, 12, -4, -6}, {  1, 12,  2, -8},
+  {  6, -9,  7, -4}, {  2,  3,  3, -2}, {  6,  3, 11,  0}, {  3, -3,  8, -8},
+  {  7,  8,  9,  3}, {-11, -5, -6, -4}, {-10, 11, -5, 10}, { -5, -8, -3, 12},
+  {-10,  5, -9,  0}, {  8, -1, 12, -6}, {  4, -6,  6,-11}, {-10, 12, -8,  7},
+  {  4, -2,  6,  7}, { -2,  0, -2, 12}, { -5, -8, -5,  2}, {  7, -6, 10, 12},
+  { -9,-13, -8, -8}, { -5,-13, -5, -2}, {  8, -8,  9,-13}, { -9,-11, -9,  0},
+  {  1, -8,  1, -2}, {  7, -4,  9,  1}, { -2,  1, -1, -4}, { 11, -6, 12,-11},
+  {-12, -9, -6,  4}, {  3,  7,  7, 12}, {  5,  5, 10,  8}, {  0, -4,  2,  8},
+  { -9, 12, -5,-13}, {  0,  7,  2, 12}, { -1,  2,  1,  7}, {  5, 11,  7, -9},
+  {  3,  5,  6, -8}, {-13, -4, -8,  9}, { -5,  9, -3, -3}, { -4, -7, -3,-12},
+  {  6,  5,  8,  0}, { -7,  6, -6, 12}, {-13,  6, -5, -2}, {  1,-10,  3, 10},
+  {  4,  1,  8, -4}, { -2, -2,  2,-13}, {  2,-12, 12, 12}, { -2,-13,  0, -6},
+  {  4,  1,  9,  3}, { -6,-10, -3, -5}, { -3,-13, -1,  1}, {  7,  5, 12,-11},
+  {  4, -2,  5, -7}, {-13,  9, -9, -5}, {  7,  1,  8,  6}, {  7, -8,  7,  6},
+  { -7, -4, -7,  1}, { -8, 11, -7, -8}, {-13,  6,-12, -8}, {  2,  4,  3,  9},
+  { 10, -5, 12,  3}, { -6, -5, -6,  7}, {  8, -3,  9, -8}, {  2,-12,  2,  8},
+  {-11, -2,-10,  3}, {-12,-13, -7, -9}, {-11,  0,-10, -5}, {  5, -3, 11,  8},
+  { -2,-13, -1, 12}, { -1, -8,  0,  9}, {-13,-11,-12, -5}, {-10, -2,-10, 11},
+  { -3,  9, -2,-13}, {  2, -3,  3,  2}, { -9,-13, -4,  0}, { -4,  6, -3,-10},
+  { -4, 12, -2, -7}, { -6,-11, -4,  9}, {  6, -3,  6, 11}, {-13, 11, -5,  5},
+  { 11, 11, 12,  6}, {  7, -5, 12, -2}, { -1, 12,  0,  7}, { -4, -8, -3, -2},
+  { -7,  1, -6,  7}, {-13,-12, -8,-13}, { -7, -2, -6, -8}, { -8,  5, -6, -9},
+  { -5, -1, -4,  5}, {-13,  7, -8, 10}, {  1,  5,  5,-13}, {  1,  0, 10,-13},
+  {  9, 12, 10, -1}, {  5, -8, 10, -9}, { -1, 11,  1,-13}, { -9, -3, -6,  2},
+  { -1,-10,  1, 12}, {-13,  1, -8,-10}, {  8,-11, 10, -6}, {  2,-13,  3, -6},
+  {  7,-13, 12, -9}, {-10,-10, -5, -7}, {-10, -8, -8,-13}, {  4, -6,  8,  5},
+  {  3, 12,  8,-13}, { -4,  2, -3, -3}, {  5,-13, 10,-12}, {  4,-13,  5, -1},
+  { -9,  9, -4,  3}, {  0,  3,  3, -9}, {-12,  1, -6,  1}, {  3,  2,  4, -8},
+  {-10,-10,-10,  9}, {  8,-13, 12, 12}, { -8,-12, -6, -5}, {  2,  2,  3,  7},
+  { 10,  6, 11, -8}, {  6,  8,  8,-12}, { -7, 10, -6,  5}, { -3, -9, -3,  9},
+  { -1,-13, -1,  5}, { -3, -7, -3,  4}, { -8, -2, -8,  3}, {  4,  2, 12, 12},
+  {  2, -5,  3, 11}, {  6, -9, 11,-13}, {  3, -1,  7, 12}, { 11, -1, 12,  4},
+  { -3,  0, -3,  6}, {  4,-11,  4, 12}, {  2, -4,  2,  1}, {-10, -6, -8,  1},
+  {-13,  7,-11,  1}, {-13, 12,-11,-13}, {  6,  0, 11,-13}, {  0, -1,  1,  4},
+  {-13,  3, -9, -2}, { -9,  8, -6, -3}, {-13, -6, -8, -2}, {  5, -9,  8, 10},
+  {  2,  7,  3, -9}, { -1, -6, -1, -1}, {  9,  5, 11, -2}, { 11, -3, 12, -8},
+  {  3,  0,  3,  5}, { -1,  4,  0, 10}, {  3, -6,  4,  5}, {-13,  0,-10,  5},
+  {  5,  8, 12, 11}, {  8,  9,  9, -6}, {  7, -4,  8,-12}, {-10,  4,-10,  9},
+  {  7,  3, 12,  4}, {  9, -7, 10, -2}, {  7,  0, 12, -2}, { -1, -6,  0,-11},
+};
+
+/// Rotate the pattern by `theta` radians, writing the offset of each
+/// pixel from the keypoint in an image with rows of `vstep` bytes.
+/// offsets[0][b] and offsets[1][b] are the pixels compared for bit b.
+///
+/// Coordinates are rounded and clamped to the 31x31 patch exactly as by
+/// briefBit, whose compile time arithmetic is single precision without
+/// fused multiply-adds, so the rotation is compiled without them too.
+PISLAM_NO_FP_CONTRACT
+inline void briefRotatePattern(float theta, int vstep,
+    int32_t offsets[2][256]) {
+  const float c = cosf(theta);
+  const float s = sinf(theta);
+
+  for (int b = 0; b < 256; b += 1) {
+    const int8_t *p = briefPattern[b];
+    for (int i = 0; i < 2; i += 1) {
+      const float dx = p[2*i], dy = p[2*i + 1];
+      int rx = std::min(15, std::max(-15, (int)roundf(c*dx - s*dy)));
+      int ry = std::min(15, std::max(-15, (int)roundf(s*dx + c*dy)));
+      offsets[i][b] = ry*vstep + rx;
+    }
+  }
+}
+
+/// Rotated patterns for the 30 discrete orientations produced by atan2,
+/// built on first use. The table is 60 KB, but a kernel only touches the
+/// 2 KB of one rotation, and the same code serves every rotation.
+template <int vstep>
+class BriefTable {
+ public:
+  static const BriefTable &get() {
+    static const BriefTable table;
+    return table;
+  }
+
+  /// offsets[rot], as written by briefRotatePattern.
+  int32_t offsets[30][2][256];
+
+ private:
+  BriefTable() {
+    for (int rot = 0; rot < 30; rot += 1) {
+      briefRotatePattern(rot * M_PI / 15, vstep, offsets[rot]);
+    }
+  }
+};
+
+/// The pattern as floats, one array per coordinate, for steering.
+struct BriefPatternFloat {
+  float x[2][256];
+  float y[2][256];
+
+  static const BriefPatternFloat &get() {
+    static const BriefPatternFloat pattern;
+    return pattern;
+  }
+
+ private:
+  BriefPatternFloat() {
+    for (int b = 0; b < 256; b += 1) {
+      x[0][b] = briefPattern[b][0];
+      y[0][b] = briefPattern[b][1];
+      x[1][b] = briefPattern[b][2];
+      y[1][b] = briefPattern[b][3];
+    }
+  }
+};
+
+/// Offsets of the points (px, py) rotated by cos a, sin b and rounded
+/// half to even, as cvRound does on x86 and AArch64.
+PISLAM_NO_FP_CONTRACT
+static inline void briefSteerScalar(const float *px, const float *py,
+    float a, float b, int vstep, int32_t *out) {
+  for (int i = 0; i < 256; i += 1) {
+    float xa = px[i]*a, yb = py[i]*b;
+    float xb = px[i]*b, ya = py[i]*a;
+    out[i] = lrintf(xb + ya)*vstep + lrintf(xa - yb);
+  }
+}
+
+#if defined(PISLAM_NEON) && defined(__aarch64__)
+PISLAM_NO_FP_CONTRACT
+static inline void briefSteerNeon(const float *px, const float *py,
+    float a, float b, int vstep, int32_t *out) {
+  const float32x4_t va = vdupq_n_f32(a);
+  const float32x4_t vb = vdupq_n_f32(b);
+  const int32x4_t step = vdupq_n_s32(vstep);
+  for (int i = 0; i < 256; i += 4) {
+    float32x4_t x = vld1q_f32(&px[i]);
+    float32x4_t y = vld1q_f32(&py[i]);
+    float32x4_t rx = vsubq_f32(vmulq_f32(x, va), vmulq_f32(y, vb));
+    float32x4_t ry = vaddq_f32(vmulq_f32(x, vb), vmulq_f32(y, va));
+    int32x4_t ix = vcvtnq_s32_f32(rx);
+    int32x4_t iy = vcvtnq_s32_f32(ry);
+    vst1q_s32(&out[i], vmlaq_s32(ix, iy, step));
+  }
+}
+#endif
+
+#if defined(PISLAM_X86)
+/// vcvtps2dq rounds by the current mode, which is half to even unless
+/// the caller has changed it.
+PISLAM_TARGET_AVX2 PISLAM_NO_FP_CONTRACT
+static inline void briefSteerAvx2(const float *px, const float *py,
+    float a, float b, int vstep, int32_t *out) {
+  const __m256 va = _mm256_set1_ps(a);
+  const __m256 vb = _mm256_set1_ps(b);
+  const __m256i step = _mm256_set1_epi32(vstep);
+  for (int i = 0; i < 256; i += 8) {
+    __m256 x = _mm256_loadu_ps(&px[i]);
+    __m256 y = _mm256_loadu_ps(&py[i]);
+    __m256 rx = _mm256_sub_ps(_mm256_mul_ps(x, va), _mm256_mul_ps(y, vb));
+    __m256 ry = _mm256_add_ps(_mm256_mul_ps(x, vb), _mm256_mul_ps(y, va));
+    __m256i ix = _mm256_cvtps_epi32(rx);
+    __m256i iy = _mm256_cvtps_epi32(ry);
+    _mm256_storeu_si256((__m256i *)&out[i],
+        _mm256_add_epi32(ix, _mm256_mullo_epi32(iy, step)));
+  }
+}
+#endif
+
+/// Rotate the pattern to an angle in degrees exactly as OpenCV's ORB
+/// does when computing descriptors: the angle is converted to radians
+/// in single precision, its cosine and sine are taken in double
+/// precision and narrowed, the pattern is rotated in single precision
+/// without clamping to the patch, and coordinates are rounded half to
+/// even. Descriptors evaluated with briefDescribeTable then match
+/// OpenCV's bit for bit, provided its build does not fuse the rotation
+/// into multiply-adds.
+///
+/// Rotated points reach 18 pixels from the keypoint.
+inline void briefSteerPattern(float degrees, int vstep,
+    int32_t offsets[2][256]) {
+  const BriefPatternFloat &pattern = BriefPatternFloat::get();
+  const float angle = degrees * (float)(M_PI/180.f);
+  const float a = (float)std::cos((double)angle);
+  const float b = (float)std::sin((double)angle);
+
+  for (int i = 0; i < 2; i += 1) {
+#if defined(PISLAM_NEON) && defined(__aarch64__)
+    briefSteerNeon(pattern.x[i], pattern.y[i], a, b, vstep, offsets[i]);
+#elif defined(PISLAM_X86)
+    if (cpuSupportsAvx2()) {
+      briefSteerAvx2(pattern.x[i], pattern.y[i], a, b, vstep, offsets[i]);
+    } else {
+      briefSteerScalar(pattern.x[i], pattern.y[i], a, b, vstep, offsets[i]);
+    }
+#else
+    briefSteerScalar(pattern.x[i], pattern.y[i], a, b, vstep, offsets[i]);
+#endif
+  }
+}
+
+/// Compute the BRIEF descriptor at (x, y) by comparing the pixel pairs
+/// of a rotated pattern from briefRotatePattern. Portable version.
+template <int vstep, int words>
+void briefDescribeTableScalar(uint8_t img[][vstep], int x, int y,
+    const int32_t offsets[2][256], uint32_t descriptor[words]) {
+  const uint8_t *base = &img[y][x];
+  for (int w = 0; w < words; w += 1) {
+    uint32_t bits = 0;
+    for (int b = 0; b < 32; b += 1) {
+      if (base[offsets[0][w*32 + b]] < base[offsets[1][w*32 + b]]) {
+        bits |= 1u << b;
+      }
+    }
+    descriptor[w] = bits;
+  }
+}
+
+#if defined(PISLAM_NEON)
+/// NEON has no gather, so 32 pairs are loaded lane by lane, compared in
+/// two vectors and packed into a word with pairwise adds of the lane
+/// weights.
+template <int vstep, int words>
+void briefDescribeTableNeon(uint8_t img[][vstep], int x, int y,
+    const int32_t offsets[2][256], uint32_t descriptor[words]) {
+  const uint8_t *base = &img[y][x];
+  static const uint8_t weightBytes[16] = {
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+  };
+  const uint8x16_t weights = vld1q_u8(weightBytes);
+
+  for (int w = 0; w < words; w += 1) {
+    uint8_t a[32], b[32];
+    for (int i = 0; i < 32; i += 1) {
+      a[i] = base[offsets[0][w*32 + i]];
+      b[i] = base[offsets[1][w*32 + i]];
+    }
+    uint8x16_t lt0 = vandq_u8(vcltq_u8(vld1q_u8(&a[0]), vld1q_u8(&b[0])),
+        weights);
+    uint8x16_t lt1 = vandq_u8(vcltq_u8(vld1q_u8(&a[16]), vld1q_u8(&b[16])),
+        weights);
+
+    // Each byte holds distinct bits, so adding is or-ing.
+    uint8x8_t sum = vpadd_u8(
+        vpadd_u8(vget_low_u8(lt0), vget_high_u8(lt0)),
+        vpadd_u8(vget_low_u8(lt1), vget_high_u8(lt1)));
+    sum = vpadd_u8(sum, sum);
+
+    descriptor[w] = vget_lane_u8(sum, 0) | vget_lane_u8(sum, 1) << 8 |
+      vget_lane_u8(sum, 2) << 16 | vget_lane_u8(sum, 3) << 24;
+  }
+}
+#endif
+
+#if defined(PISLAM_X86)
+/// Eight pairs per gather. vpgatherdd loads a dword at each offset, so
+/// up to 3 bytes to the right of the patch must be readable; with the
+/// usual 16 pixel border they are.
+template <int vstep, int words>
+PISLAM_TARGET_AVX2
+void briefDescribeTableAvx2(uint8_t img[][vstep], int x, int y,
+    const int32_t offsets[2][256], uint32_t descriptor[words]) {
+  const int *base = (const int *)&img[y][x];
+  const __m256i lowByte = _mm256_set1_epi32(0xff);
+
+  for (int w = 0; w < words; w += 1) {
+    uint32_t bits = 0;
+    for (int g = 0; g < 4; g += 1) {
+      __m256i i0 = _mm256_loadu_si256((const __m256i *)&offsets[0][w*32 + g*8]);
+      __m256i i1 = _mm256_loadu_si256((const __m256i *)&offsets[1][w*32 + g*8]);
+      __m256i a = _mm256_and_si256(_mm256_i32gather_epi32(base, i0, 1), lowByte);
+      __m256i b = _mm256_and_si256(_mm256_i32gather_epi32(base, i1, 1), lowByte);
+      __m256i lt = _mm256_cmpgt_epi32(b, a);
+      bits |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(lt)) << (g*8);
+    }
+    descriptor[w] = bits;
+  }
+}
+#endif
+
+/// Table driven alternative to briefDescribe, producing identical
+/// descriptors from a pattern rotated by briefRotatePattern. One small
+/// kernel serves every rotation, so it suits cores whose instruction
+/// cache cannot hold the unrolled rotations, and it accepts patterns
+/// rotated to any angle.
+template <int vstep, int words>
+void briefDescribeTable(uint8_t img[][vstep], int x, int y,
+    const int32_t offsets[2][256], uint32_t descriptor[words]) {
+#if defined(PISLAM_NEON)
+  briefDescribeTableNeon<vstep, words>(img, x, y, offsets, descriptor);
+#else
+#if defined(PISLAM_X86)
+  if (cpuSupportsAvx2()) {
+    briefDescribeTableAvx2<vstep, words>(img, x, y, offsets, descriptor);
+    return;
+  }
+#endif
+  briefDescribeTableScalar<vstep, words>(img, x, y, offsets, descriptor);
+#endif
+}
+
+} /* namespace pislam */
+
+#endif /* PISLAM_BRIEF_TABLE_H_ */
@@ -20,19 +20,132 @@
 #ifndef PISLAM_FAST_H_
 #define PISLAM_FAST_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
 #include <vector>
 
-#include "arm_neon.h"
-
+#include "OrbContext.h"
+#include "Platform.h"
 #include "Util.h"
+
 #include "Harris.h"
 
 namespace pislam {
 
+#if defined(PISLAM_NEON)
+/// Whether the dark (`d0`, `d1`) or light (`l0`, `l1`) bits of each lane
+/// of the ring hold the 9 consecutive clear bits of a corner, as 0xff or
+/// 0x00 per lane.
+static inline uint8x16_t fastArcNeon(uint8x16_t d0, uint8x16_t l0,
+    uint8x16_t d1, uint8x16_t l1) {
+  // Determine whether to test dark or light pattern.
+  // 8 consecutive bits implies d0 & d1 == 0.
+  uint8x16_t t0 = vtstq_u8(d0, d1);
+  uint8x16_t t1 = vtstq_u8(d0, d1);
+
+  t0 = vbslq_u8(t0, l0, d0);
+  t1 = vbslq_u8(t1, l1, d1);
+
+  uint8x16_t cntLo = vclzq_u8(t0);
+  uint8x16_t testLo = t1 << (cntLo - 1);
+#if defined(__aarch64__)
+  testLo = vceqzq_u8(testLo);
+#else
+  asm("vceq.u8  %q0, %q0, #0" : [val] "+w" (testLo));
+#endif
+
+  uint8x16_t cntHi = vclzq_u8(t1);
+  uint8x16_t testHi = t0 << (cntHi - 1);
+#if defined(__aarch64__)
+  testHi = vceqzq_u8(testHi);
+#else
+  asm("vceq.u8  %q0, %q0, #0" : [val] "+w" (testHi));
+#endif
+
+  uint8x16_t result = (cntLo & testLo) | (cntHi & testHi);
+  return vtstq_u8(result, result);
+}
+
+/// Classify 16 pixels starting at `img[y][x]`, returning 0xff for each
+/// detected point.
+template <int vstep>
+static inline uint8x16_t fastDetectNeonBlock(uint8_t img[][vstep], int x, int y,
+    uint8x16_t vthreshold) {
+  uint8x16_t c = vld1q_u8(&img[y+0][x+0]);
+  uint8x16_t light = vqaddq_u8(c, vthreshold);
+  uint8x16_t dark = vqsubq_u8(c, vthreshold);
+
+  uint8x16_t test = vld1q_u8(&img[y-3][x-1]);
+  uint8x16_t d0 = vcgeq_u8(test, dark);
+  uint8x16_t l0 = vcleq_u8(test, light);
+
+  test = vld1q_u8(&img[y-3][x+0]);
+  d0 = vbslq_u8(vdupq_n_u8(0x40u), vcgeq_u8(test, dark), d0);
+  l0 = vbslq_u8(vdupq_n_u8(0x40u), vcleq_u8(test, light), l0);
+
+  test = vld1q_u8(&img[y-3][x+1]);
+  d0 = vbslq_u8(vdupq_n_u8(0x20u), vcgeq_u8(test, dark), d0);
+  l0 = vbslq_u8(vdupq_n_u8(0x20u), vcleq_u8(test, light), l0);
+
+  test = vld1q_u8(&img[y-2][x+2]);
+  d0 = vbslq_u8(vdupq_n_u8(0x10u), vcgeq_u8(test, dark), d0);
+  l0 = vbslq_u8(vdupq_n_u8(0x10u), vcleq_u8(test, light), l0);
+
+  test = vld1q_u8(&img[y-1][x+3]);
+  d0 = vbslq_u8(vdupq_n_u8(0x08u), vcgeq_u8(test, dark), d0);
+  l0 = vbslq_u8(vdupq_n_u8(0x08u), vcleq_u8(test, light), l0);
+  
+  test = vld1q_u8(&img[y+0][x+3]);
+  d0 = vbslq_u8(vdupq_n_u8(0x04u), vcgeq_u8(test, dark), d0);
+  l0 = vbslq_u8(vdupq_n_u8(0x04u), vcleq_u8(test, light), l0);
+  
+  test = vld1q_u8(&img[y+1][x+3]);
+  d0 = vbslq_u8(vdupq_n_u8(0x02u), vcgeq_u8(test, dark), d0);
+  l0 = vbslq_u8(vdupq_n_u8(0x02u), vcleq_u8(test, light), l0);
+  
+  test = vld1q_u8(&img[y+2][x+2]);
+  d0 = vbslq_u8(vdupq_n_u8(0x01u), vcgeq_u8(test, dark), d0);
+  l0 = vbslq_u8(vdupq_n_u8(0x01u), vcleq_u8(test, light), l0);
+  
+  test = vld1q_u8(&img[y+3][x+1]);
+  uint8x16_t d1 = vcgeq_u8(test, dark);
+  uint8x16_t l1 = vcleq_u8(test, light);
+
+  test = vld1q_u8(&img[y+3][x+0]);
+  d1 = vbslq_u8(vdupq_n_u8(0x40u), vcgeq_u8(test, dark), d1);
+  l1 = vbslq_u8(vdupq_n_u8(0x40u), vcleq_u8(test, light), l1);
+
+  test = vld1q_u8(&img[y+3][x-1]);
+  d1 = vbslq_u8(vdupq_n_u8(0x20u), vcgeq_u8(test, dark), d1);
+  l1 = vbslq_u8(vdupq_n_u8(0x20u), vcleq_u8(test, light), l1);
+
+  test = vld1q_u8(&img[y+2][x-2]);
+  d1 = vbslq_u8(vdupq_n_u8(0x10u), vcgeq_u8(test, dark), d1);
+  l1 = vbslq_u8(vdupq_n_u8(0x10u), vcleq_u8(test, light), l1);
+
+  test = vld1q_u8(&img[y+1][x-3]);
+  d1 = vbslq_u8(vdupq_n_u8(0x08u), vcgeq_u8(test, dark), d1);
+  l1 = vbslq_u8(vdupq_n_u8(0x08u), vcleq_u8(test, light), l1);
+  
+  test = vld1q_u8(&img[y+0][x-3]);
+  d1 = vbslq_u8(vdupq_n_u8(0x04u), vcgeq_u8(test, dark), d1);
+  l1 = vbslq_u8(vdupq_n_u8(0x04u), vcleq_u8(test, light), l1);
+  
+  test = vld1q_u8(&img[y-1][x-3]);
+  d1 = vbslq_u8(vdupq_n_u8(0x02u), vcgeq_u8(test, dark), d1);
+  l1 = vbslq_u8(vdupq_n_u8(0x02u), vcleq_u8(test, light), l1);
+  
+  test = vld1q_u8(&img[y-2][x-2]);
+  d1 = vbslq_u8(vdupq_n_u8(0x01u), vcgeq_u8(test, dark), d1);
+  l1 = vbslq_u8(vdupq_n_u8(0x01u), vcleq_u8(test, light), l1);
+
+  return fastArcNeon(d0, l0, d1, l1);
+}
+#endif
+
 /// Detect FAST features and output to `out` as `0xff` for detected points and
 /// `0x00` otherwise. Unless width is a multiple of 16, this method will
 /// classify up to 15 extra pixels and write them past the end of the row.
@@ -51,6 +164,10 @@ namespace pislam {
 /// Running time is independent of image contents and is approximately
 /// 68k pixels / ms / GHz.
 ///
+/// On x86 the same classification is computed by `fastDetectSse2` or
+/// `fastDetectAvx2`, selected at runtime.
+///
+#if defined(PISLAM_NEON)
 template <int vstep, int border>
 void fastDetect(const int width, const int height,
     uint8_t img[][vstep], uint8_t out[][vstep], int threshold) {
@@ -59,94 +176,7 @@ void fastDetect(const int width, const int height,
 
   for (int y = border; y < height - border; y += 1) {
     for (int x = border; x < width - border; x += 16) {
-      uint8x16_t c = vld1q_u8(&img[y+0][x+0]);
-      uint8x16_t light = vqaddq_u8(c, vthreshold);
-      uint8x16_t dark = vqsubq_u8(c, vthreshold);
-
-      uint8x16_t test = vld1q_u8(&img[y-3][x-1]);
-      uint8x16_t d0 = vcgeq_u8(test, dark);
-      uint8x16_t l0 = vcleq_u8(test, light);
-
-      test = vld1q_u8(&img[y-3][x+0]);
-      d0 = vbslq_u8(vdupq_n_u8(0x40u), vcgeq_u8(test, dark), d0);
-      l0 = vbslq_u8(vdupq_n_u8(0x40u), vcleq_u8(test, light), l0);
-
-      test = vld1q_u8(&img[y-3][x+1]);
-      d0 = vbslq_u8(vdupq_n_u8(0x20u), vcgeq_u8(test, dark), d0);
-      l0 = vbslq_u8(vdupq_n_u8(0x20u), vcleq_u8(test, light), l0);
-
-      test = vld1q_u8(&img[y-2][x+2]);
-      d0 = vbslq_u8(vdupq_n_u8(0x10u), vcgeq_u8(test, dark), d0);
-      l0 = vbslq_u8(vdupq_n_u8(0x10u), vcleq_u8(test, light), l0);
-
-      test = vld1q_u8(&img[y-1][x+3]);
-      d0 = vbslq_u8(vdupq_n_u8(0x08u), vcgeq_u8(test, dark), d0);
-      l0 = vbslq_u8(vdupq_n_u8(0x08u), vcleq_u8(test, light), l0);
-      
-      test = vld1q_u8(&img[y+0][x+3]);
-      d0 = vbslq_u8(vdupq_n_u8(0x04u), vcgeq_u8(test, dark), d0);
-      l0 = vbslq_u8(vdupq_n_u8(0x04u), vcleq_u8(test, light), l0);
-      
-      test = vld1q_u8(&img[y+1][x+3]);
-      d0 = vbslq_u8(vdupq_n_u8(0x02u), vcgeq_u8(test, dark), d0);
-      l0 = vbslq_u8(vdupq_n_u8(0x02u), vcleq_u8(test, light), l0);
-      
-      test = vld1q_u8(&img[y+2][x+2]);
-      d0 = vbslq_u8(vdupq_n_u8(0x01u), vcgeq_u8(test, dark), d0);
-      l0 = vbslq_u8(vdupq_n_u8(0x01u), vcleq_u8(test, light), l0);
-      
-      test = vld1q_u8(&img[y+3][x+1]);
-      uint8x16_t d1 = vcgeq_u8(test, dark);
-      uint8x16_t l1 = vcleq_u8(test, light);
-
-      test = vld1q_u8(&img[y+3][x+0]);
-      d1 = vbslq_u8(vdupq_n_u8(0x40u), vcgeq_u8(test, dark), d1);
-      l1 = vbslq_u8(vdupq_n_u8(0x40u), vcleq_u8(test, light), l1);
-
-      test = vld1q_u8(&img[y+3][x-1]);
-      d1 = vbslq_u8(vdupq_n_u8(0x20u), vcgeq_u8(test, dark), d1);
-      l1 = vbslq_u8(vdupq_n_u8(0x20u), vcleq_u8(test, light), l1);
-
-      test = vld1q_u8(&img[y+2][x-2]);
-      d1 = vbslq_u8(vdupq_n_u8(0x10u), vcgeq_u8(test, dark), d1);
-      l1 = vbslq_u8(vdupq_n_u8(0x10u), vcleq_u8(test, light), l1);
-
-      test = vld1q_u8(&img[y+1][x-3]);
-      d1 = vbslq_u8(vdupq_n_u8(0x08u), vcgeq_u8(test, dark), d1);
-      l1 = vbslq_u8(vdupq_n_u8(0x08u), vcleq_u8(test, light), l1);
-      
-      test = vld1q_u8(&img[y+0][x-3]);
-      d1 = vbslq_u8(vdupq_n_u8(0x04u), vcgeq_u8(test, dark), d1);
-      l1 = vbslq_u8(vdupq_n_u8(0x04u), vcleq_u8(test, light), l1);
-      
-      test = vld1q_u8(&img[y-1][x-3]);
-      d1 = vbslq_u8(vdupq_n_u8(0x02u), vcgeq_u8(test, dark), d1);
-      l1 = vbslq_u8(vdupq_n_u8(0x02u), vcleq_u8(test, light), l1);
-      
-      test = vld1q_u8(&img[y-2][x-2]);
-      d1 = vbslq_u8(vdupq_n_u8(0x01u), vcgeq_u8(test, dark), d1);
-      l1 = vbslq_u8(vdupq_n_u8(0x01u), vcleq_u8(test, light), l1);
-
-      // Determine whether to test dark or light pattern.
-      // 8 consecutive bits implies d0 & d1 == 0.
-      uint8x16_t t0 = vtstq_u8(d0, d1);
-      uint8x16_t t1 = vtstq_u8(d0, d1);
-
-      t0 = vbslq_u8(t0, l0, d0);
-      t1 = vbslq_u8(t1, l1, d1);
-
-      uint8x16_t cntLo = vclzq_u8(t0);
-      uint8x16_t testLo = t1 << (cntLo - 1);
-      asm("vceq.u8  %q0, %q0, #0" : [val] "+w" (testLo));
-
-      uint8x16_t cntHi = vclzq_u8(t1);
-      uint8x16_t testHi = t0 << (cntHi - 1);
-      asm("vceq.u8  %q0, %q0, #0" : [val] "+w" (testHi));
-
-      uint8x16_t result = (cntLo & testLo) | (cntHi & testHi);
-      result = vtstq_u8(result, result);
-
-      vst1q_u8(&out[y][x], result);
+      vst1q_u8(&out[y][x], fastDetectNeonBlock<vstep>(img, x, y, vthreshold));
     }
     // we've already written past the end of width, but we make the guarantee
     // to the caller that two zeros are present at the right edge.
@@ -156,29 +186,1012 @@ void fastDetect(const int width, const int height,
     }
   }
 }
+#elif defined(PISLAM_X86)
+
+// Classify a single pixel of the 16 point circle. `d` gains `bit` where the
+// pixel is not darker than `dark`, and `l` where it is not lighter than
+// `light`. This is equivalent to the vcge/vcle + vbsl sequence above.
+#define PISLAM_FAST_SSE2_BIT(dy, dx, bit, d, l) \
+  test = _mm_loadu_si128((const __m128i *)&img[y+(dy)][x+(dx)]); \
+  d = _mm_or_si128(d, _mm_and_si128(_mm_set1_epi8(char(bit)), \
+      _mm_cmpeq_epi8(_mm_max_epu8(test, dark), test))); \
+  l = _mm_or_si128(l, _mm_and_si128(_mm_set1_epi8(char(bit)), \
+      _mm_cmpeq_epi8(_mm_min_epu8(test, light), test)))
+
+#define PISLAM_FAST_AVX2_BIT(dy, dx, bit, d, l) \
+  test = _mm256_loadu_si256((const __m256i *)&img[y+(dy)][x+(dx)]); \
+  d = _mm256_or_si256(d, _mm256_and_si256(_mm256_set1_epi8(char(bit)), \
+      _mm256_cmpeq_epi8(_mm256_max_epu8(test, dark), test))); \
+  l = _mm256_or_si256(l, _mm256_and_si256(_mm256_set1_epi8(char(bit)), \
+      _mm256_cmpeq_epi8(_mm256_min_epu8(test, light), test)))
+
+// There is no byte wide clz on x86, so the NEON trick of counting leading
+// zeros in one half and testing the remaining bits of the other half is
+// replaced with an equivalent test on the 16 bit ring. Each lane holds
+// t0 << 8 | t1, and a corner is a run of 9 zero bits. Runs are found by
+// and-ing the inverted ring with rotated copies of itself. The two tests
+// agree for all 2**16 inputs.
+static inline __m128i fastArcSse2(__m128i ring) {
+  __m128i z = _mm_xor_si128(ring, _mm_set1_epi8(char(0xff)));
+  __m128i z2 = _mm_and_si128(z,
+      _mm_or_si128(_mm_slli_epi16(z, 1), _mm_srli_epi16(z, 15)));
+  __m128i z4 = _mm_and_si128(z2,
+      _mm_or_si128(_mm_slli_epi16(z2, 2), _mm_srli_epi16(z2, 14)));
+  __m128i z8 = _mm_and_si128(z4,
+      _mm_or_si128(_mm_slli_epi16(z4, 4), _mm_srli_epi16(z4, 12)));
+  __m128i z9 = _mm_and_si128(z8,
+      _mm_or_si128(_mm_slli_epi16(z, 8), _mm_srli_epi16(z, 8)));
+  return _mm_xor_si128(_mm_cmpeq_epi16(z9, _mm_setzero_si128()),
+      _mm_set1_epi8(char(0xff)));
+}
+
+/// SSE2 implementation of `fastArcNeon`.
+static inline __m128i fastCornerSse2(__m128i d0, __m128i l0, __m128i d1,
+    __m128i l1) {
+  // Determine whether to test dark or light pattern.
+  // 8 consecutive bits implies d0 & d1 == 0.
+  __m128i testDark = _mm_cmpeq_epi8(_mm_and_si128(d0, d1),
+      _mm_setzero_si128());
+  __m128i t0 = _mm_or_si128(_mm_and_si128(testDark, d0),
+      _mm_andnot_si128(testDark, l0));
+  __m128i t1 = _mm_or_si128(_mm_and_si128(testDark, d1),
+      _mm_andnot_si128(testDark, l1));
+
+  __m128i lo = fastArcSse2(_mm_unpacklo_epi8(t1, t0));
+  __m128i hi = fastArcSse2(_mm_unpackhi_epi8(t1, t0));
+  return _mm_packs_epi16(lo, hi);
+}
+
+PISLAM_TARGET_AVX2
+static inline __m256i fastArcAvx2(__m256i ring) {
+  __m256i z = _mm256_xor_si256(ring, _mm256_set1_epi8(char(0xff)));
+  __m256i z2 = _mm256_and_si256(z,
+      _mm256_or_si256(_mm256_slli_epi16(z, 1), _mm256_srli_epi16(z, 15)));
+  __m256i z4 = _mm256_and_si256(z2,
+      _mm256_or_si256(_mm256_slli_epi16(z2, 2), _mm256_srli_epi16(z2, 14)));
+  __m256i z8 = _mm256_and_si256(z4,
+      _mm256_or_si256(_mm256_slli_epi16(z4, 4), _mm256_srli_epi16(z4, 12)));
+  __m256i z9 = _mm256_and_si256(z8,
+      _mm256_or_si256(_mm256_slli_epi16(z, 8), _mm256_srli_epi16(z, 8)));
+  return _mm256_xor_si256(_mm256_cmpeq_epi16(z9, _mm256_setzero_si256()),
+      _mm256_set1_epi8(char(0xff)));
+}
+
+/// Classify 16 pixels starting at `img[y][x]`. Bit layout of the
+/// intermediate masks is identical to the NEON implementation.
+template <int vstep>
+static inline __m128i fastDetectSse2Block(uint8_t img[][vstep], int x, int y,
+    __m128i vthreshold) {
 
-/// Replace non-zero pixels in `out`, presumably detected points of interest,
-/// with 8 bit harris score. Zero value remain zero.
+  __m128i c = _mm_loadu_si128((const __m128i *)&img[y][x]);
+  __m128i light = _mm_adds_epu8(c, vthreshold);
+  __m128i dark = _mm_subs_epu8(c, vthreshold);
+  __m128i test;
+
+  __m128i d0 = _mm_setzero_si128(), l0 = _mm_setzero_si128();
+  __m128i d1 = _mm_setzero_si128(), l1 = _mm_setzero_si128();
+
+  PISLAM_FAST_SSE2_BIT(-3, -1, 0x80, d0, l0);
+  PISLAM_FAST_SSE2_BIT(-3,  0, 0x40, d0, l0);
+  PISLAM_FAST_SSE2_BIT(-3,  1, 0x20, d0, l0);
+  PISLAM_FAST_SSE2_BIT(-2,  2, 0x10, d0, l0);
+  PISLAM_FAST_SSE2_BIT(-1,  3, 0x08, d0, l0);
+  PISLAM_FAST_SSE2_BIT( 0,  3, 0x04, d0, l0);
+  PISLAM_FAST_SSE2_BIT( 1,  3, 0x02, d0, l0);
+  PISLAM_FAST_SSE2_BIT( 2,  2, 0x01, d0, l0);
+
+  PISLAM_FAST_SSE2_BIT( 3,  1, 0x80, d1, l1);
+  PISLAM_FAST_SSE2_BIT( 3,  0, 0x40, d1, l1);
+  PISLAM_FAST_SSE2_BIT( 3, -1, 0x20, d1, l1);
+  PISLAM_FAST_SSE2_BIT( 2, -2, 0x10, d1, l1);
+  PISLAM_FAST_SSE2_BIT( 1, -3, 0x08, d1, l1);
+  PISLAM_FAST_SSE2_BIT( 0, -3, 0x04, d1, l1);
+  PISLAM_FAST_SSE2_BIT(-1, -3, 0x02, d1, l1);
+  PISLAM_FAST_SSE2_BIT(-2, -2, 0x01, d1, l1);
+
+  return fastCornerSse2(d0, l0, d1, l1);
+}
+
+/// Classify 32 pixels starting at `img[y][x]`. Unpacking and packing
+/// both work within 128 bit lanes, so output order is preserved.
+template <int vstep>
+PISLAM_TARGET_AVX2
+static inline __m256i fastDetectAvx2Block(uint8_t img[][vstep], int x, int y,
+    __m256i vthreshold) {
+
+  __m256i c = _mm256_loadu_si256((const __m256i *)&img[y][x]);
+  __m256i light = _mm256_adds_epu8(c, vthreshold);
+  __m256i dark = _mm256_subs_epu8(c, vthreshold);
+  __m256i test;
+
+  __m256i d0 = _mm256_setzero_si256(), l0 = _mm256_setzero_si256();
+  __m256i d1 = _mm256_setzero_si256(), l1 = _mm256_setzero_si256();
+
+  PISLAM_FAST_AVX2_BIT(-3, -1, 0x80, d0, l0);
+  PISLAM_FAST_AVX2_BIT(-3,  0, 0x40, d0, l0);
+  PISLAM_FAST_AVX2_BIT(-3,  1, 0x20, d0, l0);
+  PISLAM_FAST_AVX2_BIT(-2,  2, 0x10, d0, l0);
+  PISLAM_FAST_AVX2_BIT(-1,  3, 0x08, d0, l0);
+  PISLAM_FAST_AVX2_BIT( 0,  3, 0x04, d0, l0);
+  PISLAM_FAST_AVX2_BIT( 1,  3, 0x02, d0, l0);
+  PISLAM_FAST_AVX2_BIT( 2,  2, 0x01, d0, l0);
+
+  PISLAM_FAST_AVX2_BIT( 3,  1, 0x80, d1, l1);
+  PISLAM_FAST_AVX2_BIT( 3,  0, 0x40, d1, l1);
+  PISLAM_FAST_AVX2_BIT( 3, -1, 0x20, d1, l1);
+  PISLAM_FAST_AVX2_BIT( 2, -2, 0x10, d1, l1);
+  PISLAM_FAST_AVX2_BIT( 1, -3, 0x08, d1, l1);
+  PISLAM_FAST_AVX2_BIT( 0, -3, 0x04, d1, l1);
+  PISLAM_FAST_AVX2_BIT(-1, -3, 0x02, d1, l1);
+  PISLAM_FAST_AVX2_BIT(-2, -2, 0x01, d1, l1);
+
+  __m256i testDark = _mm256_cmpeq_epi8(_mm256_and_si256(d0, d1),
+      _mm256_setzero_si256());
+  __m256i t0 = _mm256_or_si256(_mm256_and_si256(testDark, d0),
+      _mm256_andnot_si256(testDark, l0));
+  __m256i t1 = _mm256_or_si256(_mm256_and_si256(testDark, d1),
+      _mm256_andnot_si256(testDark, l1));
+
+  __m256i lo = fastArcAvx2(_mm256_unpacklo_epi8(t1, t0));
+  __m256i hi = fastArcAvx2(_mm256_unpackhi_epi8(t1, t0));
+  return _mm256_packs_epi16(lo, hi);
+}
+
+/// SSE2 implementation of `fastDetect`, 16 pixels per iteration.
+template <int vstep, int border>
+void fastDetectSse2(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int threshold) {
+
+  __m128i vthreshold = _mm_set1_epi8(char(threshold));
+
+  for (int y = border; y < height - border; y += 1) {
+    for (int x = border; x < width - border; x += 16) {
+      __m128i result = fastDetectSse2Block<vstep>(img, x, y, vthreshold);
+      _mm_storeu_si128((__m128i *)&out[y][x], result);
+    }
+    if (width % 16 != 0) {
+      out[y][width  ] = 0;
+      out[y][width+1] = 0;
+    }
+  }
+}
+
+/// AVX2 implementation of `fastDetect`, 32 pixels per iteration. Columns
+/// are visited in the same 16 pixel steps as the NEON and SSE2 versions,
+/// so no more than 15 extra pixels are written past the end of the row.
+template <int vstep, int border>
+PISLAM_TARGET_AVX2
+void fastDetectAvx2(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int threshold) {
+
+  __m256i vthreshold = _mm256_set1_epi8(char(threshold));
+
+  for (int y = border; y < height - border; y += 1) {
+    int x = border;
+    for (; x + 16 < width - border; x += 32) {
+      __m256i result = fastDetectAvx2Block<vstep>(img, x, y, vthreshold);
+      _mm256_storeu_si256((__m256i *)&out[y][x], result);
+    }
+    if (x < width - border) {
+      __m128i result = fastDetectSse2Block<vstep>(img, x, y,
+          _mm256_castsi256_si128(vthreshold));
+      _mm_storeu_si128((__m128i *)&out[y][x], result);
+    }
+    if (width % 16 != 0) {
+      out[y][width  ] = 0;
+      out[y][width+1] = 0;
+    }
+  }
+}
+
+template <int vstep, int border>
+void fastDetect(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int threshold) {
+  if (cpuSupportsAvx2()) {
+    fastDetectAvx2<vstep, border>(width, height, img, out, threshold);
+  } else {
+    fastDetectSse2<vstep, border>(width, height, img, out, threshold);
+  }
+}
+#endif
+
+/// Cells of `1 << logCellSize` pixels needed to cover `size` pixels.
+template <int logCellSize>
+constexpr int fastCellCount(int size) {
+  return (size + (1 << logCellSize) - 1) >> logCellSize;
+}
+
+/// Spread the thresholds of the row of cells containing row y over a row
+/// of per pixel thresholds, `vstep + 16` long so that the last vector of
+/// a row may be loaded whole. Columns past the last cell take its
+/// threshold.
+template <int vstep, int logCellSize>
+static inline void fastCellLanes(const int width, const int y,
+    const uint8_t *thresholds, uint8_t lanes[vstep + 16]) {
+  const int columns = fastCellCount<logCellSize>(width);
+  const uint8_t *row = &thresholds[(y >> logCellSize) * columns];
+  for (int x = 0; x < vstep + 16; x += 1) {
+    lanes[x] = row[std::min(x >> logCellSize, columns - 1)];
+  }
+}
+
+/// As fastDetect, but with a threshold per cell of `1 << logCellSize`
+/// pixels, for example from FastThresholdGrid, rather than one for the
+/// whole image. `thresholds` holds fastCellCount(height) rows of
+/// fastCellCount(width) cells, with cell (0, 0) at the top left pixel of
+/// the image rather than of the border. Output is as fastDetect, each
+/// pixel classified with the threshold of its cell.
 ///
-/// Running time depends on number of non-zero pixels to be classified.
-/// See Harris.h for exact details, but expect 2 ms for a 640x480 VGA image.
+/// The thresholds of a row of cells are spread over one row of bytes
+/// when the row of cells is entered, and every 16 pixels load their own
+/// vector of thresholds from it, so running time is that of fastDetect.
 ///
+#if defined(PISLAM_NEON)
+template <int vstep, int border, int logCellSize = 5>
+void fastDetectCells(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], const uint8_t *thresholds) {
+
+  uint8_t lanes[vstep + 16];
+
+  for (int y = border; y < height - border; y += 1) {
+    if (y == border || (y & ((1 << logCellSize) - 1)) == 0) {
+      fastCellLanes<vstep, logCellSize>(width, y, thresholds, lanes);
+    }
+    for (int x = border; x < width - border; x += 16) {
+      vst1q_u8(&out[y][x], fastDetectNeonBlock<vstep>(img, x, y,
+            vld1q_u8(&lanes[x])));
+    }
+    if (width % 16 != 0) {
+      out[y][width  ] = 0;
+      out[y][width+1] = 0;
+    }
+  }
+}
+#elif defined(PISLAM_X86)
+/// SSE2 implementation of `fastDetectCells`.
+template <int vstep, int border, int logCellSize = 5>
+void fastDetectCellsSse2(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], const uint8_t *thresholds) {
+
+  uint8_t lanes[vstep + 16];
+
+  for (int y = border; y < height - border; y += 1) {
+    if (y == border || (y & ((1 << logCellSize) - 1)) == 0) {
+      fastCellLanes<vstep, logCellSize>(width, y, thresholds, lanes);
+    }
+    for (int x = border; x < width - border; x += 16) {
+      __m128i result = fastDetectSse2Block<vstep>(img, x, y,
+          _mm_loadu_si128((const __m128i *)&lanes[x]));
+      _mm_storeu_si128((__m128i *)&out[y][x], result);
+    }
+    if (width % 16 != 0) {
+      out[y][width  ] = 0;
+      out[y][width+1] = 0;
+    }
+  }
+}
+
+/// AVX2 implementation of `fastDetectCells`.
+template <int vstep, int border, int logCellSize = 5>
+PISLAM_TARGET_AVX2
+void fastDetectCellsAvx2(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], const uint8_t *thresholds) {
+
+  uint8_t lanes[vstep + 16];
+
+  for (int y = border; y < height - border; y += 1) {
+    if (y == border || (y & ((1 << logCellSize) - 1)) == 0) {
+      fastCellLanes<vstep, logCellSize>(width, y, thresholds, lanes);
+    }
+    int x = border;
+    for (; x + 16 < width - border; x += 32) {
+      __m256i result = fastDetectAvx2Block<vstep>(img, x, y,
+          _mm256_loadu_si256((const __m256i *)&lanes[x]));
+      _mm256_storeu_si256((__m256i *)&out[y][x], result);
+    }
+    if (x < width - border) {
+      __m128i result = fastDetectSse2Block<vstep>(img, x, y,
+          _mm_loadu_si128((const __m128i *)&lanes[x]));
+      _mm_storeu_si128((__m128i *)&out[y][x], result);
+    }
+    if (width % 16 != 0) {
+      out[y][width  ] = 0;
+      out[y][width+1] = 0;
+    }
+  }
+}
+
+template <int vstep, int border, int logCellSize = 5>
+void fastDetectCells(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], const uint8_t *thresholds) {
+  if (cpuSupportsAvx2()) {
+    fastDetectCellsAvx2<vstep, border, logCellSize>(width, height, img, out,
+        thresholds);
+  } else {
+    fastDetectCellsSse2<vstep, border, logCellSize>(width, height, img, out,
+        thresholds);
+  }
+}
+#endif
+
+/// Region of interest for the masked overloads of fastDetect, fastScore
+/// and fastExtract, for example to ignore the vehicle's own body or a
+/// saturated sky. The image is divided into blocks of 16x16 pixels, the
+/// width of a detection vector, each either enabled or masked.
+///
+/// Detection skips every vector lying in masked blocks, and every row
+/// with no enabled block, writing zeros instead, so the time saved is
+/// in proportion to the area masked. No point is ever found in a masked
+/// pixel, including those sharing a vector with an enabled block.
+class FastMask {
+ public:
+  static constexpr int logBlockSize = 4;
+
+  FastMask(int width, int height, bool enabled = true)
+      : columns(fastCellCount<logBlockSize>(width)),
+        rows(fastCellCount<logBlockSize>(height)),
+        blocks((size_t)columns * rows, enabled),
+        rowCounts(rows, enabled ? columns : 0) {}
+
+  /// Enable or mask every block touching the pixels [x0, x1) x [y0, y1).
+  /// A row span is the rectangle of one row.
+  void set(int x0, int y0, int x1, int y1, bool enabled) {
+    x0 = std::max(x0, 0) >> logBlockSize;
+    y0 = std::max(y0, 0) >> logBlockSize;
+    x1 = std::min(fastCellCount<logBlockSize>(x1), columns);
+    y1 = std::min(fastCellCount<logBlockSize>(y1), rows);
+    for (int by = y0; by < y1; by += 1) {
+      for (int bx = x0; bx < x1; bx += 1) {
+        uint8_t &block = blocks[by * columns + bx];
+        rowCounts[by] += (int)enabled - block;
+        block = enabled;
+      }
+    }
+  }
+
+  /// Whether pixel (x, y) is enabled.
+  bool enabled(int x, int y) const {
+    return blocks[(y >> logBlockSize) * columns +
+      std::min(x >> logBlockSize, columns - 1)];
+  }
+
+  /// Whether row y holds any enabled pixel.
+  bool rowEnabled(int y) const {
+    return rowCounts[y >> logBlockSize] > 0;
+  }
+
+  /// Spread the flags of the row of blocks containing row y over `count`
+  /// pixels, as 0xff where enabled and 0x00 where masked. Columns past
+  /// the last block take its flag.
+  void lanes(int y, uint8_t *lanes, int count) const {
+    const uint8_t *row = &blocks[(y >> logBlockSize) * columns];
+    for (int x = 0; x < count; x += 1) {
+      lanes[x] = row[std::min(x >> logBlockSize, columns - 1)] ? 0xff : 0x00;
+    }
+  }
+
+ private:
+  int columns;
+  int rows;
+  std::vector<uint8_t> blocks;
+  /// Enabled blocks of each row of blocks.
+  std::vector<int> rowCounts;
+};
+
+/// Whether any pixel of a vector of `count` pixels from x is enabled in
+/// the lanes of FastMask::lanes. Vectors of 16 or 32 pixels touch at
+/// most three blocks, whose flags are the first, middle and last lane.
+static inline bool fastMaskAny(const uint8_t *lanes, int x, int count) {
+  return lanes[x] | lanes[x + count / 2] | lanes[x + count - 1];
+}
+
+/// As fastDetect, but only in the pixels enabled by `mask`. Masked pixels
+/// are written as zero, so that fastScore and fastExtract may be given
+/// the same plane with or without the mask.
+///
+/// Running time is that of fastDetect over the enabled fraction of the
+/// image.
+///
+#if defined(PISLAM_NEON)
+template <int vstep, int border>
+void fastDetect(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int threshold,
+    const FastMask &mask) {
+
+  uint8x16_t vthreshold = vdupq_n_u8(threshold);
+  uint8_t lanes[vstep + 16];
+
+  int band = -1;
+
+  for (int y = border; y < height - border; y += 1) {
+    const bool row = mask.rowEnabled(y);
+    if (row && y >> FastMask::logBlockSize != band) {
+      band = y >> FastMask::logBlockSize;
+      mask.lanes(y, lanes, vstep + 16);
+    }
+    for (int x = border; x < width - border; x += 16) {
+      if (!row || !fastMaskAny(lanes, x, 16)) {
+        vst1q_u8(&out[y][x], vdupq_n_u8(0));
+        continue;
+      }
+      vst1q_u8(&out[y][x], vandq_u8(vld1q_u8(&lanes[x]),
+            fastDetectNeonBlock<vstep>(img, x, y, vthreshold)));
+    }
+    if (width % 16 != 0) {
+      out[y][width  ] = 0;
+      out[y][width+1] = 0;
+    }
+  }
+}
+#elif defined(PISLAM_X86)
+/// SSE2 implementation of masked `fastDetect`.
+template <int vstep, int border>
+void fastDetectSse2(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int threshold,
+    const FastMask &mask) {
+
+  __m128i vthreshold = _mm_set1_epi8(char(threshold));
+  uint8_t lanes[vstep + 16];
+
+  int band = -1;
+
+  for (int y = border; y < height - border; y += 1) {
+    const bool row = mask.rowEnabled(y);
+    if (row && y >> FastMask::logBlockSize != band) {
+      band = y >> FastMask::logBlockSize;
+      mask.lanes(y, lanes, vstep + 16);
+    }
+    for (int x = border; x < width - border; x += 16) {
+      __m128i result = _mm_setzero_si128();
+      if (row && fastMaskAny(lanes, x, 16)) {
+        result = _mm_and_si128(_mm_loadu_si128((const __m128i *)&lanes[x]),
+            fastDetectSse2Block<vstep>(img, x, y, vthreshold));
+      }
+      _mm_storeu_si128((__m128i *)&out[y][x], result);
+    }
+    if (width % 16 != 0) {
+      out[y][width  ] = 0;
+      out[y][width+1] = 0;
+    }
+  }
+}
+
+/// AVX2 implementation of masked `fastDetect`.
+template <int vstep, int border>
+PISLAM_TARGET_AVX2
+void fastDetectAvx2(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int threshold,
+    const FastMask &mask) {
+
+  __m256i vthreshold = _mm256_set1_epi8(char(threshold));
+  uint8_t lanes[vstep + 16];
+
+  int band = -1;
+
+  for (int y = border; y < height - border; y += 1) {
+    const bool row = mask.rowEnabled(y);
+    if (row && y >> FastMask::logBlockSize != band) {
+      band = y >> FastMask::logBlockSize;
+      mask.lanes(y, lanes, vstep + 16);
+    }
+    int x = border;
+    for (; x + 16 < width - border; x += 32) {
+      __m256i result = _mm256_setzero_si256();
+      if (row && fastMaskAny(lanes, x, 32)) {
+        result = _mm256_and_si256(
+            _mm256_loadu_si256((const __m256i *)&lanes[x]),
+            fastDetectAvx2Block<vstep>(img, x, y, vthreshold));
+      }
+      _mm256_storeu_si256((__m256i *)&out[y][x], result);
+    }
+    if (x < width - border) {
+      __m128i result = _mm_setzero_si128();
+      if (row && fastMaskAny(lanes, x, 16)) {
+        result = _mm_and_si128(_mm_loadu_si128((const __m128i *)&lanes[x]),
+            fastDetectSse2Block<vstep>(img, x, y,
+              _mm256_castsi256_si128(vthreshold)));
+      }
+      _mm_storeu_si128((__m128i *)&out[y][x], result);
+    }
+    if (width % 16 != 0) {
+      out[y][width  ] = 0;
+      out[y][width+1] = 0;
+    }
+  }
+}
+
+template <int vstep, int border>
+void fastDetect(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int threshold,
+    const FastMask &mask) {
+  if (cpuSupportsAvx2()) {
+    fastDetectAvx2<vstep, border>(width, height, img, out, threshold, mask);
+  } else {
+    fastDetectSse2<vstep, border>(width, height, img, out, threshold, mask);
+  }
+}
+#endif
+
+/// Words per row of a bit plane, one bit per pixel of a `vstep` byte row.
+constexpr int fastBitWords(int vstep) {
+  return (vstep + 63) / 64;
+}
+
+/// Or `count` bits of `mask` into `row` from pixel x. `row` must have a
+/// spare word at the end.
+static inline void fastBitsSet(uint64_t *row, int x, uint64_t mask, int count) {
+  int shift = x & 63;
+  row[x >> 6] |= mask << shift;
+  if (shift + count > 64) {
+    row[(x >> 6) + 1] |= mask >> (64 - shift);
+  }
+}
+
+/// Mask of the first `n` of `count` bits.
+static inline uint64_t fastBitsClip(uint64_t mask, int n, int count) {
+  return n < count ? mask & ((uint64_t(1) << n) - 1) : mask;
+}
+
+#if defined(PISLAM_NEON)
+/// Narrow 16 lanes of 0x00 or 0xff to a 16 bit mask. Lane weights are
+/// summed pairwise, which or-s them since they are distinct bits.
+static inline uint32_t fastMaskNeon(uint8x16_t lanes) {
+  static const uint8_t weightBytes[16] = {
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+  };
+  uint8x16_t weighted = vandq_u8(lanes, vld1q_u8(weightBytes));
+  uint8x8_t sum = vpadd_u8(vget_low_u8(weighted), vget_high_u8(weighted));
+  sum = vpadd_u8(sum, sum);
+  sum = vpadd_u8(sum, sum);
+  return vget_lane_u8(sum, 0) | vget_lane_u8(sum, 1) << 8;
+}
+
+/// As fastDetect, but output is a plane of one bit per pixel, bit x % 64
+/// of word x / 64 of each row, so that later stages read an eighth of
+/// the memory and skip 64 empty pixels in one test. Only pixels inside
+/// the border are set, and rows inside the border are rewritten whole,
+/// so the plane may be reused across frames. Rows of the plane are
+/// fastBitWords(vstep) words.
+///
+/// Use with fastScoreHarrisBits and fastExtractBits.
+///
+template <int vstep, int border>
+void fastDetectBits(const int width, const int height,
+    uint8_t img[][vstep], uint64_t bits[][fastBitWords(vstep)], int threshold) {
+
+  uint8x16_t vthreshold = vdupq_n_u8(threshold);
+  const int end = width - border;
+
+  for (int y = border; y < height - border; y += 1) {
+    uint64_t row[fastBitWords(vstep) + 1] = {0};
+    for (int x = border; x < end; x += 16) {
+      uint64_t mask = fastMaskNeon(fastDetectNeonBlock<vstep>(img, x, y,
+            vthreshold));
+      fastBitsSet(row, x, fastBitsClip(mask, end - x, 16), 16);
+    }
+    std::copy(row, row + fastBitWords(vstep), bits[y]);
+  }
+}
+#elif defined(PISLAM_X86)
+/// SSE2 implementation of `fastDetectBits`.
+template <int vstep, int border>
+void fastDetectBitsSse2(const int width, const int height,
+    uint8_t img[][vstep], uint64_t bits[][fastBitWords(vstep)], int threshold) {
+
+  __m128i vthreshold = _mm_set1_epi8(char(threshold));
+  const int end = width - border;
+
+  for (int y = border; y < height - border; y += 1) {
+    uint64_t row[fastBitWords(vstep) + 1] = {0};
+    for (int x = border; x < end; x += 16) {
+      uint64_t mask = (uint32_t)_mm_movemask_epi8(
+          fastDetectSse2Block<vstep>(img, x, y, vthreshold));
+      fastBitsSet(row, x, fastBitsClip(mask, end - x, 16), 16);
+    }
+    std::copy(row, row + fastBitWords(vstep), bits[y]);
+  }
+}
+
+/// AVX2 implementation of `fastDetectBits`.
 template <int vstep, int border>
+PISLAM_TARGET_AVX2
+void fastDetectBitsAvx2(const int width, const int height,
+    uint8_t img[][vstep], uint64_t bits[][fastBitWords(vstep)], int threshold) {
+
+  __m256i vthreshold = _mm256_set1_epi8(char(threshold));
+  const int end = width - border;
+
+  for (int y = border; y < height - border; y += 1) {
+    uint64_t row[fastBitWords(vstep) + 1] = {0};
+    int x = border;
+    for (; x + 16 < end; x += 32) {
+      uint64_t mask = (uint32_t)_mm256_movemask_epi8(
+          fastDetectAvx2Block<vstep>(img, x, y, vthreshold));
+      fastBitsSet(row, x, fastBitsClip(mask, end - x, 32), 32);
+    }
+    if (x < end) {
+      uint64_t mask = (uint32_t)_mm_movemask_epi8(fastDetectSse2Block<vstep>(
+            img, x, y, _mm256_castsi256_si128(vthreshold)));
+      fastBitsSet(row, x, fastBitsClip(mask, end - x, 16), 16);
+    }
+    std::copy(row, row + fastBitWords(vstep), bits[y]);
+  }
+}
+
+template <int vstep, int border>
+void fastDetectBits(const int width, const int height,
+    uint8_t img[][vstep], uint64_t bits[][fastBitWords(vstep)], int threshold) {
+  if (cpuSupportsAvx2()) {
+    fastDetectBitsAvx2<vstep, border>(width, height, img, bits, threshold);
+  } else {
+    fastDetectBitsSse2<vstep, border>(width, height, img, bits, threshold);
+  }
+}
+#endif
+
+/// Circle offsets (dx, dy) of the FAST ring, clockwise from the top, in
+/// the bit order of the d0/l0 and d1/l1 masks.
+static const int8_t fastCircle[16][2] = {
+  {-1, -3}, { 0, -3}, { 1, -3}, { 2, -2},
+  { 3, -1}, { 3,  0}, { 3,  1}, { 2,  2},
+  { 1,  3}, { 0,  3}, {-1,  3}, {-2,  2},
+  {-3,  1}, {-3,  0}, {-3, -1}, {-2, -2},
+};
+
+#if defined(PISLAM_NEON)
+/// FAST scores of 16 points, one per lane, given their centers and the
+/// 16 pixels of each ring transposed so that `ring[i]` holds pixel i of
+/// every point. A score is the largest threshold at which the point is
+/// still detected, or 0. Detection is monotonic in the threshold, so
+/// every lane is found at once by a binary search of 8 classifications,
+/// one per bit, each with its own threshold per lane.
+static inline void fastScoreRing(const uint8_t center[16],
+    const uint8_t ring[16][16], uint8_t scores[16]) {
+  uint8x16_t c = vld1q_u8(center);
+  uint8x16_t score = vdupq_n_u8(0);
+  for (int bit = 0x80; bit; bit >>= 1) {
+    uint8x16_t candidate = vorrq_u8(score, vdupq_n_u8(bit));
+    uint8x16_t light = vqaddq_u8(c, candidate);
+    uint8x16_t dark = vqsubq_u8(c, candidate);
+    uint8x16_t d[2] = {vdupq_n_u8(0), vdupq_n_u8(0)};
+    uint8x16_t l[2] = {vdupq_n_u8(0), vdupq_n_u8(0)};
+    for (int i = 0; i < 16; i += 1) {
+      uint8x16_t test = vld1q_u8(ring[i]);
+      uint8x16_t weight = vdupq_n_u8(0x80 >> (i % 8));
+      d[i/8] = vorrq_u8(d[i/8], vandq_u8(weight, vcgeq_u8(test, dark)));
+      l[i/8] = vorrq_u8(l[i/8], vandq_u8(weight, vcleq_u8(test, light)));
+    }
+    score = vbslq_u8(fastArcNeon(d[0], l[0], d[1], l[1]), candidate, score);
+  }
+  vst1q_u8(scores, score);
+}
+#elif defined(PISLAM_X86)
+/// SSE2 implementation of `fastScoreRing`.
+static inline void fastScoreRing(const uint8_t center[16],
+    const uint8_t ring[16][16], uint8_t scores[16]) {
+  __m128i c = _mm_loadu_si128((const __m128i *)center);
+  __m128i score = _mm_setzero_si128();
+  for (int bit = 0x80; bit; bit >>= 1) {
+    __m128i candidate = _mm_or_si128(score, _mm_set1_epi8(char(bit)));
+    __m128i light = _mm_adds_epu8(c, candidate);
+    __m128i dark = _mm_subs_epu8(c, candidate);
+    __m128i d[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+    __m128i l[2] = {_mm_setzero_si128(), _mm_setzero_si128()};
+    for (int i = 0; i < 16; i += 1) {
+      __m128i test = _mm_loadu_si128((const __m128i *)ring[i]);
+      __m128i weight = _mm_set1_epi8(char(0x80 >> (i % 8)));
+      d[i/8] = _mm_or_si128(d[i/8], _mm_and_si128(weight,
+            _mm_cmpeq_epi8(_mm_max_epu8(test, dark), test)));
+      l[i/8] = _mm_or_si128(l[i/8], _mm_and_si128(weight,
+            _mm_cmpeq_epi8(_mm_min_epu8(test, light), test)));
+    }
+    __m128i pass = fastCornerSse2(d[0], l[0], d[1], l[1]);
+    score = _mm_or_si128(_mm_and_si128(pass, candidate),
+        _mm_andnot_si128(pass, score));
+  }
+  _mm_storeu_si128((__m128i *)scores, score);
+}
+#endif
+
+/// Scorers for fastScore, fastScoreBits and fastDetectScore. Each scores
+/// the `n` points at (xs[i], ys[i]) into `scores`, zero for points
+/// scoring no more than `threshold`. Points are given in raster order,
+/// one row at a time.
+///
+/// Harris score of harrisScoreSobel, batched by harrisScoreSobelBatch,
+/// or with a `blockSize` of 7, of harrisScoreSobel7 over the 7x7 window
+/// of OpenCV with k of harrisK / 1024, which needs a border of at least
+/// 5.
+template <int blockSize = 6, int harrisK = blockSize == 6 ? 64 : 41>
+struct HarrisScorer {
+  static_assert(blockSize == 6 || blockSize == 7, "blockSize is 6 or 7");
+  static_assert(blockSize == 7 || harrisK == 64,
+      "the 6x6 window has k = 1/16, a harrisK of 64");
+
+  template <int vstep>
+  static void score(uint8_t img[][vstep], const int32_t *xs,
+      const int32_t *ys, int n, int32_t threshold, uint8_t *scores) {
+    if (blockSize == 6) {
+      harrisScoreSobelBatch<vstep>(img, xs, ys, n, threshold, scores);
+    } else {
+      for (int i = 0; i < n; i += 1) {
+        scores[i] = harrisScoreSobel7<vstep, harrisK>(img, xs[i], ys[i],
+            threshold);
+      }
+    }
+  }
+};
+
+/// Shi-Tomasi score, the smaller eigenvalue of the same sums as the 6x6
+/// Harris score, by shiTomasiEval. It costs a square root more than
+/// HarrisScorer, and needs the same border of 4.
+struct ShiTomasiScorer {
+  template <int vstep>
+  static void score(uint8_t img[][vstep], const int32_t *xs,
+      const int32_t *ys, int n, int32_t threshold, uint8_t *scores) {
+    harrisScoreSobelBatch<vstep, true>(img, xs, ys, n, threshold, scores);
+  }
+};
+
+/// Classic FAST score, the largest threshold at which a point is still
+/// detected, so `threshold` is in the units of the fastDetect threshold.
+/// The rings of 16 points at a time are gathered into lanes and scored
+/// together by fastScoreRing, which is far cheaper than the Harris score.
+/// The last group is padded by repeating the last point. Needs the border
+/// of fastDetect.
+struct FastScorer {
+  template <int vstep>
+  static void score(uint8_t img[][vstep], const int32_t *xs,
+      const int32_t *ys, int n, int32_t threshold, uint8_t *scores) {
+    for (int i = 0; i < n; i += 16) {
+      uint8_t center[16], ring[16][16], s[16];
+      for (int j = 0; j < 16; j += 1) {
+        int k = std::min(i + j, n - 1);
+        center[j] = img[ys[k]][xs[k]];
+        for (int r = 0; r < 16; r += 1) {
+          ring[r][j] = img[ys[k] + fastCircle[r][1]][xs[k] + fastCircle[r][0]];
+        }
+      }
+      fastScoreRing(center, ring, s);
+      for (int j = 0; j < 16 && i + j < n; j += 1) {
+        scores[i + j] = threshold < s[j] ? s[j] : 0;
+      }
+    }
+  }
+};
+
+/// fastDetectScore scores its points once it has collected this many, a
+/// full batch of every scorer, ...
+constexpr int fastScoreBatch = 16;
+/// ... or once they span this many rows, so the rows around them are
+/// still in cache.
+constexpr int fastScoreBand = 4;
+
+/// Score the `n` points collected by fastScore, fastScoreBits or
+/// fastDetectScore, and write their scores to `out`.
+template <int vstep, typename Scorer>
+static inline void fastScoreFlush(uint8_t img[][vstep], const int32_t *xs,
+    const int32_t *ys, int n, int32_t threshold, uint8_t *scores,
+    uint8_t out[][vstep]) {
+  Scorer::template score<vstep>(img, xs, ys, n, threshold, scores);
+  for (int i = 0; i < n; i += 1) {
+    out[ys[i]][xs[i]] = scores[i];
+  }
+}
+
+/// Replace non-zero pixels in `out`, presumably detected points of
+/// interest, with their 8 bit score by `Scorer`. Zero values remain zero.
+///
+/// Points are collected over several rows, up to `vstep` at a time, and
+/// scored together, so that the scorer can fill its batches.
+///
+/// Running time depends on number of non-zero pixels to be classified.
+/// See Harris.h for exact details, but expect 2 ms for a 640x480 VGA
+/// image with the default HarrisScorer.
+///
+template <int vstep, int border, typename Scorer = HarrisScorer<>>
+void fastScore(int width, int height,
+    uint8_t img[][vstep], int32_t threshold, uint8_t out[][vstep]) {
+
+  int32_t xs[2*vstep], ys[2*vstep];
+  uint8_t scores[2*vstep];
+  int n = 0;
+
+  for (int y = border; y < height - border; y += 1) {
+    for (int x = border; x < width - border; x += 1) {
+      if (out[y][x]) {
+        xs[n] = x;
+        ys[n] = y;
+        n += 1;
+      }
+    }
+    if (n >= vstep) {
+      fastScoreFlush<vstep, Scorer>(img, xs, ys, n, threshold, scores, out);
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    fastScoreFlush<vstep, Scorer>(img, xs, ys, n, threshold, scores, out);
+  }
+}
+
+/// fastScore with HarrisScorer.
+template <int vstep, int border, int blockSize = 6,
+         int harrisK = blockSize == 6 ? 64 : 41>
 void fastScoreHarris(int width, int height,
     uint8_t img[][vstep], int32_t threshold, uint8_t out[][vstep]) {
+  fastScore<vstep, border, HarrisScorer<blockSize, harrisK>>(width, height,
+      img, threshold, out);
+}
+
+/// As fastScore, but only in the pixels enabled by `mask`. Rows and
+/// blocks which are masked are not read.
+template <int vstep, int border, typename Scorer = HarrisScorer<>>
+void fastScore(int width, int height, uint8_t img[][vstep],
+    int32_t threshold, uint8_t out[][vstep], const FastMask &mask) {
+
+  int32_t xs[2*vstep], ys[2*vstep];
+  uint8_t scores[2*vstep];
+  int n = 0;
+  const int end = width - border;
 
-  int x, y;
-  for (y = border; y < height - border; y += 1) {
-    for (x = border; x < width - border; x += 1) {
-      uint8_t encoded = out[y][x];
-      if (!encoded) {
+  for (int y = border; y < height - border; y += 1) {
+    if (!mask.rowEnabled(y)) {
+      continue;
+    }
+    for (int x = border; x < end; ) {
+      const int blockEnd = std::min((x | 15) + 1, end);
+      if (!mask.enabled(x, y)) {
+        x = blockEnd;
         continue;
       }
-      out[y][x] = harrisScoreSobel<vstep>(img, x, y, threshold);
+      for (; x < blockEnd; x += 1) {
+        if (out[y][x]) {
+          xs[n] = x;
+          ys[n] = y;
+          n += 1;
+        }
+      }
     }
+    if (n >= vstep) {
+      fastScoreFlush<vstep, Scorer>(img, xs, ys, n, threshold, scores, out);
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    fastScoreFlush<vstep, Scorer>(img, xs, ys, n, threshold, scores, out);
   }
 }
 
+/// Masked fastScore with HarrisScorer.
+template <int vstep, int border, int blockSize = 6,
+         int harrisK = blockSize == 6 ? 64 : 41>
+void fastScoreHarris(int width, int height, uint8_t img[][vstep],
+    int32_t threshold, uint8_t out[][vstep], const FastMask &mask) {
+  fastScore<vstep, border, HarrisScorer<blockSize, harrisK>>(width, height,
+      img, threshold, out, mask);
+}
+
+/// As fastScore, but scoring the points set in a plane from
+/// fastDetectBits and writing their scores to `out`, which is otherwise
+/// left untouched. `out` must be zero apart from the scores written by
+/// the previous call, which fastExtractBits clears again.
+///
+/// Running time depends only on the number of points, plus a test per
+/// 64 pixels.
+///
+template <int vstep, int border, typename Scorer = HarrisScorer<>>
+void fastScoreBits(int width, int height, uint8_t img[][vstep],
+    int32_t threshold, uint64_t bits[][fastBitWords(vstep)],
+    uint8_t out[][vstep]) {
+
+  int32_t xs[2*vstep], ys[2*vstep];
+  uint8_t scores[2*vstep];
+  int n = 0;
+
+  for (int y = border; y < height - border; y += 1) {
+    for (int w = 0; w < fastBitWords(vstep); w += 1) {
+      for (uint64_t word = bits[y][w]; word; word &= word - 1) {
+        xs[n] = w*64 + __builtin_ctzll(word);
+        ys[n] = y;
+        n += 1;
+      }
+    }
+    if (n >= vstep) {
+      fastScoreFlush<vstep, Scorer>(img, xs, ys, n, threshold, scores, out);
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    fastScoreFlush<vstep, Scorer>(img, xs, ys, n, threshold, scores, out);
+  }
+}
+
+/// fastScoreBits with HarrisScorer.
+template <int vstep, int border, int blockSize = 6,
+         int harrisK = blockSize == 6 ? 64 : 41>
+void fastScoreHarrisBits(int width, int height, uint8_t img[][vstep],
+    int32_t threshold, uint64_t bits[][fastBitWords(vstep)],
+    uint8_t out[][vstep]) {
+  fastScoreBits<vstep, border, HarrisScorer<blockSize, harrisK>>(width,
+      height, img, threshold, bits, out);
+}
+
+#if defined(PISLAM_NEON)
+/// fastDetect and fastScore in a single pass. Points are scored once
+/// fastScoreBatch of them are collected, or at the latest fastScoreBand
+/// rows after being classified, while the rows read by both are still in
+/// cache, and `out` is written once. Output inside the border equals that of
+/// fastDetect followed by fastScore. Pixels classified past the border
+/// are written as zero, rather than left undefined.
+///
+/// Running time is that of fastDetect plus the scoring of the detected
+/// points, without a second pass over `out`.
+///
+template <int vstep, int border, typename Scorer = HarrisScorer<>>
+void fastDetectScore(const int width, const int height,
+    uint8_t img[][vstep], int threshold, int32_t scoreThreshold,
+    uint8_t out[][vstep]) {
+
+  uint8x16_t vthreshold = vdupq_n_u8(threshold);
+  const int end = width - border;
+
+  int32_t xs[2*vstep], ys[2*vstep];
+  uint8_t scores[2*vstep];
+  int n = 0;
+
+  for (int y = border; y < height - border; y += 1) {
+    for (int x = border; x < end; x += 16) {
+      uint32_t mask = fastMaskNeon(fastDetectNeonBlock<vstep>(img, x, y,
+            vthreshold));
+      vst1q_u8(&out[y][x], vdupq_n_u8(0));
+      for (mask = fastBitsClip(mask, end - x, 16); mask; mask &= mask - 1) {
+        xs[n] = x + __builtin_ctz(mask);
+        ys[n] = y;
+        n += 1;
+      }
+    }
+    if (width % 16 != 0) {
+      out[y][width  ] = 0;
+      out[y][width+1] = 0;
+    }
+    if (n >= fastScoreBatch || (n > 0 && y - ys[0] >= fastScoreBand - 1)) {
+      fastScoreFlush<vstep, Scorer>(img, xs, ys, n, scoreThreshold, scores,
+          out);
+      n = 0;
+    }
+  }
+  if (n > 0) {
+    fastScoreFlush<vstep, Scorer>(img, xs, ys, n, scoreThreshold, scores,
+        out);
+  }
+}
+
+/// fastDetectScore with HarrisScorer.
+template <int vstep, int border, int blockSize = 6,
+         int harrisK = blockSize == 6 ? 64 : 41>
+void fastDetectScoreHarris(const int width, const int height,
+    uint8_t img[][vstep], int threshold, int32_t harrisThreshold,
+    uint8_t out[][vstep]) {
+  fastDetectScore<vstep, border, HarrisScorer<blockSize, harrisK>>(width,
+      height, img, threshold, harrisThreshold, out);
+}
+#endif
+
+template <int border, int logBucketSize>
+static inline int fastExtractBucketCount(const int width) {
+  return (width - 2*border - 1) / (1 << logBucketSize) + 1;
+}
+
+/// Implementation of fastExtract, with the buckets and their counts
+/// provided by the caller, and points only emitted from pixels enabled
+/// by `mask`, if given.
+template <int vstep, int border, int logBucketSize, int bucketLimit>
+void fastExtractBuckets(const int width, const int height,
+    uint8_t out[][vstep], std::vector<Keypoint> &results,
+    Keypoint (*buckets)[bucketLimit], int *counts,
+    const FastMask *mask = nullptr);
+
 /// Extract FAST (or other) points with non-max suppression. Points are tested
 /// against 8 surrounding pixels for maximality.
 ///
@@ -191,156 +1204,220 @@ void fastScoreHarris(int width, int height,
 /// completely optimize out the added overhead.
 ///
 /// Running time is < ms for a 640x480 VGA image and bucket overhead is about
-/// .1 ms.
+/// .1 ms. On ARM and x86, suppression is vectorized 16 pixels at a time,
+/// so the time hardly depends on how many points the scene holds.
 /// 
 template <int vstep, int border, int logBucketSize = 0, int bucketLimit = 5>
-std::vector<uint32_t> fastExtract(const int width, const int height,
-    uint8_t out[][vstep], std::vector<uint32_t> &results) {
+std::vector<Keypoint> fastExtract(const int width, const int height,
+    uint8_t out[][vstep], std::vector<Keypoint> &results) {
 
-  constexpr int bucketSize = 1 << logBucketSize;
-  const int numBuckets = (width - 2*border - 1) / bucketSize + 1;
-  uint32_t buckets[numBuckets][bucketLimit];
+  const int numBuckets = fastExtractBucketCount<border, logBucketSize>(width);
+  Keypoint buckets[numBuckets][bucketLimit];
   int counts[numBuckets];
 
+  fastExtractBuckets<vstep, border, logBucketSize, bucketLimit>(width, height,
+      out, results, buckets, counts);
+  return results;
+}
+
+/// As above, but with bucket storage taken from `context` and without
+/// returning a copy of `results`, so that no memory is allocated once
+/// `results` has enough capacity.
+template <int vstep, int border, int logBucketSize = 0, int bucketLimit = 5>
+void fastExtract(const int width, const int height,
+    uint8_t out[][vstep], std::vector<Keypoint> &results,
+    OrbContext &context) {
+
+  const int numBuckets = fastExtractBucketCount<border, logBucketSize>(width);
+  Keypoint *buckets = OrbContext::ensure(context.buckets,
+      (size_t)numBuckets * bucketLimit);
+  int *counts = OrbContext::ensure(context.bucketCounts, numBuckets);
+
+  fastExtractBuckets<vstep, border, logBucketSize, bucketLimit>(width, height,
+      out, results, (Keypoint (*)[bucketLimit])buckets, counts);
+}
+
+/// As above, but only emitting points from pixels enabled by `mask`.
+/// Pairs of rows and vectors of 16 pixels which are wholly masked are
+/// skipped. Suppression still compares with masked neighbours, which
+/// are zero if `out` came from the masked fastDetect.
+template <int vstep, int border, int logBucketSize = 0, int bucketLimit = 5>
+void fastExtract(const int width, const int height,
+    uint8_t out[][vstep], std::vector<Keypoint> &results,
+    OrbContext &context, const FastMask &mask) {
+
+  const int numBuckets = fastExtractBucketCount<border, logBucketSize>(width);
+  Keypoint *buckets = OrbContext::ensure(context.buckets,
+      (size_t)numBuckets * bucketLimit);
+  int *counts = OrbContext::ensure(context.bucketCounts, numBuckets);
+
+  fastExtractBuckets<vstep, border, logBucketSize, bucketLimit>(width, height,
+      out, results, (Keypoint (*)[bucketLimit])buckets, counts, &mask);
+}
+
+/// Non-max suppression of the 2x2 block of pixels at (x, y). Sets
+/// `result` and returns true if one of the four survives.
+template <int vstep>
+static inline bool fastExtractBlock(uint8_t out[][vstep], int x, int y,
+    Keypoint &result) {
+
   typedef union {
     uint8_t *bytes;
     uint32_t *word;
   } aliased_uint32_ptr_t;
 
-  for (int y = border; y < height - border; y += 2) {
-    if ((logBucketSize != 0) && ((y-border) % bucketSize) == 0) {
-      if (y == border) {
-        // skip retain step on initialisation
-        for (int b = 0; b < numBuckets; b += 1) {
-          counts[b] = 0;
-        }
-      } else {
-        // retain best points and reset buckets
-        for (int b = 0; b < numBuckets; b += 1) {
-          int count = counts[b];
-          for (int i = 0; i < count; i += 1) {
-            results.push_back(buckets[b][i]);
-          }
-          counts[b] = 0;
-        }
-      }
-    }
-    for (int x = border; x < width - border; x += 2) {
-      aliased_uint32_ptr_t ptr0, ptr1, ptr2, ptr3;
+  aliased_uint32_ptr_t ptr0, ptr1, ptr2, ptr3;
 
-      ptr1.bytes = &out[y+0][x-1];
-      ptr2.bytes = &out[y+1][x-1];
+  ptr1.bytes = &out[y+0][x-1];
+  ptr2.bytes = &out[y+1][x-1];
 
-      uint32_t row1 = *ptr1.word;
-      uint32_t row2 = *ptr2.word;
+  uint32_t row1 = *ptr1.word;
+  uint32_t row2 = *ptr2.word;
 
-      if (!((row1 & 0xffff00) || (row2 & 0xffff00))) {
-        continue;
-      }
+  if (!((row1 & 0xffff00) || (row2 & 0xffff00))) {
+    return false;
+  }
 
-      ptr0.bytes = &out[y-1][x-1];
-      ptr3.bytes = &out[y+2][x-1];
-
-      uint32_t row0 = *ptr0.word;
-      uint32_t row3 = *ptr3.word;
-
-      // Test a 4x4 block of pixels since that fits into 4 registers.
-      // Of the four middle pixels, only one will not be suppressed.
-      //
-      //       b0 b1 b2 b3
-      // row0  
-      // row1     v0 v1
-      // row2     v2 v3
-      // row3
-      //
-      // Determine which pixel is strongest, and then check the remaining
-      // values to see if pixel survives.
-      uint8_t v0 = (row1 >> 8) & 0xff;
-      uint8_t v1 = (row1 >> 16) & 0xff;
-      uint8_t v2 = (row2 >> 8) & 0xff;
-      uint8_t v3 = (row2 >> 16) & 0xff;
-
-      uint32_t result;
-      if (v0 > v1 && v0 > v2 && v0 > v3) {
-        if ((v0 >= (row0 & 0xff)) && (v0 >= (row1 & 0xff)) && (v0 > (row2 & 0xff))) {
-          row0 >>= 8;
-          if (v0 >= (row0 & 0xff)) {
-            row0 >>= 8;
-            if (v0 >= (row0 & 0xff)) {
-              result = encodeFast(v0, x, y);
-              goto store;
-            }
-          }
-        }
-      } else if (v1 > v2 && v1 > v3) {
+  ptr0.bytes = &out[y-1][x-1];
+  ptr3.bytes = &out[y+2][x-1];
+
+  uint32_t row0 = *ptr0.word;
+  uint32_t row3 = *ptr3.word;
+
+  // Test a 4x4 block of pixels since that fits into 4 registers.
+  // Of the four middle pixels, only one will not be suppressed.
+  //
+  //       b0 b1 b2 b3
+  // row0  
+  // row1     v0 v1
+  // row2     v2 v3
+  // row3
+  //
+  // Determine which pixel is strongest, and then check the remaining
+  // values to see if pixel survives.
+  uint8_t v0 = (row1 >> 8) & 0xff;
+  uint8_t v1 = (row1 >> 16) & 0xff;
+  uint8_t v2 = (row2 >> 8) & 0xff;
+  uint8_t v3 = (row2 >> 16) & 0xff;
+
+  if (v0 > v1 && v0 > v2 && v0 > v3) {
+    if ((v0 >= (row0 & 0xff)) && (v0 >= (row1 & 0xff)) && (v0 > (row2 & 0xff))) {
+      row0 >>= 8;
+      if (v0 >= (row0 & 0xff)) {
         row0 >>= 8;
-        if (v1 >= (row0 & 0xff)) {
-          row0 >>= 8;
-          if (v1 >= (row0 & 0xff)) {
-            row0 >>= 8; row1 >>= 24; row2 >>= 24;
-            if ((v1 >= (row0 & 0xff)) && (v1 > (row1 & 0xff)) && (v1 > (row2 & 0xff))) {
-              result = encodeFast(v1, x+1, y);
-              goto store;
-            }
-          }
+        if (v0 >= (row0 & 0xff)) {
+          result = encodeFast(v0, x, y);
+          return true;
         }
-      } else if (v2 > v3) {
-        if ((v2 >= (row1 & 0xff)) && (v2 >= (row2 & 0xff)) && (v2 > (row3 & 0xff))) {
-          row3 >>= 8;
-          if (v2 > (row3 & 0xff)) {
-            row3 >>= 8;
-            if (v2 > (row3 & 0xff)) {
-              result = encodeFast(v2, x, y+1);
-              goto store;
-            }
-          }
+      }
+    }
+  } else if (v1 > v2 && v1 > v3) {
+    row0 >>= 8;
+    if (v1 >= (row0 & 0xff)) {
+      row0 >>= 8;
+      if (v1 >= (row0 & 0xff)) {
+        row0 >>= 8; row1 >>= 24; row2 >>= 24;
+        if ((v1 >= (row0 & 0xff)) && (v1 > (row1 & 0xff)) && (v1 > (row2 & 0xff))) {
+          result = encodeFast(v1, x+1, y);
+          return true;
         }
-      } else {
+      }
+    }
+  } else if (v2 > v3) {
+    if ((v2 >= (row1 & 0xff)) && (v2 >= (row2 & 0xff)) && (v2 > (row3 & 0xff))) {
+      row3 >>= 8;
+      if (v2 > (row3 & 0xff)) {
         row3 >>= 8;
-        if (v3 > (row3 & 0xff)) {
-          row3 >>= 8;
-          if (v3 > (row3 & 0xff)) {
-            row1 >>= 24; row2 >>= 24; row3 >>= 8;
-            if ((v3 >= (row1 & 0xff)) && (v3 > (row2 & 0xff)) && (v3 > (row3 & 0xff))) {
-              result = encodeFast(v3, x+1, y+1);
-              goto store;
-            }
-          }
+        if (v2 > (row3 & 0xff)) {
+          result = encodeFast(v2, x, y+1);
+          return true;
+        }
+      }
+    }
+  } else {
+    row3 >>= 8;
+    if (v3 > (row3 & 0xff)) {
+      row3 >>= 8;
+      if (v3 > (row3 & 0xff)) {
+        row1 >>= 24; row2 >>= 24; row3 >>= 8;
+        if ((v3 >= (row1 & 0xff)) && (v3 > (row2 & 0xff)) && (v3 > (row3 & 0xff))) {
+          result = encodeFast(v3, x+1, y+1);
+          return true;
         }
       }
+    }
+  }
 
-      continue;
+  return false;
+}
 
-store:
-
-      int bucket = (x-border) / bucketSize;
-      int count = counts[bucket];
-
-      if (logBucketSize == 0) {
-        results.push_back(result);
-      } else if (count == 0) {
-        // technically case below handles count == 0, but is slightly slower.
-        buckets[bucket][0] = result;
-        counts[bucket] = 1;
-      } else if (count < bucketLimit) {
-        // forward insertion
-        int i;
-        for (i = count - 1; i >= 0 && result < buckets[bucket][i]; i -= 1) {
-          // not an off by one error, count < bucket limit, therefore count-1+1 is valid.
-          buckets[bucket][i+1] = buckets[bucket][i];
-        }
-        buckets[bucket][i+1] = result;
-        counts[bucket] = count + 1;
-      } else if (result > buckets[bucket][0]) {
-        // backwards insertion if we are full but result is stronger
-        int i;
-        for (i = 1; i < bucketLimit && result > buckets[bucket][i]; i += 1) {
-          buckets[bucket][i-1] = buckets[bucket][i];
+/// Keep a surviving point, directly or in the bucket of its column.
+template <int border, int logBucketSize, int bucketLimit>
+static inline void fastExtractStore(Keypoint result, int x,
+    std::vector<Keypoint> &results, Keypoint (*buckets)[bucketLimit],
+    int *counts) {
+
+  constexpr int bucketSize = 1 << logBucketSize;
+  int bucket = (x-border) / bucketSize;
+  int count = counts[bucket];
+
+  if (logBucketSize == 0) {
+    results.push_back(result);
+  } else if (count == 0) {
+    // technically case below handles count == 0, but is slightly slower.
+    buckets[bucket][0] = result;
+    counts[bucket] = 1;
+  } else if (count < bucketLimit) {
+    // forward insertion
+    int i;
+    for (i = count - 1; i >= 0 && result < buckets[bucket][i]; i -= 1) {
+      // not an off by one error, count < bucket limit, therefore count-1+1 is valid.
+      buckets[bucket][i+1] = buckets[bucket][i];
+    }
+    buckets[bucket][i+1] = result;
+    counts[bucket] = count + 1;
+  } else if (result > buckets[bucket][0]) {
+    // backwards insertion if we are full but result is stronger
+    int i;
+    for (i = 1; i < bucketLimit && result > buckets[bucket][i]; i += 1) {
+      buckets[bucket][i-1] = buckets[bucket][i];
+    }
+    buckets[bucket][i-1] = result;
+  }
+}
+
+/// At the first row of each band of buckets, emit the points retained
+/// by the previous band and empty the buckets.
+template <int border, int logBucketSize, int bucketLimit>
+static inline void fastExtractBand(int y, int numBuckets,
+    std::vector<Keypoint> &results, Keypoint (*buckets)[bucketLimit],
+    int *counts) {
+
+  constexpr int bucketSize = 1 << logBucketSize;
+  if ((logBucketSize != 0) && ((y-border) % bucketSize) == 0) {
+    if (y == border) {
+      // skip retain step on initialisation
+      for (int b = 0; b < numBuckets; b += 1) {
+        counts[b] = 0;
+      }
+    } else {
+      // retain best points and reset buckets
+      for (int b = 0; b < numBuckets; b += 1) {
+        int count = counts[b];
+        for (int i = 0; i < count; i += 1) {
+          results.push_back(buckets[b][i]);
         }
-        buckets[bucket][i-1] = result;
+        counts[b] = 0;
       }
     }
   }
+}
+
+/// Emit the points retained by the last band of buckets.
+template <int logBucketSize, int bucketLimit>
+static inline void fastExtractFinish(int numBuckets,
+    std::vector<Keypoint> &results, Keypoint (*buckets)[bucketLimit],
+    int *counts) {
 
   if (logBucketSize != 0) {
     for (int b = 0; b < numBuckets; b += 1) {
@@ -350,9 +1427,355 @@ store:
       }
     }
   }
+}
 
-  return results;
+/// As fastExtract, visiting only the 2x2 blocks holding a point set in
+/// `bits`, as produced by fastDetectBits, with scores in `out`, as
+/// produced by fastScoreHarrisBits. Output is identical to fastExtract
+/// on the same scores. The scores are cleared afterwards, so `out` is
+/// zero again for the next frame.
+///
+/// Running time depends only on the number of points, plus a test per
+/// 64 pixels of every second row.
+///
+template <int vstep, int border, int logBucketSize = 0, int bucketLimit = 5>
+void fastExtractBits(const int width, const int height,
+    uint64_t bits[][fastBitWords(vstep)], uint8_t out[][vstep],
+    std::vector<Keypoint> &results, OrbContext &context) {
+
+  constexpr int words = fastBitWords(vstep);
+  const int numBuckets = fastExtractBucketCount<border, logBucketSize>(width);
+  Keypoint (*buckets)[bucketLimit] = (Keypoint (*)[bucketLimit])
+    OrbContext::ensure(context.buckets, (size_t)numBuckets * bucketLimit);
+  int *counts = OrbContext::ensure(context.bucketCounts, numBuckets);
+
+  // Blocks start at even offsets from the border.
+  const uint64_t blockStarts = border % 2 == 0 ?
+    0x5555555555555555ull : 0xaaaaaaaaaaaaaaaaull;
+
+  for (int y = border; y < height - border; y += 2) {
+    fastExtractBand<border, logBucketSize, bucketLimit>(y, numBuckets,
+        results, buckets, counts);
+    for (int w = 0; w < words; w += 1) {
+      uint64_t points = bits[y][w] | bits[y+1][w];
+      uint64_t next = w + 1 < words ? bits[y][w+1] | bits[y+1][w+1] : 0;
+      if (!(points | (next & 1))) {
+        continue;
+      }
+      // a block starting at x holds pixels x and x+1
+      uint64_t blocks = (points | points >> 1 | next << 63) & blockStarts;
+      for (; blocks; blocks &= blocks - 1) {
+        int x = w*64 + __builtin_ctzll(blocks);
+        Keypoint result;
+        if (fastExtractBlock<vstep>(out, x, y, result)) {
+          fastExtractStore<border, logBucketSize, bucketLimit>(result, x,
+              results, buckets, counts);
+        }
+      }
+    }
+  }
+
+  fastExtractFinish<logBucketSize, bucketLimit>(numBuckets, results,
+      buckets, counts);
+
+  for (int y = border; y < height - border; y += 1) {
+    for (int w = 0; w < words; w += 1) {
+      for (uint64_t word = bits[y][w]; word; word &= word - 1) {
+        out[y][w*64 + __builtin_ctzll(word)] = 0;
+      }
+    }
+  }
+}
+
+#if defined(PISLAM_NEON)
+/// Non-max suppression of the 16 pixels of row y from x, by the rule of
+/// fastExtractBlock: a pixel survives if it is at least each neighbour
+/// above or to its left, and greater than each neighbour below or to its
+/// right. Returns 0xff in the lanes that survive. Greater than implies
+/// non-zero, so empty pixels never survive.
+template <int vstep>
+static inline uint8x16_t fastNmsNeon(uint8_t out[][vstep], int x, int y) {
+  uint8x16_t c = vld1q_u8(&out[y][x]);
+  uint8x16_t before = vmaxq_u8(
+      vmaxq_u8(vld1q_u8(&out[y-1][x-1]), vld1q_u8(&out[y-1][x])),
+      vmaxq_u8(vld1q_u8(&out[y-1][x+1]), vld1q_u8(&out[y][x-1])));
+  uint8x16_t after = vmaxq_u8(
+      vmaxq_u8(vld1q_u8(&out[y][x+1]), vld1q_u8(&out[y+1][x-1])),
+      vmaxq_u8(vld1q_u8(&out[y+1][x]), vld1q_u8(&out[y+1][x+1])));
+  return vandq_u8(vcgeq_u8(c, before), vcgtq_u8(c, after));
+}
+
+/// Survivors of the 16 pixels from x of rows y and y + 1, as a mask per
+/// row. A row is only tested if the pair holds a non-zero score.
+template <int vstep>
+static inline bool fastNms(uint8_t out[][vstep], int x, int y,
+    uint32_t &row0, uint32_t &row1) {
+  uint8x16_t any = vorrq_u8(vld1q_u8(&out[y][x]), vld1q_u8(&out[y+1][x]));
+  uint64x2_t halves = vreinterpretq_u64_u8(any);
+  if (!(vgetq_lane_u64(halves, 0) | vgetq_lane_u64(halves, 1))) {
+    return false;
+  }
+  row0 = fastMaskNeon(fastNmsNeon<vstep>(out, x, y));
+  row1 = fastMaskNeon(fastNmsNeon<vstep>(out, x, y + 1));
+  return true;
+}
+#elif defined(PISLAM_X86)
+/// SSE2 implementation of `fastNmsNeon`. There is no unsigned byte
+/// compare, so c >= m is tested as max(c, m) == c and c > m as its
+/// complement on the swapped operands.
+template <int vstep>
+static inline __m128i fastNmsSse2(uint8_t out[][vstep], int x, int y) {
+  __m128i c = _mm_loadu_si128((const __m128i *)&out[y][x]);
+  __m128i before = _mm_max_epu8(
+      _mm_max_epu8(_mm_loadu_si128((const __m128i *)&out[y-1][x-1]),
+        _mm_loadu_si128((const __m128i *)&out[y-1][x])),
+      _mm_max_epu8(_mm_loadu_si128((const __m128i *)&out[y-1][x+1]),
+        _mm_loadu_si128((const __m128i *)&out[y][x-1])));
+  __m128i after = _mm_max_epu8(
+      _mm_max_epu8(_mm_loadu_si128((const __m128i *)&out[y][x+1]),
+        _mm_loadu_si128((const __m128i *)&out[y+1][x-1])),
+      _mm_max_epu8(_mm_loadu_si128((const __m128i *)&out[y+1][x]),
+        _mm_loadu_si128((const __m128i *)&out[y+1][x+1])));
+  __m128i geBefore = _mm_cmpeq_epi8(_mm_max_epu8(c, before), c);
+  __m128i leAfter = _mm_cmpeq_epi8(_mm_max_epu8(after, c), after);
+  return _mm_andnot_si128(leAfter, geBefore);
+}
+
+/// SSE2 implementation of `fastNms`.
+template <int vstep>
+static inline bool fastNms(uint8_t out[][vstep], int x, int y,
+    uint32_t &row0, uint32_t &row1) {
+  __m128i any = _mm_or_si128(_mm_loadu_si128((const __m128i *)&out[y][x]),
+      _mm_loadu_si128((const __m128i *)&out[y+1][x]));
+  if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) == 0xffff) {
+    return false;
+  }
+  row0 = _mm_movemask_epi8(fastNmsSse2<vstep>(out, x, y));
+  row1 = _mm_movemask_epi8(fastNmsSse2<vstep>(out, x, y + 1));
+  return true;
+}
+#endif
+
+#if defined(PISLAM_NEON) || defined(PISLAM_X86)
+/// Non-max suppression is computed for 16 pixels of two rows at once,
+/// with a vector max of the neighbours before and after each pixel, so
+/// there are no data dependent branches until survivors are emitted.
+/// Two survivors are never adjacent, so at most one of each 2x2 block
+/// survives, and emitting the survivors of both rows in column order
+/// visits the blocks in the same order as fastExtractBlock. Output is
+/// identical, and running time barely depends on the number of points.
+template <int vstep, int border, int logBucketSize, int bucketLimit>
+void fastExtractBuckets(const int width, const int height,
+    uint8_t out[][vstep], std::vector<Keypoint> &results,
+    Keypoint (*buckets)[bucketLimit], int *counts, const FastMask *mask) {
+
+  const int numBuckets = fastExtractBucketCount<border, logBucketSize>(width);
+  // columns of the 2x2 blocks from the border
+  const int end = border + ((width - 2*border + 1) & ~1);
+
+  // mask lanes of rows y and y + 1
+  uint8_t lanes[2][vstep + 16];
+  int bands[2] = {-1, -1};
+
+  for (int y = border; y < height - border; y += 2) {
+    fastExtractBand<border, logBucketSize, bucketLimit>(y, numBuckets,
+        results, buckets, counts);
+    if (mask) {
+      if (!mask->rowEnabled(y) && !mask->rowEnabled(y + 1)) {
+        continue;
+      }
+      for (int r = 0; r < 2; r += 1) {
+        if ((y + r) >> FastMask::logBlockSize != bands[r]) {
+          bands[r] = (y + r) >> FastMask::logBlockSize;
+          mask->lanes(y + r, lanes[r], vstep + 16);
+        }
+      }
+    }
+    for (int x = border; x < end; x += 16) {
+      if (mask && !fastMaskAny(lanes[0], x, 16) &&
+          !fastMaskAny(lanes[1], x, 16)) {
+        continue;
+      }
+      uint32_t row0, row1;
+      if (!fastNms<vstep>(out, x, y, row0, row1)) {
+        continue;
+      }
+      uint32_t survivors = row0 | row1;
+      if (end - x < 16) {
+        survivors &= (1u << (end - x)) - 1;
+      }
+      for (; survivors; survivors &= survivors - 1) {
+        int i = __builtin_ctz(survivors);
+        int r = row1 >> i & 1;
+        if (mask && !lanes[r][x + i]) {
+          continue;
+        }
+        Keypoint result = encodeFast(out[y + r][x + i], x + i, y + r);
+        fastExtractStore<border, logBucketSize, bucketLimit>(result, x + i,
+            results, buckets, counts);
+      }
+    }
+  }
+
+  fastExtractFinish<logBucketSize, bucketLimit>(numBuckets, results,
+      buckets, counts);
+}
+#else
+template <int vstep, int border, int logBucketSize, int bucketLimit>
+void fastExtractBuckets(const int width, const int height,
+    uint8_t out[][vstep], std::vector<Keypoint> &results,
+    Keypoint (*buckets)[bucketLimit], int *counts, const FastMask *mask) {
+
+  const int numBuckets = fastExtractBucketCount<border, logBucketSize>(width);
+
+  for (int y = border; y < height - border; y += 2) {
+    fastExtractBand<border, logBucketSize, bucketLimit>(y, numBuckets,
+        results, buckets, counts);
+    for (int x = border; x < width - border; x += 2) {
+      Keypoint result;
+      if (fastExtractBlock<vstep>(out, x, y, result) && (!mask ||
+            mask->enabled(decodeFastX(result), decodeFastY(result)))) {
+        fastExtractStore<border, logBucketSize, bucketLimit>(result, x,
+            results, buckets, counts);
+      }
+    }
+  }
+
+  fastExtractFinish<logBucketSize, bucketLimit>(numBuckets, results,
+      buckets, counts);
+}
+#endif
+
+#if defined(PISLAM_NEON) || defined(PISLAM_X86)
+/// Classify the pixels [x0, x1) of row y into `out`, 16 at a time, and
+/// clear the pixels classified past x1.
+template <int vstep>
+static inline void fastDetectSpan(uint8_t img[][vstep], uint8_t out[][vstep],
+    int x0, int x1, int y, int threshold) {
+  int x = x0;
+#if defined(PISLAM_NEON)
+  uint8x16_t vthreshold = vdupq_n_u8(threshold);
+  for (; x < x1; x += 16) {
+    vst1q_u8(&out[y][x], fastDetectNeonBlock<vstep>(img, x, y, vthreshold));
+  }
+#else
+  __m128i vthreshold = _mm_set1_epi8(char(threshold));
+  for (; x < x1; x += 16) {
+    _mm_storeu_si128((__m128i *)&out[y][x],
+        fastDetectSse2Block<vstep>(img, x, y, vthreshold));
+  }
+#endif
+  std::fill(&out[y][x1], &out[y][x1] + (x - x1), 0);
+}
+
+/// Whether `out[y][x]` survives non-max suppression by the rule of
+/// fastExtractBlock.
+template <int vstep>
+static inline bool fastLocalMax(uint8_t out[][vstep], int x, int y) {
+  const uint8_t v = out[y][x];
+  return v >= out[y-1][x-1] && v >= out[y-1][x] && v >= out[y-1][x+1] &&
+    v >= out[y][x-1] && v > out[y][x+1] &&
+    v > out[y+1][x-1] && v > out[y+1][x] && v > out[y+1][x+1];
+}
+
+/// Incremental detection for steady state tracking: fastDetect,
+/// fastScore and fastExtract, but only in the cells of `1 << logCellSize`
+/// pixels that the tracker asks to refill, for example those which lost
+/// their tracks. `requested` holds fastCellCount(height) rows of
+/// fastCellCount(width) flags, non-zero to detect in the cell, with cell
+/// (0, 0) at the top left pixel of the image.
+///
+/// Each requested cell is detected and scored with a halo of one pixel,
+/// so that suppression at its edges compares with the same scores as a
+/// full pass. The FAST ring and the scorer's window read the image
+/// directly, so their halos need no work. Points are those fastExtract,
+/// without buckets, finds in the cell after a full pass with fastDetect
+/// and fastScore, encoded by encodeFast and appended in raster order
+/// within each cell, cells in raster order.
+///
+/// `out` is scratch and must be zero. It is cleared again afterwards, so
+/// it may be shared with the full pass. Running time is in proportion to
+/// the requested area, so refilling a tenth of the cells costs about a
+/// tenth of a full pass, plus the halos.
+///
+template <int vstep, int border, int logCellSize = 5,
+         typename Scorer = HarrisScorer<>>
+void fastRedetect(const int width, const int height, uint8_t img[][vstep],
+    uint8_t out[][vstep], int threshold, int32_t scoreThreshold,
+    const uint8_t *requested, std::vector<Keypoint> &results) {
+
+  constexpr int cellSize = 1 << logCellSize;
+  static_assert(cellSize + 2 <= vstep, "A cell row must fit the batch");
+  const int columns = fastCellCount<logCellSize>(width);
+  const int rows = fastCellCount<logCellSize>(height);
+
+  int32_t xs[2*vstep], ys[2*vstep];
+  uint8_t scores[2*vstep];
+
+  for (int cy = 0; cy < rows; cy += 1) {
+    for (int cx = 0; cx < columns; cx += 1) {
+      if (!requested[cy * columns + cx]) {
+        continue;
+      }
+      // Points come from the cell within the border, and are suppressed
+      // by the pixels around it.
+      const int x0 = std::max(cx * cellSize, border);
+      const int x1 = std::min((cx + 1) * cellSize, width - border);
+      const int y0 = std::max(cy * cellSize, border);
+      const int y1 = std::min((cy + 1) * cellSize, height - border);
+      if (x0 >= x1 || y0 >= y1) {
+        continue;
+      }
+      const int hx0 = std::max(x0 - 1, border);
+      const int hx1 = std::min(x1 + 1, width - border);
+      const int hy0 = std::max(y0 - 1, border);
+      const int hy1 = std::min(y1 + 1, height - border);
+
+      int n = 0;
+      for (int y = hy0; y < hy1; y += 1) {
+        fastDetectSpan<vstep>(img, out, hx0, hx1, y, threshold);
+        for (int x = hx0; x < hx1; x += 1) {
+          if (out[y][x]) {
+            xs[n] = x;
+            ys[n] = y;
+            n += 1;
+          }
+        }
+        if (n >= vstep) {
+          fastScoreFlush<vstep, Scorer>(img, xs, ys, n, scoreThreshold,
+              scores, out);
+          n = 0;
+        }
+      }
+      if (n > 0) {
+        fastScoreFlush<vstep, Scorer>(img, xs, ys, n, scoreThreshold,
+            scores, out);
+      }
+
+      for (int y = y0; y < y1; y += 1) {
+        for (int x = x0; x < x1; x += 1) {
+          if (out[y][x] && fastLocalMax<vstep>(out, x, y)) {
+            results.push_back(encodeFast(out[y][x], x, y));
+          }
+        }
+      }
+      for (int y = hy0; y < hy1; y += 1) {
+        std::fill(&out[y][hx0], &out[y][hx1], 0);
+      }
+    }
+  }
+}
+
+/// fastRedetect with HarrisScorer.
+template <int vstep, int border, int logCellSize = 5>
+void fastRedetectHarris(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int threshold,
+    int32_t harrisThreshold, const uint8_t *requested,
+    std::vector<Keypoint> &results) {
+  fastRedetect<vstep, border, logCellSize>(width, height, img, out,
+      threshold, harrisThreshold, requested, results);
 }
+#endif
 
 } /* namespace pislam */
 #endif /* PISLAM_FAST_H_ */
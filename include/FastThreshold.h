@@ -0,0 +1,118 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_FAST_THRESHOLD_H_
+#define PISLAM_FAST_THRESHOLD_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "Fast.h"
+#include "Util.h"
+
+namespace pislam {
+
+/// FAST thresholds per cell of one image or pyramid level, adapted from
+/// frame to frame so that every cell yields about `target` points,
+/// whatever the light and texture of the scene. Dark or flat regions get
+/// lower thresholds and busy regions higher ones, which keeps the cost of
+/// scoring and description bounded without detecting a frame twice.
+///
+/// Each frame, detect with fastDetectCells using thresholds(), extract as
+/// usual, and pass the points kept to update, which moves the threshold
+/// of every cell towards its target for the next frame:
+///
+///     pislam::FastThresholdGrid<> grid(640, 480, 4);
+///     ...
+///     pislam::fastDetectCells<640, 16>(640, 480, img, out, grid.thresholds());
+///     pislam::fastScoreHarris<640, 16>(640, 480, img, 1 << 15, out);
+///     pislam::fastExtract<640, 16>(640, 480, out, keypoints);
+///     grid.update(keypoints.data(), keypoints.data() + keypoints.size());
+///
+/// A cell with more points than its target raises its threshold by an
+/// eighth, and one with fewer lowers it by an eighth, by at least one
+/// step and within [minThreshold, maxThreshold]. Detection counts fall
+/// steeply with the threshold, so geometric steps converge in a few
+/// frames from any start, and a cell at its target holds still.
+template <int logCellSize = 5>
+class FastThresholdGrid {
+ public:
+  FastThresholdGrid(int width, int height, int target, int initial = 20,
+      int minThreshold = 5, int maxThreshold = 120)
+      : width(width), height(height),
+        columns(fastCellCount<logCellSize>(width)),
+        rows(fastCellCount<logCellSize>(height)), target(target),
+        minThreshold(minThreshold), maxThreshold(maxThreshold),
+        cells((size_t)columns * rows, (uint8_t)initial),
+        counts((size_t)columns * rows) {}
+
+  /// Row major thresholds for fastDetectCells.
+  const uint8_t *thresholds() const {
+    return cells.data();
+  }
+
+  int cellColumns() const {
+    return columns;
+  }
+
+  int cellRows() const {
+    return rows;
+  }
+
+  /// Adapt the thresholds to the points found with them. Points are
+  /// encoded by encodeFast, with y relative to `row`, for example the
+  /// first row of the level in a stacked pyramid. Points outside the
+  /// grid are ignored.
+  void update(const Keypoint *begin, const Keypoint *end, int row = 0) {
+    std::fill(counts.begin(), counts.end(), 0);
+    for (const Keypoint *p = begin; p < end; ++p) {
+      int x = decodeFastX(*p);
+      int y = (int)decodeFastY(*p) - row;
+      if (x < width && 0 <= y && y < height) {
+        counts[(y >> logCellSize) * columns + (x >> logCellSize)] += 1;
+      }
+    }
+    for (size_t i = 0; i < cells.size(); i += 1) {
+      int t = cells[i];
+      int step = std::max(t / 8, 1);
+      if (counts[i] > target) {
+        t = std::min(t + step, maxThreshold);
+      } else if (counts[i] < target) {
+        t = std::max(t - step, minThreshold);
+      }
+      cells[i] = t;
+    }
+  }
+
+ private:
+  const int width;
+  const int height;
+  const int columns;
+  const int rows;
+  const int target;
+  const int minThreshold;
+  const int maxThreshold;
+
+  std::vector<uint8_t> cells;
+  std::vector<int> counts;
+};
+
+} /* namespace pislam */
+#endif /* PISLAM_FAST_THRESHOLD_H_ */
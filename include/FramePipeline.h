@@ -0,0 +1,402 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_FRAME_PIPELINE_H_
+#define PISLAM_FRAME_PIPELINE_H_
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "Platform.h"
+#include "Fast.h"
+#include "FastThreshold.h"
+#include "OrbContext.h"
+#include "Pyramid.h"
+#include "Select.h"
+#include "SpscQueue.h"
+#include "Util.h"
+
+#if defined(PISLAM_NEON)
+#include "Orb.h"
+#endif
+
+namespace pislam {
+
+/// Snapshot of the counters of one pipeline stage.
+struct PipelineStats {
+  /// Frames waiting for the stage now, and the most ever waiting.
+  size_t queueDepth;
+  size_t maxQueueDepth;
+  /// Frames completed by the stage.
+  uint64_t frames;
+  /// Mean time a frame waited in the stage's queue.
+  double meanWaitMs;
+  /// Mean and worst time the stage spent on a frame.
+  double meanRunMs;
+  double maxRunMs;
+};
+
+#if defined(PISLAM_NEON)
+/// Extract ORB features from a stream of frames, overlapping the stages
+/// of consecutive frames on separate threads.
+///
+/// The three stages are buildPyramid, detection (fastDetect,
+/// fastScoreHarris and fastExtract of every level) and orbCompute. While
+/// frame N is being described, frame N+1 is being detected and frame N+2
+/// is being blurred and reduced, so throughput is bounded by the slowest
+/// stage rather than their sum. Latency is unchanged.
+///
+/// Frames circulate through a fixed ring of `depth` buffers, allocated
+/// with the pipeline, and are handed between stages through lock-free
+/// single producer, single consumer queues. Each stage has its own
+/// OrbContext, so once the first frame is through, the pipeline performs
+/// no allocation. Idle stages spin briefly and then poll every 100us,
+/// which bounds the added latency per stage.
+///
+/// Usage, with acquire and submit called from one thread, and receive
+/// and release called from one thread, which may be the same thread:
+///
+///     Frame *frame = pipeline.acquire();  // nullptr if all in flight
+///     copy the width x height image into frame->img
+///     pipeline.submit(frame);
+///     ...
+///     Frame *done = pipeline.receive();   // frames arrive in order
+///     use done->keypoints and done->descriptors
+///     pipeline.release(done);
+template <int vstep, int border = 16, int logBucketSize = 0,
+         int bucketLimit = 5, int words = 8>
+class FramePipeline {
+ public:
+  enum Stage { PyramidStage, DetectStage, DescribeStage, stageCount };
+
+  struct Frame {
+    /// Stacked pyramid. The first `height` rows take the input frame.
+    uint8_t (*img)[vstep];
+    /// Keypoints with y relative to the top of the stacked image, as
+    /// produced by OrbExtractor, and their descriptors.
+    std::vector<Keypoint> keypoints;
+    std::vector<uint32_t> descriptors;
+    /// Left for the caller, for example to hold a frame number.
+    uint64_t tag;
+
+   private:
+    friend class FramePipeline;
+    uint8_t (*out)[vstep];
+    std::chrono::steady_clock::time_point enqueued;
+  };
+
+  /// `depth` frames may be in flight at once, and at least one frame
+  /// per stage is needed to keep every stage busy. Keypoint and
+  /// descriptor storage is reserved for `maxPoints` points per frame.
+  ///
+  /// If `features` is positive, detection ends with selectLevels, so
+  /// that each frame keeps at most `features` of its best keypoints,
+  /// divided between the levels by area, and orbCompute never sees more.
+  /// With `distribute`, distributeLevels is used instead, which trades
+  /// some score for an even spread over each level.
+  ///
+  /// If `cellTarget` is positive, each level is detected with
+  /// fastDetectCells, its thresholds starting at `threshold` and adapted
+  /// by a FastThresholdGrid after every frame towards `cellTarget` points
+  /// per 32x32 cell.
+  FramePipeline(int width, int height, int depth = stageCount + 1,
+      int threshold = 20, int32_t harrisThreshold = 1 << 15,
+      int maxPoints = 4096, int features = 0, bool distribute = false,
+      int cellTarget = 0)
+      : width(width), height(height), threshold(threshold),
+        harrisThreshold(harrisThreshold), features(features),
+        distribute(distribute), frames(depth) {
+    rows = pyramidLevels(width, height, levels);
+    if (cellTarget > 0) {
+      for (const PyramidLevel &level : levels) {
+        grids.emplace_back(level.width, level.height, cellTarget, threshold);
+      }
+    }
+
+    // out must start zeroed for fastExtract, after which fastDetect only
+    // ever rewrites the same region.
+    storage.reset(new uint8_t[2 * (size_t)depth * rows * vstep]());
+    uint8_t (*buffer)[vstep] = (uint8_t (*)[vstep])storage.get();
+
+    for (int i = 0; i < stageCount + 2; i += 1) {
+      queues.emplace_back(new SpscQueue<Frame *>(depth));
+    }
+    for (int i = 0; i < depth; i += 1) {
+      Frame &frame = frames[i];
+      frame.img = &buffer[2*i*rows];
+      frame.out = &buffer[(2*i + 1)*rows];
+      frame.keypoints.reserve(maxPoints);
+      frame.descriptors.reserve(maxPoints * words);
+      frame.tag = 0;
+      freeQueue().push(&frame);
+    }
+    contexts[DetectStage] = OrbContext(vstep, 0, 0);
+    contexts[DescribeStage] = OrbContext(0, 0, maxPoints);
+
+    for (int i = 0; i < stageCount; i += 1) {
+      threads.emplace_back(&FramePipeline::work, this, Stage(i));
+    }
+  }
+
+  /// Stops the stages. Frames still in flight are discarded.
+  ~FramePipeline() {
+    stop = true;
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+  }
+
+  FramePipeline(const FramePipeline &) = delete;
+  FramePipeline &operator=(const FramePipeline &) = delete;
+
+  /// Rows of Frame::img, which is the height of the stacked pyramid.
+  int pyramidRows() const {
+    return rows;
+  }
+
+  const PyramidLevel *pyramid() const {
+    return levels;
+  }
+
+  /// Take an unused frame, or nullptr if every frame is in flight or
+  /// waiting to be released. A live source should drop the frame rather
+  /// than wait.
+  Frame *acquire() {
+    Frame *frame = nullptr;
+    freeQueue().pop(frame);
+    return frame;
+  }
+
+  /// Start processing a frame taken from acquire.
+  void submit(Frame *frame) {
+    enqueue(PyramidStage, frame, std::chrono::steady_clock::now());
+  }
+
+  /// Take the next processed frame, or nullptr if it is not ready.
+  /// Frames are returned in the order they were submitted.
+  Frame *tryReceive() {
+    Frame *frame = nullptr;
+    queues[stageCount]->pop(frame);
+    return frame;
+  }
+
+  /// Wait for the next processed frame. A frame must have been submitted
+  /// and not yet received.
+  Frame *receive() {
+    Frame *frame;
+    for (int idle = 0; !queues[stageCount]->pop(frame); ) {
+      backoff(idle);
+    }
+    return frame;
+  }
+
+  /// Return a received frame to the pipeline.
+  void release(Frame *frame) {
+    bool pushed = freeQueue().push(frame);
+    assert(pushed && "Frame released twice");
+    (void)pushed;
+  }
+
+  /// Counters of a stage since the pipeline was created. May be called
+  /// from any thread while frames are in flight.
+  PipelineStats stats(Stage stage) const {
+    const Counters &c = counters[stage];
+    PipelineStats s;
+    s.queueDepth = queues[stage]->size();
+    s.maxQueueDepth = c.maxDepth.load(std::memory_order_relaxed);
+    s.frames = c.frames.load(std::memory_order_relaxed);
+    uint64_t n = s.frames > 0 ? s.frames : 1;
+    s.meanWaitMs = c.waitNs.load(std::memory_order_relaxed) * 1e-6 / n;
+    s.meanRunMs = c.runNs.load(std::memory_order_relaxed) * 1e-6 / n;
+    s.maxRunMs = c.maxRunNs.load(std::memory_order_relaxed) * 1e-6;
+    return s;
+  }
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  /// Written only by the thread of the stage, except maxDepth, which is
+  /// written only by the producer of the stage's queue.
+  struct Counters {
+    std::atomic<size_t> maxDepth{0};
+    std::atomic<uint64_t> frames{0};
+    std::atomic<uint64_t> waitNs{0};
+    std::atomic<uint64_t> runNs{0};
+    std::atomic<uint64_t> maxRunNs{0};
+  };
+
+  static uint64_t nanoseconds(Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+
+  static void add(std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+        std::memory_order_relaxed);
+  }
+
+  static void backoff(int &idle) {
+    if (++idle < 64) {
+      std::this_thread::yield();
+    } else {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  SpscQueue<Frame *> &freeQueue() {
+    return *queues[stageCount + 1];
+  }
+
+  /// Hand a frame to `stage`, or to receive after the last stage.
+  void enqueue(int stage, Frame *frame, Clock::time_point now) {
+    frame->enqueued = now;
+    SpscQueue<Frame *> &queue = *queues[stage];
+
+    // Holds every frame, so can never be full.
+    bool pushed = queue.push(frame);
+    assert(pushed);
+    (void)pushed;
+
+    if (stage < stageCount) {
+      std::atomic<size_t> &maxDepth = counters[stage].maxDepth;
+      size_t depth = queue.size();
+      if (depth > maxDepth.load(std::memory_order_relaxed)) {
+        maxDepth.store(depth, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void work(Stage stage) {
+    Counters &c = counters[stage];
+    Frame *frame;
+    int idle = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      if (!queues[stage]->pop(frame)) {
+        backoff(idle);
+        continue;
+      }
+      idle = 0;
+
+      Clock::time_point start = Clock::now();
+      process(stage, *frame);
+      Clock::time_point end = Clock::now();
+
+      uint64_t run = nanoseconds(end - start);
+      add(c.waitNs, nanoseconds(start - frame->enqueued));
+      add(c.runNs, run);
+      if (run > c.maxRunNs.load(std::memory_order_relaxed)) {
+        c.maxRunNs.store(run, std::memory_order_relaxed);
+      }
+      add(c.frames, 1);
+
+      enqueue(stage + 1, frame, end);
+    }
+  }
+
+  void process(Stage stage, Frame &frame) {
+    switch (stage) {
+      case PyramidStage:
+        buildPyramid<vstep>(width, height, frame.img, frame.img,
+            contexts[stage]);
+        break;
+
+      case DetectStage:
+        frame.keypoints.clear();
+        for (int l = 0; l < pyramidLevelCount; l += 1) {
+          const PyramidLevel &level = levels[l];
+          uint8_t (*imgPtr)[vstep] = &frame.img[level.row];
+          uint8_t (*outPtr)[vstep] = &frame.out[level.row];
+
+          if (grids.empty()) {
+            fastDetect<vstep, border>(level.width, level.height,
+                imgPtr, outPtr, threshold);
+          } else {
+            fastDetectCells<vstep, border>(level.width, level.height,
+                imgPtr, outPtr, grids[l].thresholds());
+          }
+          fastScoreHarris<vstep, border>(level.width, level.height,
+              imgPtr, harrisThreshold, outPtr);
+
+          size_t oldSize = frame.keypoints.size();
+          fastExtract<vstep, border, logBucketSize, bucketLimit>(
+              level.width, level.height, outPtr, frame.keypoints,
+              contexts[stage]);
+
+          if (!grids.empty()) {
+            grids[l].update(frame.keypoints.data() + oldSize,
+                frame.keypoints.data() + frame.keypoints.size());
+          }
+
+          // Adjust y coordinate to match position in image pyramid.
+          for (auto p = frame.keypoints.begin() + oldSize;
+              p < frame.keypoints.end(); ++p) {
+            *p = rencodeFastLevel(*p, level.row, l);
+          }
+        }
+        if (features > 0 && distribute) {
+          distributeLevels(frame.keypoints, levels, pyramidLevelCount,
+              features, contexts[stage]);
+        } else if (features > 0) {
+          selectLevels(frame.keypoints, levels, pyramidLevelCount, features,
+              contexts[stage]);
+        }
+        break;
+
+      case DescribeStage:
+        frame.descriptors.clear();
+        orbCompute<vstep, words>(frame.img, frame.keypoints, frame.descriptors,
+            contexts[stage]);
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  const int width;
+  const int height;
+  const int threshold;
+  const int32_t harrisThreshold;
+  const int features;
+  const bool distribute;
+
+  PyramidLevel levels[pyramidLevelCount];
+  int rows;
+  /// Adaptive thresholds of each level, used only by the detect stage.
+  std::vector<FastThresholdGrid<>> grids;
+
+  std::unique_ptr<uint8_t[]> storage;
+  std::vector<Frame> frames;
+
+  /// Input queue of each stage, then the output queue and the free list.
+  std::vector<std::unique_ptr<SpscQueue<Frame *>>> queues;
+  Counters counters[stageCount];
+  OrbContext contexts[stageCount];
+
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+};
+#endif
+
+} /* namespace pislam */
+#endif /* PISLAM_FRAME_PIPELINE_H_ */
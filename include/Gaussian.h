@@ -22,16 +22,154 @@
 
 #include "arm_neon.h"
 
+#include <algorithm>
 #include <stdint.h>
 
+#include "OrbContext.h"
+
+namespace pislam {
+
+/// Number of rows blurred by each call to gaussian5x5Band.
+constexpr int gaussian5x5BandRows = 16;
+
+/// Size in bytes of the state buffer required by gaussian5x5Band.
+static inline int gaussian5x5BandBufferSize(const int width) {
+  return (gaussian5x5BandRows + 2) * (((width + 15) & ~15) + 32);
+}
+
+/// Convolve rows r to r+n of a single channel image with a 5x5 gaussian
+/// kernel, where n is at most gaussian5x5BandRows.
+///
+/// Bands must be computed in order starting at row 0. The last two input
+/// rows of each band are kept in `buffer`, which must be zero initialised
+/// and gaussian5x5BandBufferSize(width) bytes long, so img and out may be
+/// the same pointer. Rows r+n and r+n+1 of img are read but not written.
+///
+/// This is the hstore mechanism described in gaussian5x5 below, and
+/// allows later stages such as image pyramids to consume the blurred
+/// image while it is still in cache. See buildPyramid.
+///
+/// Output is identical to gaussian5x5.
+template <int vstep>
+void gaussian5x5Band(const int width, const int height, const int r,
+    const int n, uint8_t img[][vstep], uint8_t out[][vstep],
+    uint8_t *buffer) {
+  // The filter is decomposed into vrhadd operations exactly as described
+  // in the ARMv7 implementation of gaussian5x5.
+  //
+  // Unaligned loads are cheap, so instead of transposing 8x16 blocks and
+  // passing columns between them through hstore, the band is convolved
+  // vertically into a buffer small enough to stay in L1 (16 rows of 640
+  // pixels is 10kB), which is then convolved horizontally into `out`.
+  //
+  // Edges are reflected, i.e. row -1 is row 1 and row height is
+  // row height-2. The buffer has 16 bytes of padding either side of each
+  // row to hold the reflected columns.
+  const int stride = ((width + 15) & ~15) + 32;
+
+  // bandRows rows of vertical results followed by the last two input rows
+  // of the previous band, which may already be overwritten if in place.
+  uint8_t *saved = &buffer[gaussian5x5BandRows * stride];
+
+  const uint8_t *rows[gaussian5x5BandRows + 4];
+
+  for (int k = 0; k < n + 4; k += 1) {
+    int row = r + k - 2;
+    if (row < 0) {
+      row = -row;
+    } else if (row >= height) {
+      row = 2*(height - 1) - row;
+    }
+    rows[k] = row < r ? &saved[(row - r + 2) * stride] : &img[row][0];
+  }
+
+  // vertical pass
+  for (int x = 0; x < width; x += 16) {
+    uint8x16_t a = vld1q_u8(&rows[0][x]);
+    uint8x16_t b = vld1q_u8(&rows[1][x]);
+    uint8x16_t c = vld1q_u8(&rows[2][x]);
+    uint8x16_t d = vld1q_u8(&rows[3][x]);
+
+    for (int k = 0; k < n; k += 1) {
+      uint8x16_t e = vld1q_u8(&rows[k + 4][x]);
+
+      // short delta
+      uint8x16_t s = vrhaddq_u8(vrhaddq_u8(vrhaddq_u8(a, e), c), c);
+      // long delta
+      uint8x16_t l = vrhaddq_u8(b, d);
+
+      vst1q_u8(&buffer[k*stride + 16 + x], vrhaddq_u8(s, l));
+
+      a = b; b = c; c = d; d = e;
+    }
+  }
+
+  // keep the input rows the next band looks back on
+  if (r + n < height) {
+    std::copy(rows[n], rows[n] + stride - 32, &saved[0]);
+    std::copy(rows[n + 1], rows[n + 1] + stride - 32, &saved[stride]);
+  }
+
+  // horizontal pass
+  for (int k = 0; k < n; k += 1) {
+    uint8_t *t = &buffer[k*stride + 16];
+    t[-1] = t[1];
+    t[-2] = t[2];
+    t[width] = t[width - 2];
+    t[width + 1] = t[width - 3];
+
+    for (int x = 0; x < width; x += 16) {
+      uint8x16_t a = vld1q_u8(&t[x - 2]);
+      uint8x16_t b = vld1q_u8(&t[x - 1]);
+      uint8x16_t c = vld1q_u8(&t[x    ]);
+      uint8x16_t d = vld1q_u8(&t[x + 1]);
+      uint8x16_t e = vld1q_u8(&t[x + 2]);
+
+      uint8x16_t s = vrhaddq_u8(vrhaddq_u8(vrhaddq_u8(a, e), c), c);
+      uint8x16_t l = vrhaddq_u8(b, d);
+
+      vst1q_u8(&out[r + k][x], vrhaddq_u8(s, l));
+    }
+  }
+}
+
+#if defined(__aarch64__)
+
+/// Convolve a single channel image with a 5x5 gaussian kernel.
+///
+/// Image may be of any dimension greater than 16x16, but must be padded
+/// to a multiple of 16 columns and multiple of 8 rows.
+/// Destination image must be the same size as input.
+///
+/// img and out may be same pointer, in which case blur is done in place.
+///
+/// Output is identical to the ARMv7 implementation below.
+///
+/// Band state is kept in `context`.
+template <int vstep>
+void gaussian5x5(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], OrbContext &context) {
+  // AArch64 has neither the inline asm syntax nor the need for it.
+  // The image is processed in bands of 16 rows, which reads and writes
+  // the image only once.
+  const int size = gaussian5x5BandBufferSize(width);
+  uint8_t *buffer = OrbContext::ensure(context.blur, size);
+  std::fill(buffer, buffer + size, 0);
+
+  for (int r = 0; r < height; r += gaussian5x5BandRows) {
+    int n = std::min(gaussian5x5BandRows, height - r);
+    gaussian5x5Band<vstep>(width, height, r, n, img, out, buffer);
+  }
+}
+
+#else
+
 #define PISLAM_ALL_D_REGS \
    "d0",  "d1",  "d2",  "d3",  "d4",  "d5",  "d6",  "d7", \
    "d8",  "d9", "d10", "d11", "d12", "d13", "d14", "d15", \
   "d16", "d17", "d18", "d19", "d20", "d21", "d22", "d23", \
   "d24", "d25", "d26", "d27", "d28", "d29", "d30", "d31"
 
-namespace pislam {
-
 template <int vstep>
 void gaussian5x5_hstore(const int width, const int height,
     const uint8_t img[][vstep], uint8_t *hstore);
@@ -45,9 +183,11 @@ void gaussian5x5_hstore(const int width, const int height,
 /// img and out may be same pointer, in which case blur is done in place.
 /// 
 /// Running time for a 640x480 image is 0.7ms on raspberry pi.
+///
+/// hstore is kept in `context`.
 template <int vstep>
 void gaussian5x5(const int width, const int height,
-    uint8_t img[][vstep], uint8_t out[][vstep]) {
+    uint8_t img[][vstep], uint8_t out[][vstep], OrbContext &context) {
   // The below applies the seperable gaussian filter
   // 1/16 * 1/16 * [1 4 6 4 1] * [1 4 6 4 1].T
   //
@@ -119,7 +259,8 @@ void gaussian5x5(const int width, const int height,
   int vblocks = (height + 7) / 8;
   int hblocks = (width + 14) / 16;
 
-  uint8_t *hstore = new uint8_t[vblocks * 64]();
+  uint8_t *hstore = OrbContext::ensure(context.blur, vblocks * 64);
+  std::fill(hstore, hstore + vblocks * 64, 0);
   gaussian5x5_hstore<vstep>(width, height, img, hstore);
 
   int step = 2*vstep;
@@ -677,8 +818,6 @@ hblock_fix:
     }
   }
 
-  delete[] hstore;
-
   return;
 }
 
@@ -961,6 +1100,16 @@ vlast:
   return;
 }
 
+#endif
+
+/// As above, with state allocated for this call.
+template <int vstep>
+void gaussian5x5(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep]) {
+  OrbContext context;
+  gaussian5x5<vstep>(width, height, img, out, context);
+}
+
 } /* namespace */
 
 #endif /* PISLAM_GAUSSIAN_BLUR_H__ */
@@ -0,0 +1,331 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_MATCH_H_
+#define PISLAM_MATCH_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Platform.h"
+
+namespace pislam {
+
+/// 32 bit words per descriptor accepted by the matcher, as produced by
+/// orbCompute<vstep, 8>.
+constexpr int matchWords = 8;
+
+/// Distance reported when there is no nearest or second nearest
+/// descriptor. Greater than any Hamming distance.
+constexpr int matchNoDistance = 32 * matchWords + 1;
+
+/// Nearest and second nearest train descriptors of a query descriptor.
+/// On equal distances the lower train index is nearest.
+struct NearestMatch {
+  /// Index of the nearest train descriptor, or -1 if there is none.
+  int train;
+  int distance;
+  int second;
+};
+
+/// A query descriptor accepted as matching a train descriptor.
+struct Match {
+  int query;
+  int train;
+  int distance;
+};
+
+/// Hamming distance between two descriptors.
+static inline int hammingDistance(const uint32_t *a, const uint32_t *b) {
+#if defined(PISLAM_NEON)
+  uint8x16_t c = vaddq_u8(
+      vcntq_u8(veorq_u8(vld1q_u8((const uint8_t *)a),
+          vld1q_u8((const uint8_t *)b))),
+      vcntq_u8(veorq_u8(vld1q_u8((const uint8_t *)a + 16),
+          vld1q_u8((const uint8_t *)b + 16))));
+  uint64x2_t s = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(c)));
+  return vgetq_lane_u64(s, 0) + vgetq_lane_u64(s, 1);
+#else
+  // Bit sliced count, so no popcnt instruction is required.
+  int distance = 0;
+  for (int w = 0; w < matchWords; w += 2) {
+    uint64_t x, y;
+    memcpy(&x, &a[w], sizeof(x));
+    memcpy(&y, &b[w], sizeof(y));
+    x ^= y;
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    distance += (x * 0x0101010101010101ull) >> 56;
+  }
+  return distance;
+#endif
+}
+
+static inline void matchUpdate(int distance, int index, NearestMatch &m) {
+  if (distance < m.distance) {
+    m.second = m.distance;
+    m.distance = distance;
+    m.train = index;
+  } else if (distance < m.second) {
+    m.second = distance;
+  }
+}
+
+/// Portable matchNearest, one query at a time.
+static inline void matchNearestScalar(const uint32_t *query, int queryCount,
+    const uint32_t *train, int trainCount, NearestMatch *out) {
+  for (int i = 0; i < queryCount; i += 1) {
+    const uint32_t *q = &query[i * matchWords];
+    NearestMatch m = {-1, matchNoDistance, matchNoDistance};
+    for (int j = 0; j < trainCount; j += 1) {
+      const uint32_t *t = &train[j * matchWords];
+      int distance = 0;
+      for (int w = 0; w < matchWords; w += 1) {
+        distance += __builtin_popcount(q[w] ^ t[w]);
+      }
+      matchUpdate(distance, j, m);
+    }
+    out[i] = m;
+  }
+}
+
+#if defined(PISLAM_NEON)
+/// NEON matchNearest.
+///
+/// Four query descriptors are held in eight q registers while the train
+/// descriptors stream past. Each xor is counted with vcnt, and the four
+/// distances are reduced with pairwise adds into the lanes of one
+/// uint16x4, so nearest and second nearest are also tracked four at a
+/// time without leaving the NEON unit.
+static inline void matchNearestNeon(const uint32_t *query, int queryCount,
+    const uint32_t *train, int trainCount, NearestMatch *out) {
+  for (int i = 0; i < queryCount; i += 4) {
+    // A partial tile repeats the last query.
+    uint8x16_t q[4][2];
+    for (int k = 0; k < 4; k += 1) {
+      const uint8_t *p = (const uint8_t *)
+        &query[std::min(i + k, queryCount - 1) * matchWords];
+      q[k][0] = vld1q_u8(p);
+      q[k][1] = vld1q_u8(p + 16);
+    }
+
+    uint16x4_t best = vdup_n_u16(matchNoDistance);
+    uint16x4_t second = vdup_n_u16(matchNoDistance);
+    uint32x4_t index = vdupq_n_u32(0xffffffff);
+
+    for (int j = 0; j < trainCount; j += 1) {
+      const uint8_t *p = (const uint8_t *)&train[j * matchWords];
+      uint8x16_t t0 = vld1q_u8(p);
+      uint8x16_t t1 = vld1q_u8(p + 16);
+
+      // at most 16 per byte, then at most 32 per u16 lane
+      uint16x4_t d[4];
+      for (int k = 0; k < 4; k += 1) {
+        uint8x16_t c = vaddq_u8(vcntq_u8(veorq_u8(q[k][0], t0)),
+            vcntq_u8(veorq_u8(q[k][1], t1)));
+        uint16x8_t s = vpaddlq_u8(c);
+        d[k] = vadd_u16(vget_low_u16(s), vget_high_u16(s));
+      }
+      uint16x4_t distance = vpadd_u16(vpadd_u16(d[0], d[1]),
+          vpadd_u16(d[2], d[3]));
+
+      uint16x4_t nearer = vclt_u16(distance, best);
+      second = vmin_u16(second, vmax_u16(best, distance));
+      best = vmin_u16(best, distance);
+      uint32x4_t nearer32 = vreinterpretq_u32_s32(
+          vmovl_s16(vreinterpret_s16_u16(nearer)));
+      index = vbslq_u32(nearer32, vdupq_n_u32(j), index);
+    }
+
+    uint16_t b[4], s[4];
+    uint32_t t[4];
+    vst1_u16(b, best);
+    vst1_u16(s, second);
+    vst1q_u32(t, index);
+    for (int k = 0; k < 4 && i + k < queryCount; k += 1) {
+      out[i + k] = {(int)(int32_t)t[k], b[k], s[k]};
+    }
+  }
+}
+#endif
+
+#if defined(PISLAM_X86)
+/// matchNearest using the popcnt instruction, one query at a time. The
+/// query is held in four 64 bit registers.
+PISLAM_TARGET_POPCNT
+static inline void matchNearestPopcnt(const uint32_t *query, int queryCount,
+    const uint32_t *train, int trainCount, NearestMatch *out) {
+  for (int i = 0; i < queryCount; i += 1) {
+    uint64_t q[4];
+    memcpy(q, &query[i * matchWords], sizeof(q));
+
+    NearestMatch m = {-1, matchNoDistance, matchNoDistance};
+    for (int j = 0; j < trainCount; j += 1) {
+      uint64_t t[4];
+      memcpy(t, &train[j * matchWords], sizeof(t));
+      int distance = __builtin_popcountll(q[0] ^ t[0]) +
+        __builtin_popcountll(q[1] ^ t[1]) +
+        __builtin_popcountll(q[2] ^ t[2]) +
+        __builtin_popcountll(q[3] ^ t[3]);
+      matchUpdate(distance, j, m);
+    }
+    out[i] = m;
+  }
+}
+
+/// Count the bits of each byte with two 4 bit table lookups.
+PISLAM_TARGET_AVX2
+static inline __m256i matchPopcountAvx2(__m256i x) {
+  const __m256i table = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_and_si256(x, nibble);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble);
+  return _mm256_add_epi8(_mm256_shuffle_epi8(table, lo),
+      _mm256_shuffle_epi8(table, hi));
+}
+
+/// AVX2 matchNearest, with the same four query tile as the NEON version.
+/// Byte counts are summed with vpsadbw, and the four distances are packed
+/// into the 16 bit lanes of one register.
+PISLAM_TARGET_AVX2
+static inline void matchNearestAvx2(const uint32_t *query, int queryCount,
+    const uint32_t *train, int trainCount, NearestMatch *out) {
+  const __m256i zero = _mm256_setzero_si256();
+
+  for (int i = 0; i < queryCount; i += 4) {
+    // A partial tile repeats the last query.
+    __m256i q[4];
+    for (int k = 0; k < 4; k += 1) {
+      q[k] = _mm256_loadu_si256((const __m256i *)
+          &query[std::min(i + k, queryCount - 1) * matchWords]);
+    }
+
+    __m128i best = _mm_set1_epi16(matchNoDistance);
+    __m128i second = _mm_set1_epi16(matchNoDistance);
+    __m128i index = _mm_set1_epi32(-1);
+
+    for (int j = 0; j < trainCount; j += 1) {
+      __m256i t = _mm256_loadu_si256((const __m256i *)&train[j * matchWords]);
+
+      // four 64 bit partial sums per query, each at most 64
+      __m256i s0 = _mm256_sad_epu8(matchPopcountAvx2(_mm256_xor_si256(q[0], t)), zero);
+      __m256i s1 = _mm256_sad_epu8(matchPopcountAvx2(_mm256_xor_si256(q[1], t)), zero);
+      __m256i s2 = _mm256_sad_epu8(matchPopcountAvx2(_mm256_xor_si256(q[2], t)), zero);
+      __m256i s3 = _mm256_sad_epu8(matchPopcountAvx2(_mm256_xor_si256(q[3], t)), zero);
+      __m256i s = _mm256_or_si256(
+          _mm256_or_si256(s0, _mm256_slli_epi64(s1, 16)),
+          _mm256_or_si256(_mm256_slli_epi64(s2, 32), _mm256_slli_epi64(s3, 48)));
+      __m128i h = _mm_add_epi16(_mm256_castsi256_si128(s),
+          _mm256_extracti128_si256(s, 1));
+      __m128i distance = _mm_add_epi16(h, _mm_unpackhi_epi64(h, h));
+
+      // distances are small enough for signed comparisons
+      __m128i nearer = _mm_cmplt_epi16(distance, best);
+      second = _mm_min_epi16(second, _mm_max_epi16(best, distance));
+      best = _mm_min_epi16(best, distance);
+      index = _mm_blendv_epi8(index, _mm_set1_epi32(j),
+          _mm_unpacklo_epi16(nearer, nearer));
+    }
+
+    uint16_t b[8], s[8];
+    int32_t t[4];
+    _mm_storeu_si128((__m128i *)b, best);
+    _mm_storeu_si128((__m128i *)s, second);
+    _mm_storeu_si128((__m128i *)t, index);
+    for (int k = 0; k < 4 && i + k < queryCount; k += 1) {
+      out[i + k] = {t[k], b[k], s[k]};
+    }
+  }
+}
+#endif
+
+/// Find the nearest and second nearest train descriptor of every query
+/// descriptor by exhaustive search. Descriptors are matchWords words
+/// each, stored contiguously as by orbCompute.
+///
+/// On x86 the AVX2 or popcnt kernel is selected at runtime. All kernels
+/// produce identical output.
+///
+/// Running time is about queryCount * trainCount / 16 cycles with NEON.
+static inline void matchNearest(const uint32_t *query, int queryCount,
+    const uint32_t *train, int trainCount, NearestMatch *out) {
+#if defined(PISLAM_NEON)
+  matchNearestNeon(query, queryCount, train, trainCount, out);
+#elif defined(PISLAM_X86)
+  if (cpuSupportsAvx2()) {
+    matchNearestAvx2(query, queryCount, train, trainCount, out);
+  } else if (cpuSupportsPopcnt()) {
+    matchNearestPopcnt(query, queryCount, train, trainCount, out);
+  } else {
+    matchNearestScalar(query, queryCount, train, trainCount, out);
+  }
+#else
+  matchNearestScalar(query, queryCount, train, trainCount, out);
+#endif
+}
+
+/// Match two sets of descriptors, as produced by orbCompute<vstep, 8>,
+/// and append the accepted matches to `matches` in query order.
+///
+/// A query is matched to its nearest train descriptor if
+///  - the distance is at most `maxDistance`,
+///  - the distance is less than `ratio` times the second nearest
+///    distance (Lowe's ratio test), unless ratio is 1 or more, and
+///  - with `crossCheck`, the query is also the nearest query
+///    descriptor of the train descriptor.
+static inline void match(const std::vector<uint32_t> &query,
+    const std::vector<uint32_t> &train, std::vector<Match> &matches,
+    float ratio = 0.8f, bool crossCheck = true,
+    int maxDistance = 32 * matchWords) {
+  const int queryCount = query.size() / matchWords;
+  const int trainCount = train.size() / matchWords;
+
+  std::vector<NearestMatch> nearest(queryCount);
+  matchNearest(query.data(), queryCount, train.data(), trainCount,
+      nearest.data());
+
+  std::vector<NearestMatch> reverse;
+  if (crossCheck) {
+    reverse.resize(trainCount);
+    matchNearest(train.data(), trainCount, query.data(), queryCount,
+        reverse.data());
+  }
+
+  for (int i = 0; i < queryCount; i += 1) {
+    const NearestMatch &m = nearest[i];
+    if (m.train < 0 || m.distance > maxDistance) {
+      continue;
+    }
+    if (ratio < 1 && !(m.distance < ratio * m.second)) {
+      continue;
+    }
+    if (crossCheck && reverse[m.train].train != i) {
+      continue;
+    }
+    matches.push_back({i, m.train, m.distance});
+  }
+}
+
+} /* namespace pislam */
+#endif /* PISLAM_MATCH_H_ */
@@ -0,0 +1,214 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_MATCH_GRID_H_
+#define PISLAM_MATCH_GRID_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "Match.h"
+#include "Pyramid.h"
+#include "Util.h"
+
+namespace pislam {
+
+/// A uniform grid over the keypoints of a stacked pyramid, for matching
+/// only against descriptors near a given position.
+///
+/// Every level has its own cells, so a search never crosses into a
+/// neighbouring level. Cells are numbered row by row within a level, and
+/// levels follow each other, so the cells of one row of a search window
+/// are contiguous. Keypoints and their descriptors are copied into cell
+/// order with a counting sort, which is O(n), and a search streams
+/// through a few short runs of memory.
+///
+/// All storage is kept between calls to build, so rebuilding the grid
+/// every frame does not allocate once it has held the largest frame.
+class MatchGrid {
+ public:
+  /// `cellSize` is in pixels of each level. A cell of about the search
+  /// radius keeps windows to 3x3 cells.
+  MatchGrid(const PyramidLevel *levels, int numLevels, int cellSize = 16)
+      : levels(levels, levels + numLevels), cellSize(cellSize) {
+    int cells = 0;
+    for (const PyramidLevel &level : this->levels) {
+      firstCell.push_back(cells);
+      columns.push_back((level.width + cellSize - 1) / cellSize);
+      cells += columns.back() * ((level.height + cellSize - 1) / cellSize);
+    }
+    cellStart.resize(cells + 1);
+  }
+
+  /// Index the keypoints, encoded by encodeFast with y relative to the
+  /// top of the stacked pyramid, and their matchWords word descriptors.
+  void build(const std::vector<Keypoint> &keypoints,
+      const std::vector<uint32_t> &descriptors) {
+    const int n = keypoints.size();
+    cellOf.resize(n);
+    order.resize(n);
+    sortedKeypoints.resize(n);
+    sortedDescriptors.resize((size_t)n * matchWords);
+
+    // counting sort by cell
+    std::fill(cellStart.begin(), cellStart.end(), 0);
+    for (int i = 0; i < n; i += 1) {
+      cellOf[i] = cell(keypoints[i]);
+      cellStart[cellOf[i] + 1] += 1;
+    }
+    for (size_t c = 1; c < cellStart.size(); c += 1) {
+      cellStart[c] += cellStart[c - 1];
+    }
+    // Placing a point advances the start of its cell, which leaves
+    // cellStart[c] at the end of cell c ...
+    for (int i = 0; i < n; i += 1) {
+      int k = cellStart[cellOf[i]]++;
+      order[k] = i;
+      sortedKeypoints[k] = keypoints[i];
+      std::copy(&descriptors[(size_t)i * matchWords],
+          &descriptors[(size_t)(i + 1) * matchWords],
+          &sortedDescriptors[(size_t)k * matchWords]);
+    }
+    // ... so shifting by one cell restores the start of each cell.
+    for (size_t c = cellStart.size() - 1; c > 0; c -= 1) {
+      cellStart[c] = cellStart[c - 1];
+    }
+    cellStart[0] = 0;
+  }
+
+  /// Level containing row y of the stacked pyramid, or -1.
+  int level(int y) const {
+    for (size_t l = 0; l < levels.size(); l += 1) {
+      if (levels[l].row <= y && y < levels[l].row + levels[l].height) {
+        return l;
+      }
+    }
+    return -1;
+  }
+
+  /// Find the nearest and second nearest descriptors among the keypoints
+  /// within `radius` pixels of `position` along both axes, on the level
+  /// containing `position`. The window is square, as in ORB-SLAM.
+  /// Returned train indices refer to the keypoints given to build, and
+  /// equal distances resolve to the lower index, as by matchNearest.
+  NearestMatch nearest(const uint32_t *descriptor, Keypoint position,
+      int radius) const {
+    NearestMatch m = {-1, matchNoDistance, matchNoDistance};
+
+    const int x = decodeFastX(position);
+    const int y = decodeFastY(position);
+    const int l = level(y);
+    if (l < 0) {
+      return m;
+    }
+    const PyramidLevel &lev = levels[l];
+    const int ly = y - lev.row;
+
+    const int cx0 = std::max(x - radius, 0) / cellSize;
+    const int cx1 = std::min(x + radius, lev.width - 1) / cellSize;
+    const int cy0 = std::max(ly - radius, 0) / cellSize;
+    const int cy1 = std::min(ly + radius, lev.height - 1) / cellSize;
+    if (cx0 > cx1) {
+      return m;
+    }
+
+    for (int cy = cy0; cy <= cy1; cy += 1) {
+      const int row = firstCell[l] + cy * columns[l];
+      const int begin = cellStart[row + cx0];
+      const int end = cellStart[row + cx1 + 1];
+
+      for (int k = begin; k < end; k += 1) {
+        Keypoint p = sortedKeypoints[k];
+        if (std::abs((int)decodeFastX(p) - x) > radius ||
+            std::abs((int)decodeFastY(p) - y) > radius) {
+          continue;
+        }
+        int distance = hammingDistance(descriptor,
+            &sortedDescriptors[(size_t)k * matchWords]);
+        int index = order[k];
+        if (distance < m.distance ||
+            (distance == m.distance && index < m.train)) {
+          m.second = m.distance;
+          m.distance = distance;
+          m.train = index;
+        } else if (distance < m.second) {
+          m.second = distance;
+        }
+      }
+    }
+    return m;
+  }
+
+ private:
+  int cell(Keypoint keypoint) const {
+    const int x = decodeFastX(keypoint);
+    const int y = decodeFastY(keypoint);
+    const int l = std::max(level(y), 0);
+    const int ly = std::min(std::max(y - levels[l].row, 0),
+        levels[l].height - 1);
+    return firstCell[l] + (ly / cellSize) * columns[l] +
+      std::min(x / cellSize, columns[l] - 1);
+  }
+
+  std::vector<PyramidLevel> levels;
+  int cellSize;
+  std::vector<int> firstCell;
+  std::vector<int> columns;
+
+  /// Index of the first sorted keypoint of each cell, plus one past the
+  /// end.
+  std::vector<int> cellStart;
+  std::vector<int> cellOf;
+  /// Original index of each sorted keypoint.
+  std::vector<int> order;
+  std::vector<Keypoint> sortedKeypoints;
+  std::vector<uint32_t> sortedDescriptors;
+};
+
+/// Guided matching. Each query keypoint is matched against the train
+/// keypoints in `grid` within `radius` pixels of its own position, or of
+/// `predicted[i]` if given, for example after applying a motion model.
+/// Matches are accepted as by pislam::match, without the cross-check,
+/// and appended in query order.
+///
+/// Running time is proportional to the number of queries times the
+/// number of train keypoints per window, rather than the product of the
+/// two set sizes.
+static inline void matchRadius(const std::vector<Keypoint> &queryKeypoints,
+    const std::vector<uint32_t> &queryDescriptors, const MatchGrid &grid,
+    int radius, std::vector<Match> &matches, float ratio = 0.8f,
+    int maxDistance = 32 * matchWords, const Keypoint *predicted = nullptr) {
+  for (size_t i = 0; i < queryKeypoints.size(); i += 1) {
+    Keypoint position = predicted ? predicted[i] : queryKeypoints[i];
+    NearestMatch m = grid.nearest(&queryDescriptors[i * matchWords],
+        position, radius);
+    if (m.train < 0 || m.distance > maxDistance) {
+      continue;
+    }
+    if (ratio < 1 && !(m.distance < ratio * m.second)) {
+      continue;
+    }
+    matches.push_back({(int)i, m.train, m.distance});
+  }
+}
+
+} /* namespace pislam */
+#endif /* PISLAM_MATCH_GRID_H_ */
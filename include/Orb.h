@@ -20,6 +20,7 @@
 #ifndef PISLAM_ORB_H_
 #define PISLAM_ORB_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdlib>
 #include <cstdio>
@@ -27,10 +28,13 @@
 #include <iostream>
 #include <vector>
 #include <cassert>
+#include <type_traits>
 
 #include "arm_neon.h"
 
 #include "Brief.h"
+#include "BriefTable.h"
+#include "OrbContext.h"
 #include "Util.h"
 
 namespace pislam {
@@ -77,9 +81,31 @@ namespace pislam {
     yy -= 1; \
     PISLAM_CENTROID_SUM_ROW_USING_MASK(n, dx, weights);
 
+/// Number of moments written by orbCentroids for `count` points. Points
+/// are stored in groups of four, as four x moments then four y moments.
+static inline size_t orbCentroidsSize(size_t count) {
+  return (2*count + 7) & ~(size_t)0x7;
+}
+
+template<int vstep>
+void orbCentroids(uint8_t img[][vstep], const std::vector<Keypoint> &points,
+    int32_t *centroids);
+
+/// Compute the intensity centroid moments of each point, as used to find
+/// its orientation.
 template<int vstep>
 std::vector<int32_t> orbCentroids(uint8_t img[][vstep],
-    const std::vector<uint32_t> &points) {
+    const std::vector<Keypoint> &points) {
+  std::vector<int32_t> centroids(orbCentroidsSize(points.size()));
+  orbCentroids<vstep>(img, points, centroids.data());
+  return centroids;
+}
+
+/// As above, writing orbCentroidsSize(points.size()) moments to
+/// `centroids`.
+template<int vstep>
+void orbCentroids(uint8_t img[][vstep], const std::vector<Keypoint> &points,
+    int32_t *centroids) {
 
   // Circle looks like this, reflected about y = 0
   //
@@ -109,9 +135,12 @@ std::vector<int32_t> orbCentroids(uint8_t img[][vstep],
   // Incidentally read bytes are masked out. In the case of one extra
   // rightmost byte, setlane is used.
   //
-  // round up to nearest 8
-  std::vector<int32_t> centroids;
-  centroids.resize((2*points.size() + 7) & (~0x7));
+  // The unused moments of a partial last group are zeroed so that atan2
+  // sees the same input every time.
+  if (points.size() % 4 != 0) {
+    int32_t *last = &centroids[orbCentroidsSize(points.size()) - 8];
+    std::fill(last, last + 8, 0);
+  }
 
   // the trick is to create masks which are valid at row x by comparing
   // to the row number.
@@ -140,7 +169,7 @@ std::vector<int32_t> orbCentroids(uint8_t img[][vstep],
   int32_t xmomenti, ymomenti;
 
   int out = 0;
-  for (uint32_t point : points) {
+  for (Keypoint point : points) {
     int x = decodeFastX(point);
     int y = decodeFastY(point);
 
@@ -303,15 +332,14 @@ std::vector<int32_t> orbCentroids(uint8_t img[][vstep],
       out += 4;
     }
   }
-  centroids.resize((centroids.size() + 7) & ~(0x7));
-  return centroids;
 }
 
-std::vector<uint8_t> atan2(const std::vector<int32_t> &xys) {
+/// Convert `size` centroid moments, as produced by orbCentroids, into
+/// one angle in [0, 30) per point, writing size/2 angles.
+inline void atan2(const int32_t *xys, size_t size, uint8_t *angles) {
   // returning angles as uint8_t instead of uint32_t saved
   // 0.2 ms / frame with 1229 points.
-  std::vector<uint8_t> angles;
-  for (auto it = xys.begin(); it < xys.end(); it += 8) {
+  for (const int32_t *it = xys; it < xys + size; it += 8) {
     int32x4_t xmoment32 = vld1q_s32(&it[0]);
     int32x4_t ymoment32 = vld1q_s32(&it[4]);
 
@@ -379,50 +407,36 @@ std::vector<uint8_t> atan2(const std::vector<int32_t> &xys) {
         // guard against possible NaN nonsense
         angle = 0;
       }
-      angles.push_back(angle);
+      *angles++ = angle;
     }
   }
+}
 
+inline std::vector<uint8_t> atan2(const std::vector<int32_t> &xys) {
+  std::vector<uint8_t> angles(xys.size() / 2);
+  atan2(xys.data(), xys.size(), angles.data());
   return angles;
 }
 
-/// Compute ORB descriptions from keypoints. Set words to the number
-/// of 32bit words the brief description should output, up to
-/// 8 for a 256 bit descriptor. Descriptors are appended to the back of
-/// `descriptors`.
-///
-/// Running time is 250 features / ms / GHz
-///
+/// Describe the points of each angle bin of orbCompute with the
+/// unrolled briefDescribeRot of that rotation.
 template <int vstep, int words>
-void orbCompute(uint8_t img[][vstep], const std::vector<uint32_t> &points,
-    std::vector<uint32_t> &descriptors) {
-
-  std::vector<int32_t> centroids = orbCentroids<vstep>(img, points);
-  std::vector<uint8_t> angles = atan2(centroids);
-
+void orbDescribeBins(uint8_t img[][vstep], const std::vector<Keypoint> &points,
+    const uint32_t *order, const size_t binStart[31], uint32_t *out,
+    std::false_type) {
   // The briefDescribe function is 1026 instructions long = 4104 bytes.
   // Unfortunately we get killed on cache performance, and it's actually
-  // faster to iterate over the points 30 times calling only the
-  // brief descriptor for a particular orientation. This also beats
-  // sorting first.
-  //
-  // Experimentally it was found that reducing iterations by evaluating
-  // pairs reduced execution time by .5 ms for 1000 features.
-  // 3s, and 4s each slightly decreased execution time, but pairs were
-  // chosen since the speed up is probably not worth the cache loss.
+  // faster to describe every point of one orientation with its own
+  // briefDescribeRot before moving on to the next.
 #define PISLAM_ORB_COMPUTE_DESCRIBE(rot) \
-  for (size_t i = 0; i < points.size(); i += 1) { \
-    if (rot*2 <= angles[i] && angles[i] < (rot + 1)*2) { \
-      uint32_t point = points[i]; \
-      int x = decodeFastX(point); \
-      int y = decodeFastY(point); \
-      briefDescribe<vstep, words>(img, x, y, angles[i], &out[i*words]); \
-    } \
+  for (size_t k = binStart[rot]; k < binStart[rot + 1]; k += 1) { \
+    size_t i = order[k]; \
+    Keypoint point = points[i]; \
+    int x = decodeFastX(point); \
+    int y = decodeFastY(point); \
+    briefDescribeRot<vstep, rot, words>(img, x, y, &out[i*words]); \
   }
 
-  descriptors.resize(descriptors.size() + points.size()*words);
-  auto out = descriptors.end() - (points.size()*words);
-
   PISLAM_ORB_COMPUTE_DESCRIBE(0);
   PISLAM_ORB_COMPUTE_DESCRIBE(1);
   PISLAM_ORB_COMPUTE_DESCRIBE(2);
@@ -438,6 +452,98 @@ void orbCompute(uint8_t img[][vstep], const std::vector<uint32_t> &points,
   PISLAM_ORB_COMPUTE_DESCRIBE(12);
   PISLAM_ORB_COMPUTE_DESCRIBE(13);
   PISLAM_ORB_COMPUTE_DESCRIBE(14);
+  PISLAM_ORB_COMPUTE_DESCRIBE(15);
+  PISLAM_ORB_COMPUTE_DESCRIBE(16);
+  PISLAM_ORB_COMPUTE_DESCRIBE(17);
+  PISLAM_ORB_COMPUTE_DESCRIBE(18);
+  PISLAM_ORB_COMPUTE_DESCRIBE(19);
+  PISLAM_ORB_COMPUTE_DESCRIBE(20);
+  PISLAM_ORB_COMPUTE_DESCRIBE(21);
+  PISLAM_ORB_COMPUTE_DESCRIBE(22);
+  PISLAM_ORB_COMPUTE_DESCRIBE(23);
+  PISLAM_ORB_COMPUTE_DESCRIBE(24);
+  PISLAM_ORB_COMPUTE_DESCRIBE(25);
+  PISLAM_ORB_COMPUTE_DESCRIBE(26);
+  PISLAM_ORB_COMPUTE_DESCRIBE(27);
+  PISLAM_ORB_COMPUTE_DESCRIBE(28);
+  PISLAM_ORB_COMPUTE_DESCRIBE(29);
+}
+
+/// Describe the points of each angle bin of orbCompute with
+/// briefDescribeTable, using the pattern of that rotation.
+template <int vstep, int words>
+void orbDescribeBins(uint8_t img[][vstep], const std::vector<Keypoint> &points,
+    const uint32_t *order, const size_t binStart[31], uint32_t *out,
+    std::true_type) {
+  const BriefTable<vstep> &table = BriefTable<vstep>::get();
+  for (int rot = 0; rot < 30; rot += 1) {
+    for (size_t k = binStart[rot]; k < binStart[rot + 1]; k += 1) {
+      size_t i = order[k];
+      int x = decodeFastX(points[i]);
+      int y = decodeFastY(points[i]);
+      briefDescribeTable<vstep, words>(img, x, y, table.offsets[rot],
+          &out[i*words]);
+    }
+  }
+}
+
+/// Compute ORB descriptions from keypoints. Set words to the number
+/// of 32bit words the brief description should output, up to
+/// 8 for a 256 bit descriptor. Descriptors are appended to the back of
+/// `descriptors`.
+///
+/// Running time is 250 features / ms / GHz
+///
+/// Scratch buffers are taken from `context`, so no memory is allocated
+/// once `descriptors` has enough capacity.
+///
+/// With `tableBrief` set, descriptors are computed by briefDescribeTable
+/// rather than the unrolled rotations of briefDescribeRot. Output is
+/// identical; which is faster depends on the instruction cache.
+///
+template <int vstep, int words, bool tableBrief = false>
+void orbCompute(uint8_t img[][vstep], const std::vector<Keypoint> &points,
+    std::vector<uint32_t> &descriptors, OrbContext &context) {
+
+  const size_t size = orbCentroidsSize(points.size());
+  int32_t *centroids = OrbContext::ensure(context.centroids, size);
+  uint8_t *angles = OrbContext::ensure(context.angles, size / 2);
+
+  orbCentroids<vstep>(img, points, centroids);
+  atan2(centroids, size, angles);
+
+  // Point indices are bucketed by angle with a counting sort, so each
+  // orientation visits only its own points rather than testing every
+  // angle on every pass. The sort is stable, so points extracted in row
+  // order are described in row order within each bucket.
+  uint32_t *order = OrbContext::ensure(context.order, points.size());
+  size_t binStart[31] = {0};
+  size_t binNext[30];
+
+  for (size_t i = 0; i < points.size(); i += 1) {
+    binStart[angles[i] + 1] += 1;
+  }
+  for (int b = 0; b < 30; b += 1) {
+    binStart[b + 1] += binStart[b];
+    binNext[b] = binStart[b];
+  }
+  for (size_t i = 0; i < points.size(); i += 1) {
+    order[binNext[angles[i]]++] = i;
+  }
+
+  descriptors.resize(descriptors.size() + points.size()*words);
+  uint32_t *out = descriptors.data() + descriptors.size() - points.size()*words;
+
+  orbDescribeBins<vstep, words>(img, points, order, binStart, out,
+      std::integral_constant<bool, tableBrief>());
+}
+
+/// As above, with scratch buffers allocated for this call.
+template <int vstep, int words, bool tableBrief = false>
+void orbCompute(uint8_t img[][vstep], const std::vector<Keypoint> &points,
+    std::vector<uint32_t> &descriptors) {
+  OrbContext context;
+  orbCompute<vstep, words, tableBrief>(img, points, descriptors, context);
 }
 } /* namespace pislam */
 
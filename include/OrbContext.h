@@ -0,0 +1,112 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_ORB_CONTEXT_H_
+#define PISLAM_ORB_CONTEXT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Util.h"
+
+namespace pislam {
+
+/// Scratch memory shared by the extraction stages, so that a frame can
+/// be processed without touching the allocator.
+///
+/// Pass the same context to gaussian5x5, buildPyramid, fastExtract,
+/// selectLevels, distributeLevels and orbCompute on every frame. A
+/// buffer only grows when a call needs more than it holds, so once the
+/// first frame of the largest size has been processed, later frames
+/// perform no allocation. Sizing the context in the constructor moves
+/// even that allocation out of the frame loop.
+///
+/// Output vectors remain owned by the caller. They are only appended
+/// to, so clearing and reusing them also avoids allocation.
+///
+/// A context must not be used by two threads at once.
+class OrbContext {
+ public:
+  OrbContext() {}
+
+  /// Reserve score and bit planes of `rows` rows of `vstep` pixels,
+  /// usually the stacked pyramid, orbCompute buffers for `maxPoints`
+  /// keypoints, and fastExtract buckets for a bucketLimit of up to 8.
+  OrbContext(int vstep, int rows, int maxPoints) {
+    scores.resize((size_t)vstep * rows);
+    bits.resize((size_t)(vstep + 63) / 64 * rows);
+    ensure(centroids, 2 * (size_t)maxPoints + 8);
+    ensure(angles, (size_t)maxPoints + 4);
+    ensure(order, (size_t)maxPoints);
+    ensure(buckets, (size_t)vstep * 4);
+    ensure(bucketCounts, (size_t)vstep);
+  }
+
+  /// Score plane for fastDetect, fastScoreHarris and fastExtract. It is
+  /// zero initialised and, as those functions require, may be reused
+  /// across frames without clearing.
+  template <int vstep>
+  uint8_t (*scorePlane())[vstep] {
+    return (uint8_t (*)[vstep])scores.data();
+  }
+
+  /// Detection plane for fastDetectBits, with rows of one bit per pixel.
+  /// Zero initialised, and like the score plane, may be reused across
+  /// frames without clearing.
+  template <int vstep>
+  uint64_t (*bitPlane())[(vstep + 63) / 64] {
+    return (uint64_t (*)[(vstep + 63) / 64])bits.data();
+  }
+
+  /// Return a buffer of at least `size` elements, growing it if needed.
+  /// Contents are preserved when it does not grow.
+  template <typename T>
+  static T *ensure(std::vector<T> &buffer, size_t size) {
+    if (buffer.size() < size) {
+      buffer.resize(size);
+    }
+    return buffer.data();
+  }
+
+  /// orbCentroids output, eight moments per group of four points.
+  std::vector<int32_t> centroids;
+  /// atan2 output, one angle per point.
+  std::vector<uint8_t> angles;
+  /// orbCompute point indices, bucketed by angle.
+  std::vector<uint32_t> order;
+  /// gaussian5x5 band state or hstore, followed by the buildPyramid
+  /// scratch rows.
+  std::vector<uint8_t> blur;
+  /// fastExtract buckets, bucketLimit points per bucket.
+  std::vector<Keypoint> buckets;
+  std::vector<int> bucketCounts;
+  /// selectLevels score histograms and per level state.
+  std::vector<int> selectCounts;
+  /// distributeLevels point order, covering grid, and level and kept
+  /// flags of each point.
+  std::vector<uint32_t> distributeOrder;
+  std::vector<uint8_t> distributeCells;
+  std::vector<uint8_t> distributeFlags;
+  std::vector<uint8_t> scores;
+  std::vector<uint64_t> bits;
+};
+
+} /* namespace pislam */
+#endif /* PISLAM_ORB_CONTEXT_H_ */
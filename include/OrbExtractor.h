@@ -0,0 +1,205 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_ORB_EXTRACTOR_H_
+#define PISLAM_ORB_EXTRACTOR_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Platform.h"
+#include "Fast.h"
+#include "OrbContext.h"
+#include "Pyramid.h"
+#include "ThreadPool.h"
+#include "Util.h"
+
+#if defined(PISLAM_NEON)
+#include "Orb.h"
+#endif
+
+namespace pislam {
+
+#if defined(PISLAM_NEON)
+/// Extract ORB features from every level of a vertically stacked pyramid
+/// using all threads of a ThreadPool.
+///
+/// Each level is divided into horizontal strips of about `stripRows`
+/// rows, so that level 0, which holds 40% of the pixels, is spread over
+/// all cores. Work is scheduled in two phases per level:
+///
+///  1. fastDetect and fastScoreHarris, one task per strip. A strip reads
+///     the `border` rows above and below it from the shared image, so no
+///     data is copied, but writes only its own rows of `out`.
+///  2. Once every strip of a level is scored, fastExtract and orbCompute,
+///     one task per strip. Non-max suppression reads one row either side
+///     of the strip, which is why it must wait for its neighbours.
+///
+/// Strips start on bucket boundaries, so fastExtract visits the same
+/// buckets in the same order as when called on the whole level. Points
+/// and descriptors are merged in strip order and are identical to the
+/// serial loop described in the README.
+///
+/// `out` must be zero initialised, as for fastExtract. An extractor may
+/// be used for any number of frames, but only one at a time.
+template <int vstep, int border = 16, int logBucketSize = 0,
+         int bucketLimit = 5, int words = 8>
+class OrbExtractor {
+ public:
+  OrbExtractor(ThreadPool &pool, const PyramidLevel *levels, int numLevels,
+      int threshold = 20, int32_t harrisThreshold = 1 << 15,
+      int stripRows = 64)
+      : pool(pool), levels(levels, levels + numLevels),
+        threshold(threshold), harrisThreshold(harrisThreshold),
+        remaining(new std::atomic<int>[numLevels]) {
+
+    // strips must keep the 2 row non-max blocks and buckets aligned
+    constexpr int align = (1 << logBucketSize) > 2 ? (1 << logBucketSize) : 2;
+    stripRows = std::max(align, stripRows / align * align);
+
+    for (int i = 0; i < numLevels; i += 1) {
+      firstStrip.push_back(strips.size());
+      for (int y = border; y < levels[i].height - border; y += stripRows) {
+        int end = std::min(y + stripRows, levels[i].height - border);
+        strips.push_back({i, y, end});
+      }
+    }
+    firstStrip.push_back(strips.size());
+
+    stripPoints.resize(strips.size());
+    stripDescriptors.resize(strips.size());
+    contexts.resize(strips.size());
+  }
+
+  OrbExtractor(const OrbExtractor &) = delete;
+  OrbExtractor &operator=(const OrbExtractor &) = delete;
+
+  /// Append the keypoints, with y relative to the top of the stacked
+  /// image, and their descriptors to `keypoints` and `descriptors`.
+  void extract(uint8_t img[][vstep], uint8_t out[][vstep],
+      std::vector<Keypoint> &keypoints, std::vector<uint32_t> &descriptors) {
+    this->img = img;
+    this->out = out;
+
+    for (size_t i = 0; i < levels.size(); i += 1) {
+      remaining[i] = firstStrip[i+1] - firstStrip[i];
+    }
+    for (size_t i = 0; i < strips.size(); i += 1) {
+      pool.push(&OrbExtractor::detect, this, i);
+    }
+    pool.wait();
+
+    for (size_t i = 0; i < strips.size(); i += 1) {
+      keypoints.insert(keypoints.end(),
+          stripPoints[i].begin(), stripPoints[i].end());
+      descriptors.insert(descriptors.end(),
+          stripDescriptors[i].begin(), stripDescriptors[i].end());
+    }
+  }
+
+ private:
+  struct Strip {
+    int level;
+    /// Rows of the level, within its border, scored by this strip.
+    int begin;
+    int end;
+  };
+
+  /// Rows [begin - border, end + border) of the strip's level, which is
+  /// the view the stages are given.
+  int stripHeight(const Strip &strip) const {
+    return strip.end - strip.begin + 2*border;
+  }
+
+  int stripRow(const Strip &strip) const {
+    return levels[strip.level].row + strip.begin - border;
+  }
+
+  static void detect(void *context, int index) {
+    OrbExtractor &self = *static_cast<OrbExtractor *>(context);
+    const Strip &strip = self.strips[index];
+    const int width = self.levels[strip.level].width;
+    const int height = self.stripHeight(strip);
+    const int row = self.stripRow(strip);
+
+    fastDetect<vstep, border>(width, height,
+        &self.img[row], &self.out[row], self.threshold);
+    fastScoreHarris<vstep, border>(width, height,
+        &self.img[row], self.harrisThreshold, &self.out[row]);
+
+    // the last strip of the level starts non-max suppression
+    if (--self.remaining[strip.level] == 0) {
+      for (int i = self.firstStrip[strip.level];
+          i < self.firstStrip[strip.level + 1]; i += 1) {
+        self.pool.push(&OrbExtractor::describe, context, i);
+      }
+    }
+  }
+
+  static void describe(void *context, int index) {
+    OrbExtractor &self = *static_cast<OrbExtractor *>(context);
+    const Strip &strip = self.strips[index];
+    const int width = self.levels[strip.level].width;
+    const int height = self.stripHeight(strip);
+    const int row = self.stripRow(strip);
+
+    std::vector<Keypoint> &points = self.stripPoints[index];
+    points.clear();
+    fastExtract<vstep, border, logBucketSize, bucketLimit>(width, height,
+        &self.out[row], points, self.contexts[index]);
+
+    // Adjust y coordinate to match position in image pyramid.
+    for (Keypoint &p : points) {
+      p = rencodeFastLevel(p, row, strip.level);
+    }
+
+    self.stripDescriptors[index].clear();
+    orbCompute<vstep, words>(self.img, points, self.stripDescriptors[index],
+        self.contexts[index]);
+  }
+
+  ThreadPool &pool;
+  std::vector<PyramidLevel> levels;
+  int threshold;
+  int32_t harrisThreshold;
+
+  std::vector<Strip> strips;
+  /// Index of the first strip of each level, plus one past the end.
+  std::vector<int> firstStrip;
+
+  /// Strips of each level still to be scored.
+  std::unique_ptr<std::atomic<int>[]> remaining;
+
+  /// Results and scratch memory of each strip, kept between frames to
+  /// reuse their storage.
+  std::vector<std::vector<Keypoint>> stripPoints;
+  std::vector<std::vector<uint32_t>> stripDescriptors;
+  std::vector<OrbContext> contexts;
+
+  uint8_t (*img)[vstep] = nullptr;
+  uint8_t (*out)[vstep] = nullptr;
+};
+
+#endif
+
+} /* namespace pislam */
+#endif /* PISLAM_ORB_EXTRACTOR_H_ */
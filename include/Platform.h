@@ -0,0 +1,68 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_PLATFORM_H_
+#define PISLAM_PLATFORM_H_
+
+// PiSlam is first and foremost a NEON library. The x86 kernels exist so
+// that recorded data can be reprocessed offline on servers, and must
+// produce bit identical output to their NEON counterparts.
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PISLAM_NEON 1
+#include "arm_neon.h"
+#elif defined(__x86_64__) || defined(__i386__)
+#define PISLAM_X86 1
+#include <immintrin.h>
+#endif
+
+// Functions compiled for AVX2 cannot be inlined into generic callers,
+// so every helper used by an AVX2 kernel must carry the same target.
+#if defined(PISLAM_X86)
+#define PISLAM_TARGET_AVX2 __attribute__((target("avx2")))
+#define PISLAM_TARGET_POPCNT __attribute__((target("popcnt")))
+#endif
+
+// Kernels which must reproduce another library's float results bit for
+// bit are compiled without fused multiply-adds. gcc contracts across
+// statements by default, so it needs telling; clang only contracts
+// within an expression, which such kernels avoid.
+#if defined(__GNUC__) && !defined(__clang__)
+#define PISLAM_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define PISLAM_NO_FP_CONTRACT
+#endif
+
+namespace pislam {
+
+#if defined(PISLAM_X86)
+/// Query CPUID (via the gcc builtin, which also checks that the OS saves
+/// the ymm registers) once and cache the result.
+static inline bool cpuSupportsAvx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+
+static inline bool cpuSupportsPopcnt() {
+  static const bool supported = __builtin_cpu_supports("popcnt");
+  return supported;
+}
+#endif
+
+} /* namespace pislam */
+#endif /* PISLAM_PLATFORM_H_ */
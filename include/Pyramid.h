@@ -0,0 +1,167 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_PYRAMID_H_
+#define PISLAM_PYRAMID_H_
+
+#include <algorithm>
+#include <cstdint>
+
+#include "OrbContext.h"
+#include "Platform.h"
+
+#if defined(PISLAM_NEON)
+#include "Gaussian.h"
+#include "Bilinear.h"
+#endif
+
+namespace pislam {
+
+constexpr int pyramidLevelCount = 8;
+
+/// Reduction applied to each level to produce the next, as
+/// {numerator, denominator}. Chaining 13/16 and 7/8 reductions tracks
+/// the 1.2 scale factor (5/6) of pislam to within 3% at every level.
+static const int pyramidReductions[pyramidLevelCount - 1][2] = {
+  {13, 16}, {7, 8}, {13, 16}, {13, 16}, {7, 8}, {13, 16}, {13, 16}
+};
+
+/// Position of a level within a vertically stacked pyramid.
+struct PyramidLevel {
+  int width;
+  int height;
+  /// First row of the level in the stacked image.
+  int row;
+};
+
+/// Compute the level dimensions of the pyramid produced by buildPyramid.
+/// Dimensions are rounded down as by bilinear7_8 and bilinear13_16.
+///
+/// For a 640x480 image the levels are 640x480, 520x390, 455x341,
+/// 369x277, 299x225, 261x196, 212x159 and 172x129, for 2197 rows total.
+///
+/// Returns the height of the stacked pyramid.
+static inline int pyramidLevels(const int width, const int height,
+    PyramidLevel levels[pyramidLevelCount]) {
+  levels[0] = {width, height, 0};
+  for (int i = 1; i < pyramidLevelCount; i += 1) {
+    const PyramidLevel &prev = levels[i - 1];
+    int num = pyramidReductions[i - 1][0];
+    int den = pyramidReductions[i - 1][1];
+    levels[i] = {
+      prev.width * num / den, prev.height * num / den, prev.row + prev.height
+    };
+  }
+  const PyramidLevel &last = levels[pyramidLevelCount - 1];
+  return last.row + last.height;
+}
+
+#if defined(PISLAM_NEON)
+/// Blur a single channel image with gaussian5x5 and build the stacked
+/// pyramid described by pyramidLevels in `out`.
+///
+/// Rather than producing each level from the full previous level, which
+/// costs a memory round trip per level, the pyramid is computed in a
+/// single pass. Each band of blurred rows is immediately reduced into
+/// the next level, and so on down the pyramid, so every stage reads
+/// rows which are still in L1.
+///
+/// Image must be padded to a multiple of 16 columns, and vstep must be
+/// at least the padded width. out must have as many rows as returned by
+/// pyramidLevels. Only the rows of the pyramid are written.
+///
+/// img and out may be same pointer, in which case level 0 replaces the
+/// input image.
+///
+/// The gaussian state and scratch rows are kept in `context`.
+template <int vstep>
+void buildPyramid(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], OrbContext &context) {
+  PyramidLevel levels[pyramidLevelCount];
+  pyramidLevels(width, height, levels);
+
+  // Rows of each level computed so far.
+  int done[pyramidLevelCount] = {0};
+
+  // State for the gaussian bands, followed by a scratch block for the
+  // final, partial block of each reduction. The partial block is padded
+  // by repeating its last row, and the result is copied out so that
+  // neither the input padding nor the output overhang touches the
+  // neighbouring levels.
+  const int blurSize = gaussian5x5BandBufferSize(width);
+  const int size = blurSize + (16 + 13) * vstep;
+  uint8_t *buffer = OrbContext::ensure(context.blur, size);
+  std::fill(buffer, buffer + size, 0);
+  uint8_t (*scratchIn)[vstep] = (uint8_t (*)[vstep])&buffer[blurSize];
+  uint8_t (*scratchOut)[vstep] = &scratchIn[16];
+
+  while (done[0] < height) {
+    int n = std::min(gaussian5x5BandRows, height - done[0]);
+    gaussian5x5Band<vstep>(width, height, done[0], n, img, out, buffer);
+    done[0] += n;
+
+    for (int i = 1; i < pyramidLevelCount; i += 1) {
+      const PyramidLevel &src = levels[i - 1];
+      const PyramidLevel &dst = levels[i];
+      const int num = pyramidReductions[i - 1][0];
+      const int den = pyramidReductions[i - 1][1];
+
+      uint8_t (*srcRows)[vstep] = &out[src.row];
+      uint8_t (*dstRows)[vstep] = &out[dst.row];
+
+      // whole blocks of the previous level
+      int y = done[i] / num * den;
+      for (; y + den <= done[i - 1]; y += den, done[i] += num) {
+        if (den == 8) {
+          bilinear7_8<vstep>(src.width, den, &srcRows[y], &dstRows[done[i]]);
+        } else {
+          bilinear13_16<vstep>(src.width, den, &srcRows[y], &dstRows[done[i]]);
+        }
+      }
+
+      // partial block at the bottom of the previous level
+      if (done[i - 1] == src.height && done[i] < dst.height) {
+        for (int k = 0; k < den; k += 1) {
+          const uint8_t *row = srcRows[std::min(y + k, src.height - 1)];
+          std::copy(row, row + vstep, scratchIn[k]);
+        }
+        if (den == 8) {
+          bilinear7_8<vstep>(src.width, den, scratchIn, scratchOut);
+        } else {
+          bilinear13_16<vstep>(src.width, den, scratchIn, scratchOut);
+        }
+        for (int k = 0; done[i] < dst.height; k += 1, done[i] += 1) {
+          std::copy(scratchOut[k], scratchOut[k] + vstep, dstRows[done[i]]);
+        }
+      }
+    }
+  }
+}
+
+/// As above, with state allocated for this call.
+template <int vstep>
+void buildPyramid(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep]) {
+  OrbContext context;
+  buildPyramid<vstep>(width, height, img, out, context);
+}
+#endif
+
+} /* namespace pislam */
+#endif /* PISLAM_PYRAMID_H_ */
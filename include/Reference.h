@@ -0,0 +1,834 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_REFERENCE_H_
+#define PISLAM_REFERENCE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "BriefTable.h"
+#include "Match.h"
+#include "OrbSteered.h"
+#include "Pyramid.h"
+#include "Select.h"
+#include "Util.h"
+
+/// Scalar reference implementations of every stage of the pipeline.
+///
+/// These are written for clarity, not speed, and exist as an oracle
+/// for the SIMD kernels. Each function has the same signature as its
+/// optimized counterpart and reproduces its output bit for bit,
+/// including the rounding of the NEON halving instructions
+/// (vrhadd, vhadd, vhsub), the "quarter precision" Harris score and the
+/// vrecpe based atan2 approximation.
+///
+/// Nothing in this file depends on NEON, so it builds on any platform.
+namespace pislam {
+namespace ref {
+
+// NEON halving instructions, computed without intermediate overflow.
+static inline int rhadd(int a, int b) { return (a + b + 1) >> 1; }
+static inline int hadd(int a, int b) { return (a + b) >> 1; }
+static inline int hsub(int a, int b) { return (a - b) >> 1; }
+
+/// Whether `img[y][x]` is a FAST corner at `threshold`.
+template <int vstep>
+bool fastCorner(uint8_t img[][vstep], int x, int y, int threshold) {
+
+  // The 16 circle pixels, clockwise from the top. The first 8 make up
+  // d0/l0 (bit 7 first) and the remaining 8 make up d1/l1.
+  static const int circle[16][2] = {
+    {-1, -3}, { 0, -3}, { 1, -3}, { 2, -2},
+    { 3, -1}, { 3,  0}, { 3,  1}, { 2,  2},
+    { 1,  3}, { 0,  3}, {-1,  3}, {-2,  2},
+    {-3,  1}, {-3,  0}, {-3, -1}, {-2, -2},
+  };
+
+  int c = img[y][x];
+  int light = std::min(c + threshold, 255);
+  int dark = std::max(c - threshold, 0);
+
+  uint8_t d[2] = {0, 0};
+  uint8_t l[2] = {0, 0};
+  for (int i = 0; i < 16; i += 1) {
+    int test = img[y+circle[i][1]][x+circle[i][0]];
+    if (test >= dark) d[i/8] |= 0x80 >> (i%8);
+    if (test <= light) l[i/8] |= 0x80 >> (i%8);
+  }
+
+  // 8 consecutive bits implies d0 & d1 == 0.
+  uint8_t t0 = (d[0] & d[1]) ? l[0] : d[0];
+  uint8_t t1 = (d[0] & d[1]) ? l[1] : d[1];
+
+  // A corner is 9 consecutive zeros: the leading zeros of one half
+  // followed by the trailing zeros of the other.
+  int cntLo = 0, cntHi = 0;
+  while (cntLo < 8 && !(t0 & (0x80 >> cntLo))) cntLo += 1;
+  while (cntHi < 8 && !(t1 & (0x80 >> cntHi))) cntHi += 1;
+
+  bool lo = cntLo && uint8_t(t1 << (cntLo - 1)) == 0;
+  bool hi = cntHi && uint8_t(t0 << (cntHi - 1)) == 0;
+  return lo || hi;
+}
+
+/// See pislam::fastDetect. Unlike the SIMD version, only pixels inside
+/// the border are written.
+template <int vstep, int border>
+void fastDetect(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int threshold) {
+  for (int y = border; y < height - border; y += 1) {
+    for (int x = border; x < width - border; x += 1) {
+      out[y][x] = fastCorner<vstep>(img, x, y, threshold) ? 0xff : 0x00;
+    }
+  }
+}
+
+/// See pislam::FastScorer. Every threshold is tried in turn.
+template <int vstep>
+uint8_t fastCornerScore(uint8_t img[][vstep], int x, int y,
+    int32_t threshold) {
+  int score = 0;
+  for (int t = 1; t < 256; t += 1) {
+    if (fastCorner<vstep>(img, x, y, t)) {
+      score = t;
+    }
+  }
+  return threshold < score ? score : 0;
+}
+
+/// See pislam::harrisEval. All arithmetic wraps at 32 bits like the
+/// NEON registers.
+static inline uint8_t harrisEval(uint32_t Ixx, uint32_t Iyy, int32_t Ixy,
+    int32_t threshold) {
+
+  uint32_t trace32 = Ixx + Iyy;
+  trace32 = (trace32 * trace32) >> 4;
+
+  uint32_t det32 = Ixx * Iyy - uint32_t(Ixy) * uint32_t(Ixy);
+  int32_t score = int32_t(det32 - trace32);
+
+  if (threshold < score) {
+    float scoref = float(score);
+    uint32_t logscore;
+    std::memcpy(&logscore, &scoref, sizeof(logscore));
+    return (logscore >> 20) & 0xff;
+  }
+
+  return 0;
+}
+
+/// The sums of pislam::harrisScoreSobel. The 6x6 window covers rows
+/// y-2..y+3 and columns x-2..x+3.
+template <int vstep>
+void harrisSums(uint8_t img[][vstep], int x, int y,
+    uint32_t &Ixx, uint32_t &Iyy, int32_t &Ixy) {
+
+  // Sobel differences, each step a halving add or subtract.
+  int dx[6][6], dy[6][6];
+  for (int r = 0; r < 6; r += 1) {
+    int yy = y - 2 + r;
+    for (int c = 0; c < 6; c += 1) {
+      int xx = x - 2 + c;
+
+      int h0 = hsub(img[yy-1][xx+1], img[yy-1][xx-1]);
+      int h1 = hsub(img[yy  ][xx+1], img[yy  ][xx-1]);
+      int h2 = hsub(img[yy+1][xx+1], img[yy+1][xx-1]);
+      dx[r][c] = hadd(hadd(h0, h2), h1);
+
+      int v0 = hsub(img[yy+1][xx-1], img[yy-1][xx-1]);
+      int v1 = hsub(img[yy+1][xx  ], img[yy-1][xx  ]);
+      int v2 = hsub(img[yy+1][xx+1], img[yy-1][xx+1]);
+      dy[r][c] = hadd(v1, hadd(v0, v2));
+    }
+  }
+
+  // NEON accumulates pairs of rows into 16 bit lanes. Only xy may
+  // be negative, and wraps in the same way here.
+  Ixx = 0;
+  Iyy = 0;
+  Ixy = 0;
+  for (int r = 0; r < 6; r += 2) {
+    for (int c = 0; c < 6; c += 1) {
+      Ixx += dx[r][c]*dx[r][c] + dx[r+1][c]*dx[r+1][c];
+      Iyy += dy[r][c]*dy[r][c] + dy[r+1][c]*dy[r+1][c];
+      Ixy += int16_t(dx[r][c]*dy[r][c] + dx[r+1][c]*dy[r+1][c]);
+    }
+  }
+  Ixx >>= 4;
+  Iyy >>= 4;
+  Ixy >>= 4;
+}
+
+/// See pislam::harrisScoreSobel.
+template <int vstep>
+uint8_t harrisScoreSobel(uint8_t img[][vstep], int x, int y,
+    int32_t threshold) {
+  uint32_t Ixx, Iyy;
+  int32_t Ixy;
+  harrisSums<vstep>(img, x, y, Ixx, Iyy, Ixy);
+  return harrisEval(Ixx, Iyy, Ixy, threshold);
+}
+
+/// See pislam::shiTomasiEval. Each single precision step is stored
+/// through a volatile, so that none are fused.
+template <int vstep>
+uint8_t shiTomasiScoreSobel(uint8_t img[][vstep], int x, int y,
+    int32_t threshold) {
+  uint32_t Ixx, Iyy;
+  int32_t Ixy;
+  harrisSums<vstep>(img, x, y, Ixx, Iyy, Ixy);
+
+  volatile float d = float(int32_t(Ixx - Iyy));
+  volatile float xy = float(Ixy);
+  volatile float dd = d*d;
+  volatile float xy4 = 4.0f*(xy*xy);
+  volatile float root = std::sqrt(dd + xy4);
+  int32_t score = int32_t(float(int32_t(Ixx + Iyy)) - root);
+
+  if (threshold < score) {
+    float scoref = float(score);
+    uint32_t logscore;
+    std::memcpy(&logscore, &scoref, sizeof(logscore));
+    return (logscore >> 20) & 0xff;
+  }
+
+  return 0;
+}
+
+/// See pislam::harrisResponse7. A transcription of HarrisResponses in
+/// OpenCV's orb.cpp, with blockSize 7, keeping its integer sums a, b
+/// and c and replacing the float response by the exact integer one.
+template <int vstep, int harrisK = 41>
+int64_t harrisResponse7(uint8_t img[][vstep], int x, int y) {
+  const int blockSize = 7, r = blockSize / 2;
+  const int step = vstep;
+  const uint8_t *ptr0 = &img[y - r][x - r];
+
+  int a = 0, b = 0, c = 0;
+  for (int i = 0; i < blockSize; i += 1) {
+    for (int j = 0; j < blockSize; j += 1) {
+      const uint8_t *ptr = ptr0 + i*step + j;
+      int Ix = (ptr[1] - ptr[-1])*2 + (ptr[-step+1] - ptr[-step-1]) +
+        (ptr[step+1] - ptr[step-1]);
+      int Iy = (ptr[step] - ptr[-step])*2 + (ptr[step-1] - ptr[-step-1]) +
+        (ptr[step+1] - ptr[-step+1]);
+      a += Ix*Ix;
+      b += Iy*Iy;
+      c += Ix*Iy;
+    }
+  }
+
+  int64_t trace = int64_t(a) + b;
+  return (int64_t(a)*b - int64_t(c)*c)*1024 - harrisK*trace*trace;
+}
+
+/// See pislam::fastScoreHarris.
+template <int vstep, int border>
+void fastScoreHarris(int width, int height,
+    uint8_t img[][vstep], int32_t threshold, uint8_t out[][vstep]) {
+
+  for (int y = border; y < height - border; y += 1) {
+    for (int x = border; x < width - border; x += 1) {
+      if (out[y][x]) {
+        out[y][x] = harrisScoreSobel<vstep>(img, x, y, threshold);
+      }
+    }
+  }
+}
+
+/// See pislam::fastExtract. A pixel survives non-max suppression if it is
+/// greater or equal to each neighbour preceding it in raster order, and
+/// strictly greater than each neighbour following it. Pixels are visited
+/// in 2x2 blocks, of which at most one survives, in the same order as the
+/// optimized version. Buckets keep their `bucketLimit` largest encoded
+/// points and are emitted in ascending order at the end of each band.
+template <int vstep, int border, int logBucketSize = 0, int bucketLimit = 5>
+std::vector<Keypoint> fastExtract(const int width, const int height,
+    uint8_t out[][vstep], std::vector<Keypoint> &results) {
+
+  constexpr int bucketSize = 1 << logBucketSize;
+  const int numBuckets = (width - 2*border - 1) / bucketSize + 1;
+  std::vector<std::vector<Keypoint>> buckets(numBuckets);
+
+  auto flush = [&]() {
+    for (auto &bucket : buckets) {
+      std::sort(bucket.begin(), bucket.end());
+      size_t keep = std::min<size_t>(bucket.size(), bucketLimit);
+      results.insert(results.end(), bucket.end() - keep, bucket.end());
+      bucket.clear();
+    }
+  };
+
+  for (int y = border; y < height - border; y += 2) {
+    if (logBucketSize != 0 && y != border && (y-border) % bucketSize == 0) {
+      flush();
+    }
+    for (int x = border; x < width - border; x += 2) {
+      for (int i = 0; i < 4; i += 1) {
+        int px = x + (i & 1);
+        int py = y + (i >> 1);
+        int v = out[py][px];
+        if (!v) {
+          continue;
+        }
+
+        bool survives = true;
+        for (int ny = py - 1; ny <= py + 1; ny += 1) {
+          for (int nx = px - 1; nx <= px + 1; nx += 1) {
+            bool before = ny < py || (ny == py && nx < px);
+            bool after = ny > py || (ny == py && nx > px);
+            if ((before && v < out[ny][nx]) || (after && v <= out[ny][nx])) {
+              survives = false;
+            }
+          }
+        }
+
+        if (survives) {
+          Keypoint result = encodeFast(v, px, py);
+          if (logBucketSize == 0) {
+            results.push_back(result);
+          } else {
+            buckets[(x-border) / bucketSize].push_back(result);
+          }
+        }
+      }
+    }
+  }
+
+  if (logBucketSize != 0) {
+    flush();
+  }
+
+  return results;
+}
+
+/// Half width of the centroid patch for each row offset. This is the
+/// circle traced by the masks in pislam::orbCentroids.
+static const int centroidExtent[16] = {
+  15, 15, 15, 15, 15, 15, 14, 14, 13, 13, 12, 11, 10, 9, 7, 5
+};
+
+/// See pislam::orbCentroids. Moments are returned in groups of eight,
+/// four x moments followed by the matching four y moments.
+template<int vstep>
+std::vector<int32_t> orbCentroids(uint8_t img[][vstep],
+    const std::vector<Keypoint> &points) {
+
+  std::vector<int32_t> centroids;
+  centroids.resize((2*points.size() + 7) & (~0x7));
+
+  int out = 0;
+  for (Keypoint point : points) {
+    int x = decodeFastX(point);
+    int y = decodeFastY(point);
+
+    int32_t xmoment = 0, ymoment = 0;
+    for (int dy = -15; dy <= 15; dy += 1) {
+      int extent = centroidExtent[std::abs(dy)];
+      for (int dx = -extent; dx <= extent; dx += 1) {
+        xmoment += dx * img[y+dy][x+dx];
+        ymoment += dy * img[y+dy][x+dx];
+      }
+    }
+
+    centroids[out  ] = xmoment;
+    centroids[out+4] = ymoment;
+
+    out += 1;
+    if (out % 4 == 0) {
+      out += 4;
+    }
+  }
+  return centroids;
+}
+
+/// Emulation of the ARMv7 VRECPE.F32 reciprocal estimate, following the
+/// FPRecipEstimate pseudocode in the architecture reference manual.
+/// Denormals are flushed to zero as NEON does.
+static inline float recipEstimate(float a) {
+  uint32_t bits;
+  std::memcpy(&bits, &a, sizeof(bits));
+
+  uint32_t sign = bits & 0x80000000u;
+  uint32_t exponent = (bits >> 23) & 0xff;
+  float result;
+
+  if (std::isnan(a)) {
+    return a;
+  } else if (exponent == 0) {
+    bits = sign | 0x7f800000u;
+  } else if (exponent == 0xff) {
+    bits = sign;
+  } else if (exponent >= 253) {
+    bits = sign;
+  } else {
+    // scale into [0.5, 1) and estimate to 8 bits
+    double scaled = 0.5 + (bits & 0x7fffff) / double(1 << 24);
+    int q = int(scaled * 512.0);
+    double r = 1.0 / ((double(q) + 0.5) / 512.0);
+    int s = int(256.0 * r + 0.5);
+    bits = sign | ((253 - exponent) << 23) | uint32_t(s - 256) << 15;
+  }
+
+  std::memcpy(&result, &bits, sizeof(result));
+  return result;
+}
+
+/// NEON float to integer conversion truncates, saturates and maps NaN
+/// to zero.
+static inline int32_t cvtFloatToInt(float f) {
+  if (std::isnan(f)) return 0;
+  if (f >= 2147483648.0f) return INT32_MAX;
+  if (f < -2147483648.0f) return INT32_MIN;
+  return int32_t(f);
+}
+
+/// See pislam::atan2. The polynomial is evaluated in single precision
+/// one operation at a time, which matches NEON as long as the compiler
+/// does not contract it into fused multiply-adds.
+static inline std::vector<uint8_t> atan2(const std::vector<int32_t> &xys) {
+  std::vector<uint8_t> angles;
+  for (auto it = xys.begin(); it < xys.end(); it += 8) {
+    for (int i = 0; i < 4; i += 1) {
+      int32_t x = it[i];
+      int32_t y = it[i+4];
+
+      float xf = std::fabs(float(x));
+      float yf = std::fabs(float(y));
+
+      float zmax = std::max(xf, yf);
+      float zmin = std::min(xf, yf);
+
+      float z = zmin * recipEstimate(zmax);
+
+      const float c0 = 256*14.999998;
+      const float c1 = 256*4.723436;
+      const float c2 = 256*1.266240;
+      float zm1 = z - 1;
+      float poly = c2 * z;
+      poly = c1 + poly;
+      poly = zm1 * poly;
+      poly = c0 - poly;
+      float anglef = z * poly;
+
+      int32_t angle = cvtFloatToInt(anglef);
+
+      if (abs(x) > abs(y)) {
+        if ((x^y) < 0) {
+          angle = -angle;
+        }
+        if (x < 0) {
+          angle += 256*60;
+        } else if (angle < 0) {
+          angle += 256*120;
+        }
+      } else {
+        if ((x^y) >= 0) {
+          angle = -angle;
+        }
+        if (y >= 0) {
+          angle = angle + 256*30;
+        } else {
+          angle = angle + 256*90;
+        }
+      }
+      angle >>= 10;
+      if (!(0 <= angle && angle < 30)) {
+        angle = 0;
+      }
+      angles.push_back(angle);
+    }
+  }
+
+  return angles;
+}
+
+/// See pislam::briefDescribe. The pattern is rotated at runtime using the
+/// same single precision arithmetic that briefBit evaluates at compile
+/// time.
+template <int vstep, int words>
+void briefDescribe(uint8_t img[][vstep], int x, int y,
+    int rot, uint32_t descriptor[words]) {
+
+  float theta = rot * M_PI / 15;
+  float c = cosf(theta);
+  float s = sinf(theta);
+
+  auto clamp = [](int v) { return std::min(15, std::max(-15, v)); };
+
+  for (int w = 0; w < words; w += 1) {
+    uint32_t bits = 0;
+    for (int b = 0; b < 32; b += 1) {
+      const int8_t *p = briefPattern[w*32+b];
+      int dx0 = clamp(roundf(c*p[0]-s*p[1]));
+      int dy0 = clamp(roundf(s*p[0]+c*p[1]));
+      int dx1 = clamp(roundf(c*p[2]-s*p[3]));
+      int dy1 = clamp(roundf(s*p[2]+c*p[3]));
+      if (img[y+dy0][x+dx0] < img[y+dy1][x+dx1]) {
+        bits |= 1u << b;
+      }
+    }
+    descriptor[w] = bits;
+  }
+}
+
+/// See pislam::orbCompute.
+template <int vstep, int words>
+void orbCompute(uint8_t img[][vstep], const std::vector<Keypoint> &points,
+    std::vector<uint32_t> &descriptors) {
+
+  std::vector<int32_t> centroids = orbCentroids<vstep>(img, points);
+  std::vector<uint8_t> angles = atan2(centroids);
+
+  size_t base = descriptors.size();
+  descriptors.resize(base + points.size()*words);
+
+  for (size_t i = 0; i < points.size(); i += 1) {
+    int x = decodeFastX(points[i]);
+    int y = decodeFastY(points[i]);
+    briefDescribe<vstep, words>(img, x, y, angles[i],
+        &descriptors[base + i*words]);
+  }
+}
+
+/// See pislam::orbComputeSteered. A transcription of OpenCV's ICAngles
+/// and computeOrbDescriptors, including the construction of u_max.
+template <int vstep, int words>
+PISLAM_NO_FP_CONTRACT
+void orbComputeSteered(uint8_t img[][vstep], const std::vector<Keypoint> &points,
+    std::vector<uint32_t> &descriptors, std::vector<float> &angles) {
+  const int halfPatch = 15;
+  int umax[halfPatch + 2];
+  int vmax = std::floor(halfPatch * std::sqrt(2.f) / 2 + 1);
+  int vmin = std::ceil(halfPatch * std::sqrt(2.f) / 2);
+  for (int v = 0; v <= vmax; v += 1) {
+    umax[v] = lrint(std::sqrt((double)halfPatch*halfPatch - v*v));
+  }
+  for (int v = halfPatch, v0 = 0; v >= vmin; v -= 1) {
+    while (umax[v0] == umax[v0 + 1]) {
+      v0 += 1;
+    }
+    umax[v] = v0;
+    v0 += 1;
+  }
+
+  for (Keypoint point : points) {
+    const uint8_t *center = &img[decodeFastY(point)][decodeFastX(point)];
+
+    int m01 = 0, m10 = 0;
+    for (int u = -halfPatch; u <= halfPatch; u += 1) {
+      m10 += u * center[u];
+    }
+    for (int v = 1; v <= halfPatch; v += 1) {
+      int vsum = 0;
+      int d = umax[v];
+      for (int u = -d; u <= d; u += 1) {
+        int plus = center[u + v*vstep], minus = center[u - v*vstep];
+        vsum += plus - minus;
+        m10 += u * (plus + minus);
+      }
+      m01 += v * vsum;
+    }
+    float degrees = fastAtan2((float)m01, (float)m10);
+    angles.push_back(degrees);
+
+    float angle = degrees * (float)(M_PI/180.f);
+    float a = (float)std::cos((double)angle);
+    float b = (float)std::sin((double)angle);
+
+    auto value = [&](int idx) {
+      float px = briefPattern[idx/2][idx%2*2];
+      float py = briefPattern[idx/2][idx%2*2 + 1];
+      float xa = px*a, yb = py*b, xb = px*b, ya = py*a;
+      float x = xa - yb, y = xb + ya;
+      return center[lrintf(y)*vstep + lrintf(x)];
+    };
+
+    for (int w = 0; w < words; w += 1) {
+      uint32_t bits = 0;
+      for (int bit = 0; bit < 32; bit += 1) {
+        int idx = 2*(w*32 + bit);
+        if (value(idx) < value(idx + 1)) {
+          bits |= 1u << bit;
+        }
+      }
+      descriptors.push_back(bits);
+    }
+  }
+}
+
+/// See pislam::gaussian5x5. Edges are reflected, i.e. row -1 is row 1.
+/// img and out may be same pointer.
+template <int vstep>
+void gaussian5x5(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep]) {
+
+  if (img != out) {
+    for (int i = 0; i < height; i += 1) {
+      std::copy(&img[i][0], &img[i][width], &out[i][0]);
+    }
+  }
+
+  // vertical pass
+  for (int j = 0; j < width; j += 1) {
+    int a = out[2][j], b = out[1][j], c = out[0][j], d = out[1][j], e;
+    for (int i = 0; i < height; i += 1) {
+      if (i == height - 2) {
+        e = c;
+      } else if (i == height - 1) {
+        e = a;
+      } else {
+        e = out[i+2][j];
+      }
+
+      int x = rhadd(rhadd(rhadd(a, e), c), c);
+      out[i][j] = rhadd(x, rhadd(b, d));
+
+      a = b; b = c; c = d; d = e;
+    }
+  }
+
+  // horizontal pass
+  for (int i = 0; i < height; i += 1) {
+    int a = out[i][2], b = out[i][1], c = out[i][0], d = out[i][1], e;
+    for (int j = 0; j < width; j += 1) {
+      if (j == width - 2) {
+        e = c;
+      } else if (j == width - 1) {
+        e = a;
+      } else {
+        e = out[i][j+2];
+      }
+
+      int x = rhadd(rhadd(rhadd(a, e), c), c);
+      out[i][j] = rhadd(x, rhadd(b, d));
+
+      a = b; b = c; c = d; d = e;
+    }
+  }
+}
+
+// vrshr, shift right rounding half up
+static inline int rshr(int a, int n) {
+  return (a + (1 << (n-1))) >> n;
+}
+
+/// Shared implementation of the fixed ratio bilinear reductions.
+/// Every `blockSize` input pixels produce `filter.size()` output pixels,
+/// `map` gives the input offset of each output pixel within the block.
+template <int vstep>
+void bilinearBlocks(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep], int blockSize,
+    const int *filter, const int *map, int n) {
+
+  for (int i = 0, oi = 0; i < height; i += blockSize, oi += n) {
+    for (int j = 0, oj = 0; j < width; j += blockSize, oj += n) {
+      // computed into a temporary so that img and out may alias
+      uint8_t block[16][16];
+      for (int y = 0; y < n; y += 1) {
+        for (int x = 0; x < n; x += 1) {
+          int sy = i + map[y];
+          int sx = j + map[x];
+          int h0 = rshr(img[sy  ][sx]*filter[x] + img[sy  ][sx+1]*filter[n-1-x], 8);
+          int h1 = rshr(img[sy+1][sx]*filter[x] + img[sy+1][sx+1]*filter[n-1-x], 8);
+          block[y][x] = rshr(h0*filter[y] + h1*filter[n-1-y], 8);
+        }
+      }
+      for (int y = 0; y < n; y += 1) {
+        std::copy(&block[y][0], &block[y][n], &out[oi+y][oj]);
+      }
+    }
+  }
+}
+
+/// See pislam::bilinear7_8.
+template <int vstep>
+void bilinear7_8(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep]) {
+  static const int filter[] = {238, 201, 165, 128, 91, 55, 18};
+  static const int map[] = {0, 1, 2, 3, 4, 5, 6};
+  bilinearBlocks<vstep>(width, height, img, out, 8, filter, map, 7);
+}
+
+/// See pislam::bilinear13_16.
+template <int vstep>
+void bilinear13_16(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep]) {
+  static const int filter[] = {
+    226, 167, 108, 49, 246, 187, 128, 69, 10, 207, 138, 89, 30
+  };
+  static const int map[] = {0, 1, 2, 3, 5, 6, 7, 8, 9, 11, 12, 13, 14};
+  bilinearBlocks<vstep>(width, height, img, out, 16, filter, map, 13);
+}
+
+/// See pislam::buildPyramid. Each level is computed from the whole of
+/// the previous level, with zero padding below and to the right.
+template <int vstep>
+void buildPyramid(const int width, const int height,
+    uint8_t img[][vstep], uint8_t out[][vstep]) {
+  PyramidLevel levels[pyramidLevelCount];
+  pyramidLevels(width, height, levels);
+
+  gaussian5x5<vstep>(width, height, img, out);
+
+  for (int i = 1; i < pyramidLevelCount; i += 1) {
+    const PyramidLevel &src = levels[i - 1];
+    const PyramidLevel &dst = levels[i];
+
+    std::vector<uint8_t> a((src.height + 16) * vstep), b(a.size());
+    for (int y = 0; y < src.height; y += 1) {
+      std::copy(out[src.row + y], out[src.row + y] + src.width, &a[y*vstep]);
+    }
+
+    if (pyramidReductions[i - 1][1] == 8) {
+      bilinear7_8<vstep>(src.width, src.height,
+          (uint8_t (*)[vstep])a.data(), (uint8_t (*)[vstep])b.data());
+    } else {
+      bilinear13_16<vstep>(src.width, src.height,
+          (uint8_t (*)[vstep])a.data(), (uint8_t (*)[vstep])b.data());
+    }
+
+    for (int y = 0; y < dst.height; y += 1) {
+      std::copy(&b[y*vstep], &b[y*vstep + dst.width], &out[dst.row + y][0]);
+    }
+  }
+}
+
+/// See pislam::resample. Taps are computed directly for each pixel
+/// rather than read from a table.
+template <int vstep>
+void resample(const int width, const int height,
+    const int outWidth, const int outHeight,
+    uint8_t img[][vstep], uint8_t out[][vstep]) {
+  // source position of output pixel i in 1/256ths, and its two taps
+  auto taps = [](int i, int size, int outSize, int *i0, int *i1, int *w1) {
+    int64_t pos = ((2*i + 1) * (int64_t)size - outSize) * 128;
+    pos = (pos + outSize/2) / outSize;
+    *i0 = pos / 256;
+    *w1 = pos % 256;
+    *i1 = *w1 ? *i0 + 1 : *i0;
+  };
+
+  std::vector<uint8_t> temp(width);
+  for (int y = 0; y < outHeight; y += 1) {
+    int y0, y1, b;
+    taps(y, height, outHeight, &y0, &y1, &b);
+    int a = b ? 256 - b : 128;
+    b = b ? b : 128;
+    for (int x = 0; x < width; x += 1) {
+      temp[x] = rshr(img[y0][x]*a + img[y1][x]*b, 8);
+    }
+
+    for (int x = 0; x < outWidth; x += 1) {
+      int x0, x1, d;
+      taps(x, width, outWidth, &x0, &x1, &d);
+      int c = d ? 256 - d : 128;
+      d = d ? d : 128;
+      out[y][x] = rshr(temp[x0]*c + temp[x1]*d, 8);
+    }
+  }
+}
+
+/// Number of set bits in each byte value.
+static inline int popcount8(uint8_t byte) {
+  static uint8_t table[256];
+  static bool init = false;
+  if (!init) {
+    for (int i = 0; i < 256; i += 1) {
+      table[i] = (i & 1) + table[i / 2];
+    }
+    init = true;
+  }
+  return table[byte];
+}
+
+/// See pislam::matchNearest. Bits are counted a byte at a time with a
+/// lookup table, as by flann's Hamming distance.
+static inline void matchNearest(const uint32_t *query, int queryCount,
+    const uint32_t *train, int trainCount, NearestMatch *out) {
+  for (int i = 0; i < queryCount; i += 1) {
+    const uint8_t *q = (const uint8_t *)&query[i * matchWords];
+    NearestMatch m = {-1, matchNoDistance, matchNoDistance};
+    for (int j = 0; j < trainCount; j += 1) {
+      const uint8_t *t = (const uint8_t *)&train[j * matchWords];
+      int distance = 0;
+      for (int b = 0; b < 4 * matchWords; b += 1) {
+        distance += popcount8(q[b] ^ t[b]);
+      }
+      if (distance < m.distance) {
+        m.second = m.distance;
+        m.distance = distance;
+        m.train = j;
+      } else if (distance < m.second) {
+        m.second = distance;
+      }
+    }
+    out[i] = m;
+  }
+}
+
+/// See pislam::selectLevels. The points of each level are stably sorted
+/// by descending score, and the first of each are kept.
+static inline void selectLevels(std::vector<Keypoint> &keypoints,
+    const PyramidLevel *levels, int numLevels, int total) {
+  std::vector<std::vector<size_t>> byLevel(numLevels);
+  for (size_t i = 0; i < keypoints.size(); i += 1) {
+    int l = numLevels - 1;
+    while (l > 0 && (int)decodeFastY(keypoints[i]) < levels[l].row) {
+      l -= 1;
+    }
+    byLevel[l].push_back(i);
+  }
+
+  std::vector<int> available(numLevels);
+  std::vector<int> quotas(numLevels);
+  for (int l = 0; l < numLevels; l += 1) {
+    available[l] = byLevel[l].size();
+  }
+  pislam::levelQuotas(levels, numLevels, total, quotas.data(),
+      available.data());
+
+  std::vector<bool> keep(keypoints.size());
+  for (int l = 0; l < numLevels; l += 1) {
+    std::stable_sort(byLevel[l].begin(), byLevel[l].end(),
+        [&](size_t a, size_t b) {
+          return decodeFastScore(keypoints[a]) > decodeFastScore(keypoints[b]);
+        });
+    for (int k = 0; k < quotas[l]; k += 1) {
+      keep[byLevel[l][k]] = true;
+    }
+  }
+
+  std::vector<Keypoint> kept;
+  for (size_t i = 0; i < keypoints.size(); i += 1) {
+    if (keep[i]) {
+      kept.push_back(keypoints[i]);
+    }
+  }
+  keypoints.swap(kept);
+}
+
+} /* namespace ref */
+} /* namespace pislam */
+#endif /* PISLAM_REFERENCE_H_ */
@@ -0,0 +1,198 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_RESAMPLE_H_
+#define PISLAM_RESAMPLE_H_
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "Platform.h"
+
+namespace pislam {
+
+/// Bilinear filter taps for one output pixel along one axis.
+///
+/// Output pixel i is centred on source position
+/// (i + 1/2) * size / outSize - 1/2, which is split into the source pixel
+/// to its left and a fraction in 1/256ths. The taps are `index` and
+/// `index + 1` with weights `256 - fraction` and `fraction`. If the
+/// fraction is zero both taps are `index` with weight 128, so that every
+/// weight fits in a byte.
+///
+/// This is the same convention used by bilinear7_8 and bilinear13_16.
+static inline void resampleTaps(int i, int size, int outSize,
+    int *i0, int *i1, uint8_t *w0, uint8_t *w1) {
+  // position in 1/256ths, rounded to nearest
+  int64_t num = ((int64_t)(2*i + 1) * size - outSize) * 256;
+  int64_t den = 2 * (int64_t)outSize;
+  int pos = (num + den/2) / den;
+
+  *i0 = pos >> 8;
+  int fraction = pos & 0xff;
+  if (fraction == 0) {
+    *i1 = *i0;
+    *w0 = *w1 = 128;
+  } else {
+    *i1 = *i0 + 1;
+    *w0 = 256 - fraction;
+    *w1 = fraction;
+  }
+}
+
+/// Horizontal taps for eight consecutive output pixels. Taps are byte
+/// offsets from `base`, all of which lie within 32 bytes so that they
+/// can be gathered with a single table lookup.
+struct ResampleBlock {
+  uint16_t base;
+  uint8_t i0[8];
+  uint8_t i1[8];
+  uint8_t w0[8];
+  uint8_t w1[8];
+};
+
+/// Precomputed filter taps for resampling a width x height image to
+/// outWidth x outHeight. Building the table is the only part of
+/// resampling which involves division, so it should be built once per
+/// pyramid level and reused for every frame.
+struct ResampleTable {
+  int width;
+  int height;
+  int outWidth;
+  int outHeight;
+  /// Source rows and weights of each output row, two per row.
+  std::vector<uint16_t> rows;
+  std::vector<uint8_t> rowWeights;
+  /// One block per eight output columns.
+  std::vector<ResampleBlock> blocks;
+};
+
+/// Build the table to resample a width x height image to
+/// outWidth x outHeight. The scale factor along each axis is
+/// outSize / size, so for a rational scale num/den the output size
+/// should be size*num/den. For example, 5/6 maps 640x480 to 533x400.
+///
+/// Scale factors must be at most 1, and no less than about 1/4 so that
+/// eight output pixels span at most 32 source pixels.
+static inline void resampleTable(const int width, const int height,
+    const int outWidth, const int outHeight, ResampleTable &table) {
+  assert(0 < outWidth && outWidth <= width);
+  assert(0 < outHeight && outHeight <= height);
+
+  table.width = width;
+  table.height = height;
+  table.outWidth = outWidth;
+  table.outHeight = outHeight;
+
+  table.rows.resize(2*outHeight);
+  table.rowWeights.resize(2*outHeight);
+  for (int y = 0; y < outHeight; y += 1) {
+    int i0, i1;
+    resampleTaps(y, height, outHeight, &i0, &i1,
+        &table.rowWeights[2*y], &table.rowWeights[2*y+1]);
+    table.rows[2*y] = i0;
+    table.rows[2*y+1] = i1;
+  }
+
+  table.blocks.resize((outWidth + 7) / 8);
+  for (int b = 0; b < (int)table.blocks.size(); b += 1) {
+    ResampleBlock &block = table.blocks[b];
+    for (int k = 0; k < 8; k += 1) {
+      // The overhang past outWidth repeats the last pixel.
+      int x = std::min(8*b + k, outWidth - 1);
+      int i0, i1;
+      resampleTaps(x, width, outWidth, &i0, &i1, &block.w0[k], &block.w1[k]);
+      if (k == 0) {
+        block.base = i0;
+      }
+      assert(i1 - block.base < 32);
+      block.i0[k] = i0 - block.base;
+      block.i1[k] = i1 - block.base;
+    }
+  }
+}
+
+#if defined(PISLAM_NEON)
+/// Resample an image with bilinear interpolation, using the taps
+/// precomputed in `table`.
+///
+/// Image must be padded to a multiple of 16 columns. Output rows are
+/// written in blocks of 8 pixels, so vstep must be at least
+/// table.outWidth rounded up to a multiple of 8.
+///
+/// img and out may be same pointer, in which case resampling is
+/// done in place.
+///
+/// Each output row is computed in two passes. The vertical pass blends
+/// two source rows into a temporary row, which is contiguous and needs
+/// no tables. The horizontal pass then gathers the taps for every eight
+/// output pixels with vtbl from the 32 bytes starting at the block base.
+template <int vstep>
+void resample(const ResampleTable &table,
+    uint8_t img[][vstep], uint8_t out[][vstep]) {
+  const int width = table.width;
+
+  // 32 bytes of slack for the final gather.
+  std::vector<uint8_t> temp(((width + 15) & ~15) + 32);
+
+  for (int y = 0; y < table.outHeight; y += 1) {
+    const uint8_t *r0 = img[table.rows[2*y]];
+    const uint8_t *r1 = img[table.rows[2*y+1]];
+    uint8x8_t a = vdup_n_u8(table.rowWeights[2*y]);
+    uint8x8_t b = vdup_n_u8(table.rowWeights[2*y+1]);
+
+    // vertical pass
+    for (int x = 0; x < width; x += 16) {
+      uint8x16_t p0 = vld1q_u8(&r0[x]);
+      uint8x16_t p1 = vld1q_u8(&r1[x]);
+
+      uint16x8_t lo = vmull_u8(vget_low_u8(p0), a);
+      uint16x8_t hi = vmull_u8(vget_high_u8(p0), a);
+      lo = vmlal_u8(lo, vget_low_u8(p1), b);
+      hi = vmlal_u8(hi, vget_high_u8(p1), b);
+
+      vst1q_u8(&temp[x], vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+
+    // horizontal pass
+    uint8_t *out_ptr = out[y];
+    for (const ResampleBlock &block : table.blocks) {
+      uint8x16_t t0 = vld1q_u8(&temp[block.base]);
+      uint8x16_t t1 = vld1q_u8(&temp[block.base + 16]);
+      uint8x8x4_t t = {{
+        vget_low_u8(t0), vget_high_u8(t0), vget_low_u8(t1), vget_high_u8(t1)
+      }};
+
+      uint8x8_t p0 = vtbl4_u8(t, vld1_u8(block.i0));
+      uint8x8_t p1 = vtbl4_u8(t, vld1_u8(block.i1));
+
+      uint16x8_t h = vmull_u8(p0, vld1_u8(block.w0));
+      h = vmlal_u8(h, p1, vld1_u8(block.w1));
+
+      vst1_u8(out_ptr, vrshrn_n_u16(h, 8));
+      out_ptr += 8;
+    }
+  }
+}
+#endif
+
+} /* namespace pislam */
+#endif /* PISLAM_RESAMPLE_H_ */
@@ -0,0 +1,341 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_SELECT_H_
+#define PISLAM_SELECT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "OrbContext.h"
+#include "Pyramid.h"
+#include "Util.h"
+
+namespace pislam {
+
+/// Number of distinct scores held by the selected keypoint encoding.
+constexpr int keypointScoreLevels = sizeof(Keypoint) == 8 ? 4096 : 256;
+
+/// Divide `total` keypoints between the levels of a pyramid in
+/// proportion to their area, so that every level is covered with the
+/// same density of features, in the manner of ORB-SLAM's per-level
+/// feature counts.
+///
+/// Shares are rounded down and the remainder goes to the levels with
+/// the largest fractions, the lower level first on a tie, so the quotas
+/// always sum to `total`. If `available` is given, no level is given
+/// more than its available points, and the excess is divided between
+/// the other levels in the same way. The quotas then sum to the lesser
+/// of `total` and the points available.
+///
+/// Running time is O(numLevels^3), which is negligible for a pyramid.
+static inline void levelQuotas(const PyramidLevel *levels, int numLevels,
+    int total, int *quotas, const int *available = nullptr) {
+  // -1 marks a level whose quota is still open
+  for (int l = 0; l < numLevels; l += 1) {
+    quotas[l] = available && available[l] <= 0 ? 0 : -1;
+  }
+
+  int64_t remaining = std::max(total, 0);
+  for (;;) {
+    int64_t sum = 0;
+    for (int l = 0; l < numLevels; l += 1) {
+      if (quotas[l] < 0) {
+        sum += (int64_t)levels[l].width * levels[l].height;
+      }
+    }
+    if (sum == 0) {
+      break;
+    }
+
+    int64_t leftover = remaining;
+    for (int l = 0; l < numLevels; l += 1) {
+      if (quotas[l] < 0) {
+        leftover -= remaining * levels[l].width * levels[l].height / sum;
+      }
+    }
+
+    // Share of an open level, including its part of the leftover.
+    auto share = [&](int l) {
+      int64_t area = (int64_t)levels[l].width * levels[l].height;
+      int64_t fraction = remaining * area % sum;
+      int64_t rank = 0;
+      for (int m = 0; m < numLevels; m += 1) {
+        if (quotas[m] < 0) {
+          int64_t other = remaining * levels[m].width * levels[m].height % sum;
+          rank += other > fraction || (other == fraction && m < l);
+        }
+      }
+      return (int)(remaining * area / sum + (rank < leftover));
+    };
+
+    // Shares are held as -2 - share, so the levels still read as open
+    // while the rest are ranked.
+    for (int l = 0; l < numLevels; l += 1) {
+      if (quotas[l] == -1) {
+        quotas[l] = -2 - share(l);
+      }
+    }
+
+    // Close the levels which cannot fill their share and divide what
+    // remains again, or accept the shares if every level can fill them.
+    bool capped = false;
+    for (int l = 0; l < numLevels; l += 1) {
+      if (quotas[l] < -1 && available && available[l] <= -2 - quotas[l]) {
+        quotas[l] = available[l];
+        remaining -= available[l];
+        capped = true;
+      }
+    }
+    for (int l = 0; l < numLevels; l += 1) {
+      if (quotas[l] < -1) {
+        quotas[l] = capped ? -1 : -2 - quotas[l];
+      }
+    }
+    if (!capped) {
+      break;
+    }
+  }
+}
+
+/// Keep only the best `total` keypoints of a stacked pyramid, divided
+/// between the levels by levelQuotas, so that the cost of orbCompute and
+/// of everything downstream is bounded whatever the scene. Keypoints are
+/// encoded by encodeFast, with y relative to the top of the stacked
+/// pyramid, as produced by FramePipeline and OrbExtractor.
+///
+/// The best points of a level are those with the highest scores. Rather
+/// than sorting, each level is radix selected on the score: one pass
+/// counts the points of each score of each level, which gives the lowest
+/// score kept on every level, and a second pass compacts the survivors in
+/// place. Points tied on the lowest score kept are taken in input order,
+/// so the result is deterministic, and the survivors stay in input order,
+/// so orbCompute still walks the image from top to bottom.
+///
+/// Running time is O(n), plus clearing keypointScoreLevels counters per
+/// level. The counters are kept in `context`.
+static inline void selectLevels(std::vector<Keypoint> &keypoints,
+    const PyramidLevel *levels, int numLevels, int total,
+    OrbContext &context) {
+  constexpr int scores = keypointScoreLevels;
+  // histogram of each level, then the points, quota, lowest score kept
+  // and ties still to take of each level
+  int *counts = OrbContext::ensure(context.selectCounts,
+      (size_t)numLevels * (scores + 4));
+  int *available = counts + (size_t)numLevels * scores;
+  int *quotas = available + numLevels;
+  int *cutoffs = quotas + numLevels;
+  int *ties = cutoffs + numLevels;
+  std::fill(counts, counts + (size_t)numLevels * (scores + 1), 0);
+
+  // Level containing row y, clamped as by MatchGrid.
+  auto level = [&](int y) {
+    int l = 0;
+    while (l + 1 < numLevels && levels[l + 1].row <= y) {
+      l += 1;
+    }
+    return l;
+  };
+
+  for (Keypoint p : keypoints) {
+    int l = level(decodeFastY(p));
+    counts[l * scores + decodeFastScore(p)] += 1;
+    available[l] += 1;
+  }
+  levelQuotas(levels, numLevels, total, quotas, available);
+
+  for (int l = 0; l < numLevels; l += 1) {
+    const int *count = &counts[l * scores];
+    int kept = 0;
+    int s = scores;
+    while (s > 0 && kept + count[s - 1] < quotas[l]) {
+      kept += count[--s];
+    }
+    // Every point scoring above s - 1 is kept, and the first
+    // quota - kept points scoring s - 1.
+    cutoffs[l] = s - 1;
+    ties[l] = quotas[l] - kept;
+  }
+
+  size_t n = 0;
+  for (Keypoint p : keypoints) {
+    int l = level(decodeFastY(p));
+    int score = decodeFastScore(p);
+    if (score > cutoffs[l] || (score == cutoffs[l] && ties[l]-- > 0)) {
+      keypoints[n++] = p;
+    }
+  }
+  keypoints.resize(n);
+}
+
+/// As above, with the counters allocated for the call.
+static inline void selectLevels(std::vector<Keypoint> &keypoints,
+    const PyramidLevel *levels, int numLevels, int total) {
+  OrbContext context;
+  selectLevels(keypoints, levels, numLevels, total, context);
+}
+
+/// Greedy square covering of one level for distributeLevels. Points are
+/// visited in `order`, best first, on a grid of cells of half the radius.
+/// A point is kept if its cell is not yet covered, and then covers every
+/// cell within `radius` of its own. Stops once `limit` points are kept,
+/// marking them in `keep` if given, and returns how many were kept.
+static inline int distributeCover(const std::vector<Keypoint> &keypoints,
+    const uint32_t *order, int n, const PyramidLevel &level, int radius,
+    int limit, uint8_t *covered, uint8_t *keep) {
+  const int cell = std::max(radius / 2, 1);
+  const int reach = radius / cell;
+  const int columns = (level.width + cell - 1) / cell;
+  const int rows = (level.height + cell - 1) / cell;
+  std::fill(covered, covered + (size_t)columns * rows, 0);
+
+  int kept = 0;
+  for (int i = 0; i < n && kept < limit; i += 1) {
+    Keypoint p = keypoints[order[i]];
+    const int cx = std::min((int)decodeFastX(p) / cell, columns - 1);
+    const int cy = std::min(std::max((int)decodeFastY(p) - level.row, 0) / cell,
+        rows - 1);
+    if (covered[cy * columns + cx]) {
+      continue;
+    }
+    kept += 1;
+    if (keep) {
+      keep[order[i]] = 1;
+    }
+    const int x0 = std::max(cx - reach, 0);
+    const int x1 = std::min(cx + reach, columns - 1);
+    for (int y = std::max(cy - reach, 0); y <= std::min(cy + reach, rows - 1);
+        y += 1) {
+      std::fill(&covered[y * columns + x0], &covered[y * columns + x1 + 1], 1);
+    }
+  }
+  return kept;
+}
+
+/// Keep `total` keypoints of a stacked pyramid that are both strong and
+/// spread evenly over each level, by Suppression via Square Covering
+/// (Bailo et al., 2018). Unlike the buckets of fastExtract, which only
+/// limit the points of each small region, this has a view of the whole
+/// level, so textured regions cannot crowd out sparse ones, and fewer
+/// features are needed for the same coverage.
+///
+/// The budget is divided between the levels by levelQuotas. Each level
+/// is covered greedily from its best point down, every kept point
+/// suppressing the others within a radius, and the radius is binary
+/// searched for the largest that still yields the quota. Exactly the
+/// quota is kept, taking the best points if the covering yields more, so
+/// the result holds the lesser of `total` and the points available.
+/// Points stay in input order, as for selectLevels.
+///
+/// Running time is O(n log n) for sorting the points by score, plus
+/// O(log(width) * (n + cells)) for the search. Point order, covering
+/// grid and flags are flat arrays kept in `context`, so nothing is
+/// allocated per node or, once grown, per frame.
+static inline void distributeLevels(std::vector<Keypoint> &keypoints,
+    const PyramidLevel *levels, int numLevels, int total,
+    OrbContext &context) {
+  const int n = keypoints.size();
+  int *counts = OrbContext::ensure(context.selectCounts,
+      (size_t)numLevels * 3 + 1);
+  int *available = counts;
+  int *quotas = available + numLevels;
+  int *firsts = quotas + numLevels;
+  uint32_t *order = OrbContext::ensure(context.distributeOrder,
+      (size_t)n + 1);
+  uint8_t *levelOf = OrbContext::ensure(context.distributeFlags,
+      2 * (size_t)n + 1);
+  uint8_t *keep = levelOf + n;
+
+  // Level containing row y, clamped as by MatchGrid.
+  auto level = [&](int y) {
+    int l = 0;
+    while (l + 1 < numLevels && levels[l + 1].row <= y) {
+      l += 1;
+    }
+    return l;
+  };
+
+  std::fill(available, available + numLevels, 0);
+  for (int i = 0; i < n; i += 1) {
+    levelOf[i] = level(decodeFastY(keypoints[i]));
+    available[levelOf[i]] += 1;
+    order[i] = i;
+    keep[i] = 0;
+  }
+  levelQuotas(levels, numLevels, total, quotas, available);
+
+  // By level, then best first. Encodings order by score, then position.
+  std::sort(order, order + n, [&](uint32_t a, uint32_t b) {
+    return levelOf[a] != levelOf[b] ? levelOf[a] < levelOf[b] :
+      keypoints[a] > keypoints[b];
+  });
+
+  for (int l = 0, first = 0; l < numLevels; first += available[l], l += 1) {
+    firsts[l] = first;
+  }
+  for (int l = 0; l < numLevels; l += 1) {
+    const PyramidLevel &lev = levels[l];
+    const uint32_t *levelOrder = order + firsts[l];
+    const int count = available[l];
+    if (quotas[l] >= count) {
+      for (int i = 0; i < count; i += 1) {
+        keep[levelOrder[i]] = 1;
+      }
+      continue;
+    }
+    if (quotas[l] == 0) {
+      continue;
+    }
+
+    uint8_t *covered = OrbContext::ensure(context.distributeCells,
+        (size_t)lev.width * lev.height);
+    // A radius of zero keeps every point, so the search always succeeds.
+    int lo = 0, hi = std::max(lev.width, lev.height);
+    while (lo < hi) {
+      int mid = (lo + hi + 1) / 2;
+      if (distributeCover(keypoints, levelOrder, count, lev, mid, quotas[l],
+            covered, nullptr) >= quotas[l]) {
+        lo = mid;
+      } else {
+        hi = mid - 1;
+      }
+    }
+    distributeCover(keypoints, levelOrder, count, lev, lo, quotas[l],
+        covered, keep);
+  }
+
+  int kept = 0;
+  for (int i = 0; i < n; i += 1) {
+    if (keep[i]) {
+      keypoints[kept++] = keypoints[i];
+    }
+  }
+  keypoints.resize(kept);
+}
+
+/// As above, with the scratch memory allocated for the call.
+static inline void distributeLevels(std::vector<Keypoint> &keypoints,
+    const PyramidLevel *levels, int numLevels, int total) {
+  OrbContext context;
+  distributeLevels(keypoints, levels, numLevels, total, context);
+}
+
+} /* namespace pislam */
+#endif /* PISLAM_SELECT_H_ */
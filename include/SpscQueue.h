@@ -0,0 +1,100 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_SPSC_QUEUE_H_
+#define PISLAM_SPSC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace pislam {
+
+/// A bounded, lock-free queue between exactly one producer thread and
+/// exactly one consumer thread.
+///
+/// Storage is allocated once by the constructor. Head and tail are
+/// padded onto separate cache lines, so the producer and consumer only
+/// share a line when the queue is empty or full.
+template <typename T>
+class SpscQueue {
+ public:
+  /// Capacity is rounded up to a power of two.
+  explicit SpscQueue(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+      size *= 2;
+    }
+    ring.resize(size);
+    mask = size - 1;
+  }
+
+  SpscQueue(const SpscQueue &) = delete;
+  SpscQueue &operator=(const SpscQueue &) = delete;
+
+  size_t capacity() const {
+    return ring.size();
+  }
+
+  /// Number of items in the queue. Exact when called by the producer or
+  /// consumer, otherwise a snapshot. `head` is loaded first: both only
+  /// grow, so the difference is never negative, though from a third
+  /// thread it can overshoot and is clamped to the capacity.
+  size_t size() const {
+    size_t h = head.load(std::memory_order_acquire);
+    size_t t = tail.load(std::memory_order_acquire);
+    return std::min(t - h, ring.size());
+  }
+
+  /// Append an item. Returns false if the queue is full. Producer only.
+  bool push(const T &item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == ring.size()) {
+      return false;
+    }
+    ring[t & mask] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Remove the oldest item. Returns false if the queue is empty.
+  /// Consumer only.
+  bool pop(T &item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = ring[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  std::vector<T> ring;
+  size_t mask;
+
+  char pad0[64];
+  std::atomic<size_t> head{0};
+  char pad1[64];
+  std::atomic<size_t> tail{0};
+};
+
+} /* namespace pislam */
+#endif /* PISLAM_SPSC_QUEUE_H_ */
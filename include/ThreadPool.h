@@ -0,0 +1,216 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#ifndef PISLAM_THREAD_POOL_H_
+#define PISLAM_THREAD_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace pislam {
+
+/// A fixed pool of worker threads with work stealing.
+///
+/// Every thread owns a bounded queue of tasks. Tasks pushed from a worker
+/// go onto its own queue and are popped from the back, so a worker
+/// continues on the data it just touched. Idle workers steal from the
+/// front of the other queues, taking the oldest and usually largest
+/// piece of work. The thread calling `wait` owns one more queue and
+/// executes tasks alongside the workers.
+///
+/// Tasks are a function pointer, a context pointer and an index, so
+/// pushing a task never allocates. If a queue is full the task is run
+/// immediately by the pushing thread.
+class ThreadPool {
+ public:
+  typedef void (*TaskFn)(void *context, int index);
+
+  /// Start `workers` threads in addition to the caller. Zero workers is
+  /// valid, in which case every task runs on the thread calling `wait`.
+  explicit ThreadPool(int workers, int capacity = 1024)
+      : queues(workers + 1) {
+    for (Queue &queue : queues) {
+      queue.ring.resize(capacity);
+    }
+    for (int i = 0; i < workers; i += 1) {
+      threads.emplace_back(&ThreadPool::work, this, i);
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stop = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /// Number of threads executing tasks, including the caller of `wait`.
+  int size() const {
+    return queues.size();
+  }
+
+  /// Queue `fn(context, index)`. May be called from within a task.
+  void push(TaskFn fn, void *context, int index) {
+    pending += 1;
+
+    Queue &queue = queues[self()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.tail - queue.head < queue.ring.size()) {
+        queue.ring[queue.tail % queue.ring.size()] = {fn, context, index};
+        queue.tail += 1;
+        fn = nullptr;
+      }
+    }
+
+    if (fn == nullptr) {
+      {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queued += 1;
+      }
+      wake.notify_one();
+    } else {
+      fn(context, index);
+      pending -= 1;
+    }
+  }
+
+  /// Execute tasks until every task pushed so far, and every task those
+  /// push in turn, has completed. Must not be called from within a task.
+  void wait() {
+    Task task;
+    while (pending.load() != 0) {
+      if (pop(int(threads.size()), task)) {
+        run(task);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+ private:
+  struct Task {
+    TaskFn fn;
+    void *context;
+    int index;
+  };
+
+  struct Queue {
+    std::mutex mutex;
+    std::vector<Task> ring;
+    size_t head = 0;
+    size_t tail = 0;
+  };
+
+  /// Index of the calling thread's queue. Threads outside the pool
+  /// share the last queue.
+  int self() const {
+    return current() == this ? currentIndex() : int(threads.size());
+  }
+
+  static const ThreadPool *&current() {
+    static thread_local const ThreadPool *pool = nullptr;
+    return pool;
+  }
+
+  static int &currentIndex() {
+    static thread_local int index = 0;
+    return index;
+  }
+
+  bool pop(int index, Task &task) {
+    // own queue, newest first
+    {
+      Queue &queue = queues[index];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.head != queue.tail) {
+        queue.tail -= 1;
+        task = queue.ring[queue.tail % queue.ring.size()];
+        return true;
+      }
+    }
+    // steal, oldest first
+    for (size_t i = 1; i < queues.size(); i += 1) {
+      Queue &queue = queues[(index + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.head != queue.tail) {
+        task = queue.ring[queue.head % queue.ring.size()];
+        queue.head += 1;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(const Task &task) {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      queued -= 1;
+    }
+    task.fn(task.context, task.index);
+    pending -= 1;
+  }
+
+  void work(int index) {
+    current() = this;
+    currentIndex() = index;
+
+    Task task;
+    for (;;) {
+      if (pop(index, task)) {
+        run(task);
+        continue;
+      }
+      // Sleep until woken by push, re-checking the queues periodically.
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait_for(lock, std::chrono::milliseconds(10),
+          [this] { return stop || queued > 0; });
+      if (stop) {
+        return;
+      }
+    }
+  }
+
+  std::vector<Queue> queues;
+  std::vector<std::thread> threads;
+
+  /// Tasks pushed but not yet completed.
+  std::atomic<int> pending{0};
+
+  /// Tasks sitting in a queue, guarded by sleepMutex.
+  int queued = 0;
+  bool stop = false;
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+};
+
+} /* namespace pislam */
+#endif /* PISLAM_THREAD_POOL_H_ */
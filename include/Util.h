@@ -24,25 +24,129 @@
 
 namespace pislam {
 
-static inline uint32_t encodeFast(uint32_t score, uint32_t x, uint32_t y) {
+// Keypoints are passed between stages packed into one integer, ordered
+// by score, then x, then y, so that comparing encodings compares points.
+//
+// The 32 bit encoding, score << 24 | x << 12 | y, limits x and y to 4095
+// and the score to 8 bits. It is enough for a VGA pyramid and is the
+// default. Defining PISLAM_KEYPOINT64 selects the 64 bit encoding for
+// every stage instead, for larger sensors:
+//
+//   bits 52..63  score, 12 bits
+//   bits 36..51  x, 16 bits
+//   bits 20..35  y, 16 bits, so a stacked pyramid of up to 65535 rows
+//   bits 16..19  pyramid level
+//   bits  8..15  angle
+//   bits  4..7   subpixel x offset, in 1/16 pixel
+//   bits  0..3   subpixel y offset, in 1/16 pixel
+//
+// Both encodings can be decoded in any build, as the decode functions
+// are overloaded on the width of the encoding. Fields the 32 bit
+// encoding does not hold decode as zero.
+#if defined(PISLAM_KEYPOINT64)
+typedef uint64_t Keypoint;
+#else
+typedef uint32_t Keypoint;
+#endif
+
+static inline uint32_t encodeFast32(uint32_t score, uint32_t x, uint32_t y) {
   return (score << 24) | (x << 12) | y;
 }
 
+static inline uint64_t encodeFast64(uint64_t score, uint64_t x, uint64_t y,
+    uint64_t level = 0, uint64_t angle = 0, uint64_t subX = 0,
+    uint64_t subY = 0) {
+  return (score << 52) | (x << 36) | (y << 20) | (level << 16) |
+    (angle << 8) | (subX << 4) | subY;
+}
+
+/// Encode a point in the selected encoding.
+static inline Keypoint encodeFast(uint32_t score, uint32_t x, uint32_t y) {
+#if defined(PISLAM_KEYPOINT64)
+  return encodeFast64(score, x, y);
+#else
+  return encodeFast32(score, x, y);
+#endif
+}
+
 static inline uint32_t rencodeFastScore(uint32_t score, uint32_t encoded) {
   return (score << 24) | (encoded & 0xffffff);
 }
 
+static inline uint64_t rencodeFastScore(uint64_t score, uint64_t encoded) {
+  return (score << 52) | (encoded & 0xfffffffffffffull);
+}
+
 static inline uint32_t decodeFastX(uint32_t encoded) {
   return (encoded >> 12) & 0xfff;
 }
 
+static inline uint32_t decodeFastX(uint64_t encoded) {
+  return (encoded >> 36) & 0xffff;
+}
+
 static inline uint32_t decodeFastY(uint32_t encoded) {
   return encoded & 0xfff;
 }
 
+static inline uint32_t decodeFastY(uint64_t encoded) {
+  return (encoded >> 20) & 0xffff;
+}
+
 static inline uint32_t decodeFastScore(uint32_t encoded) {
   return encoded >> 24;
 }
 
+static inline uint32_t decodeFastScore(uint64_t encoded) {
+  return encoded >> 52;
+}
+
+static inline uint32_t decodeFastLevel(uint32_t) {
+  return 0;
+}
+
+static inline uint32_t decodeFastLevel(uint64_t encoded) {
+  return (encoded >> 16) & 0xf;
+}
+
+static inline uint32_t decodeFastAngle(uint32_t) {
+  return 0;
+}
+
+static inline uint32_t decodeFastAngle(uint64_t encoded) {
+  return (encoded >> 8) & 0xff;
+}
+
+static inline uint32_t decodeFastSubX(uint32_t) {
+  return 0;
+}
+
+static inline uint32_t decodeFastSubX(uint64_t encoded) {
+  return (encoded >> 4) & 0xf;
+}
+
+static inline uint32_t decodeFastSubY(uint32_t) {
+  return 0;
+}
+
+static inline uint32_t decodeFastSubY(uint64_t encoded) {
+  return encoded & 0xf;
+}
+
+/// Move a point found on a pyramid level to the stacked pyramid, whose
+/// level starts at `row`. The 64 bit encoding also records the level.
+static inline uint32_t rencodeFastLevel(uint32_t encoded, uint32_t row,
+    uint32_t) {
+  return encodeFast32(decodeFastScore(encoded), decodeFastX(encoded),
+      decodeFastY(encoded) + row);
+}
+
+static inline uint64_t rencodeFastLevel(uint64_t encoded, uint32_t row,
+    uint32_t level) {
+  return encodeFast64(decodeFastScore(encoded), decodeFastX(encoded),
+      decodeFastY(encoded) + row, level, decodeFastAngle(encoded),
+      decodeFastSubX(encoded), decodeFastSubY(encoded));
+}
+
 } /* namespace pislam */
 #endif /* PISLAM_FAST_H_ */
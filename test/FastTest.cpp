@@ -0,0 +1,368 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <cmath>
+#include <random>
+
+#include "gtest/gtest.h"
+#include "../include/Fast.h"
+#include "../include/FastThreshold.h"
+#include "../include/Reference.h"
+#include "TestUtil.h"
+
+namespace {
+
+using ::testing::Combine;
+using ::testing::Range;
+using ::testing::Values;
+
+class FastTest: public ::testing::TestWithParam<::testing::tuple<int, int>> {};
+
+constexpr int border = 3;
+
+static void check(const int vstep, const int width, const int height,
+    const uint8_t *a, const uint8_t *b) {
+  int x, y;
+  if (test_util::first_divergence(vstep, border, width, height, a, b, &x, &y)) {
+    FAIL() << "first divergence at " << x << ", " << y << ": "
+      << int(a[y*vstep+x]) << " != " << int(b[y*vstep+x]);
+  }
+}
+
+TEST_P(FastTest, spiral) {
+  constexpr size_t vstep = 64;
+
+  size_t width = ::testing::get<0>(GetParam());
+  size_t height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t a[vstep*vstep];
+  uint8_t b[vstep*vstep];
+
+  test_util::fill_spiral(vstep, width, height, vstep/3, vstep/3, img);
+
+  for (int threshold : {10, 20, 40}) {
+    std::fill(a, a+vstep*vstep, 0);
+    std::fill(b, b+vstep*vstep, 0);
+
+    pislam::ref::fastDetect<vstep, border>(width, height,
+        (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])a, threshold);
+    pislam::fastDetect<vstep, border>(width, height,
+        (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])b, threshold);
+
+    check(vstep, width, height, a, b);
+  }
+}
+
+TEST_P(FastTest, random) {
+  constexpr size_t vstep = 64;
+
+  size_t width = ::testing::get<0>(GetParam());
+  size_t height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t a[vstep*vstep];
+  uint8_t b[vstep*vstep];
+
+  std::fill(img, img+vstep*vstep, 0);
+  test_util::fill_random(vstep, width, height, img);
+
+  for (int threshold : {10, 20, 40}) {
+    std::fill(a, a+vstep*vstep, 0);
+    std::fill(b, b+vstep*vstep, 0);
+
+    pislam::ref::fastDetect<vstep, border>(width, height,
+        (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])a, threshold);
+    pislam::fastDetect<vstep, border>(width, height,
+        (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])b, threshold);
+
+    check(vstep, width, height, a, b);
+  }
+}
+
+// The bit plane holds exactly the reference points inside the border.
+TEST_P(FastTest, bits) {
+  constexpr size_t vstep = 64;
+
+  size_t width = ::testing::get<0>(GetParam());
+  size_t height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t a[vstep*vstep];
+  uint64_t bits[vstep][pislam::fastBitWords(vstep)];
+
+  std::fill(img, img+vstep*vstep, 0);
+  test_util::fill_random(vstep, width, height, img);
+
+  for (int threshold : {10, 20, 40}) {
+    std::fill(a, a+vstep*vstep, 0);
+    std::fill(bits[0], bits[0] + vstep*pislam::fastBitWords(vstep),
+        ~uint64_t(0));
+
+    pislam::ref::fastDetect<vstep, border>(width, height,
+        (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])a, threshold);
+    pislam::fastDetectBits<vstep, border>(width, height,
+        (uint8_t (*)[vstep])img, bits, threshold);
+
+    for (size_t y = border; y < height - border; y += 1) {
+      for (size_t x = 0; x < vstep; x += 1) {
+        bool expected = x >= border && x < width - border && a[y*vstep+x];
+        ASSERT_EQ(expected, bool(bits[y][x / 64] >> (x % 64) & 1))
+          << "first divergence at " << x << ", " << y;
+      }
+    }
+  }
+}
+
+#if defined(PISLAM_X86)
+// Both x86 kernels must agree byte for byte, including the extra pixels
+// classified past the end of each row.
+TEST_P(FastTest, sse2Avx2) {
+  constexpr size_t vstep = 64;
+
+  if (!pislam::cpuSupportsAvx2()) {
+    return;
+  }
+
+  size_t width = ::testing::get<0>(GetParam());
+  size_t height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t a[vstep*vstep];
+  uint8_t b[vstep*vstep];
+
+  std::fill(img, img+vstep*vstep, 0);
+  test_util::fill_random(vstep, width, height, img);
+
+  std::fill(a, a+vstep*vstep, 0);
+  std::fill(b, b+vstep*vstep, 0);
+
+  pislam::fastDetectSse2<vstep, border>(width, height,
+      (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])a, 20);
+  pislam::fastDetectAvx2<vstep, border>(width, height,
+      (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])b, 20);
+
+  for (size_t i = 0; i < vstep*vstep; i += 1) {
+    ASSERT_EQ(a[i], b[i]);
+  }
+}
+#endif
+
+// Every pixel is classified with the threshold of its cell. Cells of 8
+// pixels put two thresholds in each vector of 16.
+TEST_P(FastTest, cells) {
+  constexpr size_t vstep = 64;
+  constexpr int logCellSize = 3;
+
+  size_t width = ::testing::get<0>(GetParam());
+  size_t height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t a[vstep*vstep];
+  uint8_t b[vstep*vstep];
+
+  std::fill(img, img+vstep*vstep, 0);
+  test_util::fill_random(vstep, width, height, img);
+
+  const int columns = pislam::fastCellCount<logCellSize>(width);
+  const int rows = pislam::fastCellCount<logCellSize>(height);
+  std::vector<uint8_t> thresholds(columns * rows);
+  std::mt19937 rng(width * vstep + height);
+  for (uint8_t &t : thresholds) {
+    t = 5 + rng() % 60;
+  }
+
+  std::fill(a, a+vstep*vstep, 0);
+  std::fill(b, b+vstep*vstep, 0);
+  for (size_t y = border; y < height - border; y += 1) {
+    for (size_t x = border; x < width - border; x += 1) {
+      int t = thresholds[(y >> logCellSize) * columns + (x >> logCellSize)];
+      a[y*vstep+x] = pislam::ref::fastCorner<vstep>(
+          (uint8_t (*)[vstep])img, x, y, t) ? 0xff : 0x00;
+    }
+  }
+  pislam::fastDetectCells<vstep, border, logCellSize>(width, height,
+      (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])b, thresholds.data());
+  check(vstep, width, height, a, b);
+
+#if defined(PISLAM_X86)
+  if (pislam::cpuSupportsAvx2()) {
+    std::fill(a, a+vstep*vstep, 0);
+    pislam::fastDetectCellsAvx2<vstep, border, logCellSize>(width, height,
+        (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])a, thresholds.data());
+    std::fill(b, b+vstep*vstep, 0);
+    pislam::fastDetectCellsSse2<vstep, border, logCellSize>(width, height,
+        (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])b, thresholds.data());
+    for (size_t i = 0; i < vstep*vstep; i += 1) {
+      ASSERT_EQ(a[i], b[i]);
+    }
+  }
+#endif
+}
+
+// Masked pixels are zero and every other pixel is as fastDetect.
+TEST_P(FastTest, masked) {
+  constexpr size_t vstep = 64;
+
+  size_t width = ::testing::get<0>(GetParam());
+  size_t height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t a[vstep*vstep];
+  uint8_t b[vstep*vstep];
+
+  std::fill(img, img+vstep*vstep, 0);
+  test_util::fill_random(vstep, width, height, img);
+
+  pislam::FastMask mask(width, height);
+  mask.set(0, 0, 16, 16, false);
+  mask.set(width - 1, 20, width, 30, false);
+  mask.set(0, 40, width, 41, false);
+
+  std::fill(a, a+vstep*vstep, 0);
+  pislam::ref::fastDetect<vstep, border>(width, height,
+      (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])a, 20);
+  for (size_t y = 0; y < height; y += 1) {
+    for (size_t x = 0; x < width; x += 1) {
+      if (!mask.enabled(x, y)) {
+        a[y*vstep+x] = 0;
+      }
+    }
+  }
+  std::fill(b, b+vstep*vstep, 0xff);
+  pislam::fastDetect<vstep, border>(width, height,
+      (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])b, 20, mask);
+  check(vstep, width, height, a, b);
+
+#if defined(PISLAM_X86)
+  if (pislam::cpuSupportsAvx2()) {
+    std::fill(a, a+vstep*vstep, 0);
+    pislam::fastDetectAvx2<vstep, border>(width, height,
+        (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])a, 20, mask);
+    std::fill(b, b+vstep*vstep, 0);
+    pislam::fastDetectSse2<vstep, border>(width, height,
+        (uint8_t (*)[vstep])img, (uint8_t (*)[vstep])b, 20, mask);
+    for (size_t i = 0; i < vstep*vstep; i += 1) {
+      ASSERT_EQ(a[i], b[i]);
+    }
+  }
+#endif
+}
+
+// Half of the image is busy and half is faint. One global threshold
+// finds almost everything on one side, while the adapted thresholds
+// bring nearly every cell to its target within a few frames.
+TEST(FastThresholdGridTest, converges) {
+  constexpr int vstep = 256;
+  constexpr int size = 256;
+  constexpr int target = 4;
+
+  std::vector<uint8_t> img(vstep * size);
+  std::mt19937 rng(1);
+  for (int y = 0; y < size; y += 1) {
+    for (int x = 0; x < size; x += 1) {
+      img[y*vstep + x] = x < size / 2 ? rng() % 256 : 120 + rng() % 12;
+    }
+  }
+
+  pislam::FastThresholdGrid<> grid(size, size, target);
+  std::vector<uint8_t> out(vstep * size);
+  std::vector<pislam::Keypoint> keypoints;
+  auto frame = [&]() {
+    std::fill(out.begin(), out.end(), 0);
+    pislam::fastDetectCells<vstep, 16>(size, size, (uint8_t (*)[vstep])
+        img.data(), (uint8_t (*)[vstep])out.data(), grid.thresholds());
+    pislam::fastScoreHarris<vstep, 16>(size, size, (uint8_t (*)[vstep])
+        img.data(), 0, (uint8_t (*)[vstep])out.data());
+    keypoints.clear();
+    pislam::fastExtract<vstep, 16>(size, size, (uint8_t (*)[vstep])
+        out.data(), keypoints);
+  };
+  auto near = [&]() {
+    std::vector<int> counts(grid.cellColumns() * grid.cellRows());
+    for (pislam::Keypoint p : keypoints) {
+      counts[pislam::decodeFastY(p) / 32 * grid.cellColumns() +
+        pislam::decodeFastX(p) / 32] += 1;
+    }
+    return std::count_if(counts.begin(), counts.end(), [&](int c) {
+      return target / 2 <= c && c <= 2 * target;
+    });
+  };
+
+  frame();
+  const int initialPoints = keypoints.size();
+  const int initialNear = near();
+  for (int i = 0; i < 20; i += 1) {
+    grid.update(keypoints.data(), keypoints.data() + keypoints.size());
+    frame();
+  }
+  const int cells = grid.cellColumns() * grid.cellRows();
+  ASSERT_LT(initialNear + cells / 2, near());
+  ASSERT_LT(std::abs((int)keypoints.size() - target * cells),
+      std::abs(initialPoints - target * cells));
+
+  // Thresholds settle on the faint side well below those of the busy side.
+  const uint8_t *t = grid.thresholds();
+  ASSERT_LT(3 * t[3 * grid.cellColumns() + 6], t[3 * grid.cellColumns() + 1]);
+}
+
+// Both encodings round trip every field they hold, order points by
+// score, then x, then y, and move points onto the stacked pyramid.
+TEST(KeypointTest, encodings) {
+  uint32_t a = pislam::encodeFast32(200, 4095, 17);
+  EXPECT_EQ(200u, pislam::decodeFastScore(a));
+  EXPECT_EQ(4095u, pislam::decodeFastX(a));
+  EXPECT_EQ(17u, pislam::decodeFastY(a));
+  EXPECT_EQ(0u, pislam::decodeFastLevel(a));
+  EXPECT_EQ(31u, pislam::decodeFastScore(pislam::rencodeFastScore(31u, a)));
+
+  uint64_t b = pislam::encodeFast64(4000, 3839, 5000, 7, 29, 15, 3);
+  EXPECT_EQ(4000u, pislam::decodeFastScore(b));
+  EXPECT_EQ(3839u, pislam::decodeFastX(b));
+  EXPECT_EQ(5000u, pislam::decodeFastY(b));
+  EXPECT_EQ(7u, pislam::decodeFastLevel(b));
+  EXPECT_EQ(29u, pislam::decodeFastAngle(b));
+  EXPECT_EQ(15u, pislam::decodeFastSubX(b));
+  EXPECT_EQ(3u, pislam::decodeFastSubY(b));
+  EXPECT_EQ(pislam::encodeFast64(31, 3839, 5000, 7, 29, 15, 3),
+      pislam::rencodeFastScore(uint64_t(31), b));
+
+  EXPECT_LT(pislam::encodeFast64(1, 65535, 65535),
+      pislam::encodeFast64(2, 0, 0));
+  EXPECT_LT(pislam::encodeFast64(1, 0, 65535),
+      pislam::encodeFast64(1, 1, 0));
+
+  uint32_t c = pislam::rencodeFastLevel(pislam::encodeFast32(9, 30, 40),
+      1000, 3);
+  EXPECT_EQ(pislam::encodeFast32(9, 30, 1040), c);
+  uint64_t d = pislam::rencodeFastLevel(pislam::encodeFast64(9, 30, 40),
+      4000, 3);
+  EXPECT_EQ(pislam::encodeFast64(9, 30, 4040, 3), d);
+
+  pislam::Keypoint e = pislam::encodeFast(9, 30, 40);
+  EXPECT_EQ(30u, pislam::decodeFastX(e));
+  EXPECT_EQ(40u, pislam::decodeFastY(e));
+}
+
+INSTANTIATE_TEST_CASE_P(
+    DimensionTest,
+    FastTest,
+    Combine(Range(8, 48), Range(8, 48)));
+
+} /* namespace */
@@ -0,0 +1,198 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../include/FramePipeline.h"
+#include "TestUtil.h"
+
+namespace {
+
+using ::testing::Values;
+
+class FramePipelineTest: public ::testing::TestWithParam<int> {};
+
+constexpr int vstep = 640;
+
+typedef uint8_t (*image_t)[vstep];
+typedef pislam::FramePipeline<vstep, 16, 4, 3> Pipeline;
+
+// buildPyramid followed by the serial loop from the README, and
+// selectLevels or distributeLevels if `features` is positive.
+static void serial(const pislam::PyramidLevel *levels, int rows,
+    const std::vector<uint8_t> &frame,
+    std::vector<pislam::Keypoint> &points, std::vector<uint32_t> &descriptors,
+    int features = 0, bool distribute = false) {
+  std::vector<uint8_t> img(rows * vstep);
+  std::vector<uint8_t> out(rows * vstep);
+  std::copy(frame.begin(), frame.end(), img.begin());
+  pislam::buildPyramid<vstep>(640, 480, (image_t)img.data(), (image_t)img.data());
+
+  for (int i = 0; i < pislam::pyramidLevelCount; i += 1) {
+    const pislam::PyramidLevel &level = levels[i];
+    image_t imgPtr = &((image_t)img.data())[level.row];
+    image_t outPtr = &((image_t)out.data())[level.row];
+
+    pislam::fastDetect<vstep, 16>(level.width, level.height, imgPtr, outPtr, 20);
+    pislam::fastScoreHarris<vstep, 16>(level.width, level.height, imgPtr,
+        1 << 15, outPtr);
+
+    size_t oldSize = points.size();
+    pislam::fastExtract<vstep, 16, 4, 3>(level.width, level.height,
+        outPtr, points);
+    for (auto p = points.begin() + oldSize; p < points.end(); ++p) {
+      *p = pislam::rencodeFastLevel(*p, level.row, i);
+    }
+  }
+  if (features > 0 && distribute) {
+    pislam::distributeLevels(points, levels, pislam::pyramidLevelCount,
+        features);
+  } else if (features > 0) {
+    pislam::selectLevels(points, levels, pislam::pyramidLevelCount, features);
+  }
+  pislam::orbCompute<vstep, 8>((image_t)img.data(), points, descriptors);
+}
+
+// Stream more frames than buffers through the pipeline, keeping up to
+// `depth` in flight, and compare each with the serial result.
+TEST_P(FramePipelineTest, matchesSerial) {
+  const int depth = GetParam();
+  const int count = 7;
+
+  Pipeline pipeline(640, 480, depth);
+  const int rows = pipeline.pyramidRows();
+
+  std::vector<std::vector<uint8_t>> frames(count);
+  std::vector<std::vector<pislam::Keypoint>> points(count);
+  std::vector<std::vector<uint32_t>> descriptors(count);
+  for (int i = 0; i < count; i += 1) {
+    frames[i].resize(480 * vstep);
+    test_util::fill_random(vstep, 640, 480, frames[i].data());
+    serial(pipeline.pyramid(), rows, frames[i], points[i], descriptors[i]);
+    ASSERT_LT(100u, points[i].size());
+  }
+
+  int submitted = 0, received = 0;
+  while (received < count) {
+    Pipeline::Frame *frame;
+    while (submitted < count && (frame = pipeline.acquire()) != nullptr) {
+      std::copy(frames[submitted].begin(), frames[submitted].end(),
+          &frame->img[0][0]);
+      frame->tag = submitted++;
+      pipeline.submit(frame);
+    }
+    // every frame is in flight
+    if (submitted < count) {
+      ASSERT_EQ(nullptr, pipeline.acquire());
+    }
+
+    frame = pipeline.receive();
+    ASSERT_EQ((uint64_t)received, frame->tag);
+    ASSERT_EQ(points[received], frame->keypoints);
+    ASSERT_EQ(descriptors[received], frame->descriptors);
+    pipeline.release(frame);
+    received += 1;
+  }
+  ASSERT_EQ(nullptr, pipeline.tryReceive());
+
+  for (int stage = 0; stage < Pipeline::stageCount; stage += 1) {
+    pislam::PipelineStats stats = pipeline.stats(Pipeline::Stage(stage));
+    ASSERT_EQ((uint64_t)count, stats.frames);
+    ASSERT_EQ(0u, stats.queueDepth);
+    ASSERT_LE(1u, stats.maxQueueDepth);
+    ASSERT_LE(stats.maxQueueDepth, (size_t)depth);
+    ASSERT_LE(stats.meanRunMs, stats.maxRunMs);
+  }
+}
+
+class FramePipelineFeaturesTest: public ::testing::TestWithParam<bool> {};
+
+// A feature budget bounds every frame to its best or best spread points.
+TEST_P(FramePipelineFeaturesTest, selectsLevels) {
+  const int features = 300;
+  const bool distribute = GetParam();
+  Pipeline pipeline(640, 480, Pipeline::stageCount + 1, 20, 1 << 15, 4096,
+      features, distribute);
+
+  std::vector<uint8_t> frame(480 * vstep);
+  test_util::fill_random(vstep, 640, 480, frame.data());
+  std::vector<pislam::Keypoint> points;
+  std::vector<uint32_t> descriptors;
+  serial(pipeline.pyramid(), pipeline.pyramidRows(), frame, points,
+      descriptors, features, distribute);
+  ASSERT_EQ((size_t)features, points.size());
+
+  Pipeline::Frame *f = pipeline.acquire();
+  std::copy(frame.begin(), frame.end(), &f->img[0][0]);
+  pipeline.submit(f);
+  f = pipeline.receive();
+  ASSERT_EQ(points, f->keypoints);
+  ASSERT_EQ(descriptors, f->descriptors);
+  pipeline.release(f);
+}
+
+// Adaptive thresholds start at the global one, so the first frame is
+// unchanged, and then move the count of a busy frame towards the target.
+TEST(FramePipelineCellsTest, adaptsThresholds) {
+  const int cellTarget = 1;
+  Pipeline pipeline(640, 480, Pipeline::stageCount + 1, 20, 1 << 15, 4096,
+      0, false, cellTarget);
+
+  std::vector<uint8_t> frame(480 * vstep);
+  test_util::fill_random(vstep, 640, 480, frame.data());
+  std::vector<pislam::Keypoint> points;
+  std::vector<uint32_t> descriptors;
+  serial(pipeline.pyramid(), pipeline.pyramidRows(), frame, points,
+      descriptors);
+
+  std::vector<size_t> counts;
+  for (int i = 0; i < 8; i += 1) {
+    Pipeline::Frame *f = pipeline.acquire();
+    std::copy(frame.begin(), frame.end(), &f->img[0][0]);
+    pipeline.submit(f);
+    f = pipeline.receive();
+    if (i == 0) {
+      ASSERT_EQ(points, f->keypoints);
+    }
+    counts.push_back(f->keypoints.size());
+    pipeline.release(f);
+  }
+
+  size_t cells = 0;
+  for (int l = 0; l < pislam::pyramidLevelCount; l += 1) {
+    const pislam::PyramidLevel &level = pipeline.pyramid()[l];
+    cells += (size_t)((level.width + 31) / 32) * ((level.height + 31) / 32);
+  }
+  ASSERT_LT(cells * cellTarget, counts[0]);
+  ASSERT_LT(counts.back(), counts[0] / 2);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    DepthTest,
+    FramePipelineTest,
+    Values(1, 2, 4));
+
+INSTANTIATE_TEST_CASE_P(
+    DistributeTest,
+    FramePipelineFeaturesTest,
+    Values(false, true));
+
+} /* namespace */
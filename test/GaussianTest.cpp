@@ -22,6 +22,7 @@
 
 #include "gtest/gtest.h"
 #include "../include/Gaussian.h"
+#include "../include/Reference.h"
 
 namespace {
 
@@ -29,13 +30,8 @@ using ::testing::Combine;
 using ::testing::Range;
 using ::testing::Values;
 
-#define RHADD(a, b) ((a >> 1) + (b >> 1) + ((a|b)&1))
-
 class GaussianTest: public ::testing::TestWithParam<::testing::tuple<int, int>> {};
 
-static void reference(const int vstep, const int width,
-    const int height, uint8_t *m);
-
 TEST_P(GaussianTest, spiral) {
   constexpr size_t vstep = 640;
 
@@ -73,7 +69,8 @@ TEST_P(GaussianTest, spiral) {
   std::copy(spiral, spiral+height*vstep, a);
   std::copy(spiral, spiral+height*vstep, b);
 
-  reference(vstep, width, height, a);
+  pislam::ref::gaussian5x5<vstep>(width, height,
+      (uint8_t (*)[vstep])a, (uint8_t (*)[vstep])a);
   pislam::gaussian5x5<vstep>(width, height,
       (uint8_t (*)[vstep])b, (uint8_t (*)[vstep])b);
 
@@ -138,7 +135,8 @@ TEST_P(GaussianTest, random) {
 
   std::copy(a, a+vstep*vstep, b);
 
-  reference(vstep, width, height, a);
+  pislam::ref::gaussian5x5<vstep>(width, height,
+      (uint8_t (*)[vstep])a, (uint8_t (*)[vstep])a);
   pislam::gaussian5x5<vstep>(width, height,
       (uint8_t (*)[vstep])b, (uint8_t (*)[vstep])b);
 
@@ -156,62 +154,4 @@ INSTANTIATE_TEST_CASE_P(
     Combine(Range(16, 64), Range(16, 64)));
     //Combine(Values(640), Values(480)));
 
-static void reference(const int vstep, const int width,
-    const int height, uint8_t *m) {
-
-  // vertical pass
-  for (int j = 0; j < width; j += 1) {
-    uint8_t a, b, c, d, e;
-    a = m[2*vstep+j];
-    b = m[1*vstep+j];
-    c = m[0*vstep+j];
-    d = m[1*vstep+j];
-    for (int i = 0; i < height; i += 1) {
-      if (i == height - 2) {
-        e = c;
-      } else if (i == height - 1) {
-        e = a;
-      } else {
-        e = m[(i+2)*vstep+(j)];
-      }
-
-      uint8_t x = RHADD(a, e);
-      uint8_t y = RHADD(b, d);
-      x = RHADD(x, c);
-      x = RHADD(x, c);
-
-      m[(i)*vstep+(j)] = RHADD(x, y);
-
-      a = b; b = c; c = d; d = e;
-    }
-  }
-
-  // horizontal pass
-  for (int i = 0; i < height; i += 1) {
-    uint8_t a, b, c, d, e;
-    a = m[i*vstep+2];
-    b = m[i*vstep+1];
-    c = m[i*vstep+0];
-    d = m[i*vstep+1];
-    for (int j = 0; j < width; j += 1) {
-      if (j == width - 2) {
-        e = c;
-      } else if (j == width - 1) {
-        e = a;
-      } else {
-        e = m[(i)*vstep+(j+2)];
-      }
-
-      uint8_t x = RHADD(a, e);
-      uint8_t y = RHADD(b, d);
-      x = RHADD(x, c);
-      x = RHADD(x, c);
-
-      m[(i)*vstep+(j)] = RHADD(x, y);
-
-      a = b; b = c; c = d; d = e;
-    }
-  }
-}
-
 } /* namespace */
@@ -0,0 +1,186 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../include/MatchGrid.h"
+#include "../include/Reference.h"
+
+namespace {
+
+using ::testing::Combine;
+using ::testing::Values;
+
+class MatchGridTest: public ::testing::TestWithParam<::testing::tuple<int, int>> {};
+
+struct Frame {
+  std::vector<pislam::Keypoint> keypoints;
+  std::vector<uint32_t> descriptors;
+};
+
+// Keypoints inside the border of random levels of a 640x480 pyramid.
+// Descriptors are drawn from a small pool with noise, so that near and
+// distant keypoints often have similar descriptors.
+static Frame makeFrame(const pislam::PyramidLevel *levels, int count,
+    std::mt19937 &rng, const std::vector<uint32_t> &pool) {
+  const int w = pislam::matchWords;
+  const int poolSize = pool.size() / w;
+  Frame frame;
+  for (int i = 0; i < count; i += 1) {
+    const pislam::PyramidLevel &level = levels[rng() % pislam::pyramidLevelCount];
+    int x = 16 + rng() % (level.width - 32);
+    int y = level.row + 16 + rng() % (level.height - 32);
+    frame.keypoints.push_back(pislam::encodeFast(rng() % 256, x, y));
+
+    int source = rng() % poolSize;
+    for (int k = 0; k < w; k += 1) {
+      frame.descriptors.push_back(pool[source*w + k] ^ (rng() & rng() & rng()));
+    }
+  }
+  return frame;
+}
+
+// Nearest by exhaustive search over the keypoints in the window.
+static pislam::NearestMatch bruteForce(const pislam::MatchGrid &grid,
+    const Frame &train, const uint32_t *descriptor, pislam::Keypoint position,
+    int radius) {
+  const int w = pislam::matchWords;
+  int x = pislam::decodeFastX(position);
+  int y = pislam::decodeFastY(position);
+
+  std::vector<uint32_t> candidates;
+  std::vector<int> indices;
+  for (size_t j = 0; j < train.keypoints.size(); j += 1) {
+    pislam::Keypoint p = train.keypoints[j];
+    int px = pislam::decodeFastX(p);
+    int py = pislam::decodeFastY(p);
+    if (std::abs(px - x) <= radius && std::abs(py - y) <= radius &&
+        grid.level(py) == grid.level(y)) {
+      candidates.insert(candidates.end(), &train.descriptors[j*w],
+          &train.descriptors[(j+1)*w]);
+      indices.push_back(j);
+    }
+  }
+
+  pislam::NearestMatch m;
+  pislam::ref::matchNearest(descriptor, 1, candidates.data(), indices.size(), &m);
+  if (m.train >= 0) {
+    m.train = indices[m.train];
+  }
+  return m;
+}
+
+TEST_P(MatchGridTest, nearest) {
+  const int cellSize = ::testing::get<0>(GetParam());
+  const int radius = ::testing::get<1>(GetParam());
+  const int w = pislam::matchWords;
+
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  pislam::pyramidLevels(640, 480, levels);
+
+  std::mt19937 rng(cellSize * 1000 + radius);
+  std::vector<uint32_t> pool(20 * w);
+  for (uint32_t &word : pool) {
+    word = rng();
+  }
+
+  pislam::MatchGrid grid(levels, pislam::pyramidLevelCount, cellSize);
+
+  // rebuilding with different sizes reuses the grid
+  for (int count : {1000, 0, 300}) {
+    Frame train = makeFrame(levels, count, rng, pool);
+    Frame query = makeFrame(levels, 200, rng, pool);
+    grid.build(train.keypoints, train.descriptors);
+
+    for (size_t i = 0; i < query.keypoints.size(); i += 1) {
+      // own position, and a predicted position nearby
+      pislam::Keypoint p = query.keypoints[i];
+      pislam::Keypoint shifted = pislam::encodeFast(0,
+          pislam::decodeFastX(p) + 7, pislam::decodeFastY(p) - 5);
+      for (pislam::Keypoint position : {p, shifted}) {
+        pislam::NearestMatch a = bruteForce(grid, train,
+            &query.descriptors[i*w], position, radius);
+        pislam::NearestMatch b = grid.nearest(&query.descriptors[i*w],
+            position, radius);
+        ASSERT_EQ(a.train, b.train) << "query " << i;
+        ASSERT_EQ(a.distance, b.distance) << "query " << i;
+        ASSERT_EQ(a.second, b.second) << "query " << i;
+      }
+    }
+  }
+}
+
+TEST_P(MatchGridTest, matchRadius) {
+  const int cellSize = ::testing::get<0>(GetParam());
+  const int radius = ::testing::get<1>(GetParam());
+  const int w = pislam::matchWords;
+
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  pislam::pyramidLevels(640, 480, levels);
+
+  std::mt19937 rng(cellSize * 1000 + radius);
+  std::vector<uint32_t> pool(50 * w);
+  for (uint32_t &word : pool) {
+    word = rng();
+  }
+
+  Frame train = makeFrame(levels, 1000, rng, pool);
+  Frame query = makeFrame(levels, 1000, rng, pool);
+
+  pislam::MatchGrid grid(levels, pislam::pyramidLevelCount, cellSize);
+  grid.build(train.keypoints, train.descriptors);
+
+  std::vector<pislam::Keypoint> predicted;
+  for (pislam::Keypoint p : query.keypoints) {
+    predicted.push_back(pislam::encodeFast(0, pislam::decodeFastX(p) + 3,
+          pislam::decodeFastY(p)));
+  }
+
+  for (const pislam::Keypoint *prediction : {(const pislam::Keypoint *)nullptr,
+      (const pislam::Keypoint *)predicted.data()}) {
+    std::vector<pislam::Match> matches;
+    pislam::matchRadius(query.keypoints, query.descriptors, grid, radius,
+        matches, 0.9f, 60, prediction);
+
+    size_t n = 0;
+    for (size_t i = 0; i < query.keypoints.size(); i += 1) {
+      pislam::Keypoint position = prediction ? prediction[i] : query.keypoints[i];
+      pislam::NearestMatch m = bruteForce(grid, train,
+          &query.descriptors[i*w], position, radius);
+      if (m.train >= 0 && m.distance <= 60 && m.distance < 0.9f * m.second) {
+        ASSERT_LT(n, matches.size());
+        ASSERT_EQ((int)i, matches[n].query);
+        ASSERT_EQ(m.train, matches[n].train);
+        ASSERT_EQ(m.distance, matches[n].distance);
+        n += 1;
+      }
+    }
+    ASSERT_EQ(n, matches.size());
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    CellTest,
+    MatchGridTest,
+    Combine(Values(8, 16, 40), Values(0, 5, 20, 100)));
+
+} /* namespace */
@@ -0,0 +1,148 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../include/Match.h"
+#include "../include/Reference.h"
+
+namespace {
+
+using ::testing::Combine;
+using ::testing::Values;
+
+class MatchTest: public ::testing::TestWithParam<::testing::tuple<int, int>> {};
+
+typedef void (*NearestFn)(const uint32_t *, int, const uint32_t *, int,
+    pislam::NearestMatch *);
+
+// Train descriptors are random with some duplicates, to exercise tie
+// breaking. Queries are noisy copies of train descriptors or random.
+static void makeDescriptors(int queryCount, int trainCount,
+    std::vector<uint32_t> &query, std::vector<uint32_t> &train) {
+  std::mt19937 rng(queryCount * 1000 + trainCount);
+  const int w = pislam::matchWords;
+
+  train.resize(trainCount * w);
+  for (int j = 0; j < trainCount; j += 1) {
+    for (int k = 0; k < w; k += 1) {
+      train[j*w + k] = j % 5 == 4 ? train[(j-1)*w + k] : rng();
+    }
+  }
+
+  query.resize(queryCount * w);
+  for (int i = 0; i < queryCount; i += 1) {
+    for (int k = 0; k < w; k += 1) {
+      query[i*w + k] = rng();
+    }
+    if (trainCount > 0 && i % 3 != 2) {
+      int j = rng() % trainCount;
+      for (int k = 0; k < w; k += 1) {
+        query[i*w + k] = train[j*w + k];
+      }
+      for (int flips = rng() % 40; flips > 0; flips -= 1) {
+        int bit = rng() % (32 * w);
+        query[i*w + bit/32] ^= 1u << (bit % 32);
+      }
+    }
+  }
+}
+
+static void checkNearest(NearestFn fn, int queryCount, int trainCount) {
+  std::vector<uint32_t> query, train;
+  makeDescriptors(queryCount, trainCount, query, train);
+
+  std::vector<pislam::NearestMatch> a(queryCount), b(queryCount);
+  pislam::ref::matchNearest(query.data(), queryCount,
+      train.data(), trainCount, a.data());
+  fn(query.data(), queryCount, train.data(), trainCount, b.data());
+
+  for (int i = 0; i < queryCount; i += 1) {
+    ASSERT_EQ(a[i].train, b[i].train) << "query " << i;
+    ASSERT_EQ(a[i].distance, b[i].distance) << "query " << i;
+    ASSERT_EQ(a[i].second, b[i].second) << "query " << i;
+  }
+}
+
+TEST_P(MatchTest, nearest) {
+  int queryCount = ::testing::get<0>(GetParam());
+  int trainCount = ::testing::get<1>(GetParam());
+
+  checkNearest(pislam::matchNearest, queryCount, trainCount);
+  checkNearest(pislam::matchNearestScalar, queryCount, trainCount);
+#if defined(PISLAM_NEON)
+  checkNearest(pislam::matchNearestNeon, queryCount, trainCount);
+#endif
+#if defined(PISLAM_X86)
+  if (pislam::cpuSupportsPopcnt()) {
+    checkNearest(pislam::matchNearestPopcnt, queryCount, trainCount);
+  }
+  if (pislam::cpuSupportsAvx2()) {
+    checkNearest(pislam::matchNearestAvx2, queryCount, trainCount);
+  }
+#endif
+}
+
+TEST_P(MatchTest, match) {
+  int queryCount = ::testing::get<0>(GetParam());
+  int trainCount = ::testing::get<1>(GetParam());
+
+  std::vector<uint32_t> query, train;
+  makeDescriptors(queryCount, trainCount, query, train);
+
+  std::vector<pislam::NearestMatch> forward(queryCount), reverse(trainCount);
+  pislam::ref::matchNearest(query.data(), queryCount,
+      train.data(), trainCount, forward.data());
+  pislam::ref::matchNearest(train.data(), trainCount,
+      query.data(), queryCount, reverse.data());
+
+  for (float ratio : {0.7f, 1.0f}) {
+    for (bool crossCheck : {false, true}) {
+      for (int maxDistance : {30, 256}) {
+        std::vector<pislam::Match> matches;
+        pislam::match(query, train, matches, ratio, crossCheck, maxDistance);
+
+        size_t n = 0;
+        for (int i = 0; i < queryCount; i += 1) {
+          const pislam::NearestMatch &m = forward[i];
+          bool accept = m.train >= 0 && m.distance <= maxDistance &&
+            (ratio >= 1 || m.distance < ratio * m.second) &&
+            (!crossCheck || reverse[m.train].train == i);
+          if (accept) {
+            ASSERT_LT(n, matches.size());
+            ASSERT_EQ(i, matches[n].query);
+            ASSERT_EQ(m.train, matches[n].train);
+            ASSERT_EQ(m.distance, matches[n].distance);
+            n += 1;
+          }
+        }
+        ASSERT_EQ(n, matches.size());
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    CountTest,
+    MatchTest,
+    Combine(Values(0, 1, 3, 4, 5, 61), Values(0, 1, 2, 7, 64)));
+
+} /* namespace */
@@ -0,0 +1,107 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../include/OrbExtractor.h"
+#include "TestUtil.h"
+
+namespace {
+
+using ::testing::Combine;
+using ::testing::Values;
+
+class OrbExtractorTest: public ::testing::TestWithParam<
+    ::testing::tuple<int, int>> {};
+
+constexpr int vstep = 640;
+
+typedef uint8_t (*image_t)[vstep];
+
+// The serial loop from the README.
+template <int logBucketSize>
+static void serial(const pislam::PyramidLevel *levels, uint8_t *img,
+    std::vector<pislam::Keypoint> &points, std::vector<uint32_t> &descriptors) {
+  std::vector<uint8_t> out(levels[7].row * vstep + levels[7].height * vstep);
+
+  for (int i = 0; i < 8; i += 1) {
+    const pislam::PyramidLevel &level = levels[i];
+    image_t imgPtr = &((image_t)img)[level.row];
+    image_t outPtr = &((image_t)out.data())[level.row];
+
+    pislam::fastDetect<vstep, 16>(level.width, level.height, imgPtr, outPtr, 20);
+    pislam::fastScoreHarris<vstep, 16>(level.width, level.height, imgPtr,
+        1 << 15, outPtr);
+
+    size_t oldSize = points.size();
+    pislam::fastExtract<vstep, 16, logBucketSize, 3>(level.width, level.height,
+        outPtr, points);
+    for (auto p = points.begin() + oldSize; p < points.end(); ++p) {
+      *p = pislam::rencodeFastLevel(*p, level.row, i);
+    }
+  }
+  pislam::orbCompute<vstep, 8>((image_t)img, points, descriptors);
+}
+
+template <int logBucketSize>
+static void check(int workers, int stripRows) {
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  int rows = pislam::pyramidLevels(640, 480, levels);
+
+  std::vector<uint8_t> img(rows * vstep);
+  test_util::fill_random(vstep, 640, 480, img.data());
+  pislam::buildPyramid<vstep>(640, 480, (image_t)img.data(), (image_t)img.data());
+
+  std::vector<pislam::Keypoint> a;
+  std::vector<uint32_t> da;
+  serial<logBucketSize>(levels, img.data(), a, da);
+  ASSERT_LT(100u, a.size());
+
+  pislam::ThreadPool pool(workers);
+  pislam::OrbExtractor<vstep, 16, logBucketSize, 3> extractor(pool,
+      levels, pislam::pyramidLevelCount, 20, 1 << 15, stripRows);
+
+  // twice, to check that state is reset between frames
+  for (int frame = 0; frame < 2; frame += 1) {
+    std::vector<uint8_t> out(rows * vstep);
+    std::vector<pislam::Keypoint> b;
+    std::vector<uint32_t> db;
+    extractor.extract((image_t)img.data(), (image_t)out.data(), b, db);
+
+    ASSERT_EQ(a, b);
+    ASSERT_EQ(da, db);
+  }
+}
+
+TEST_P(OrbExtractorTest, noBuckets) {
+  check<0>(::testing::get<0>(GetParam()), ::testing::get<1>(GetParam()));
+}
+
+TEST_P(OrbExtractorTest, buckets) {
+  check<4>(::testing::get<0>(GetParam()), ::testing::get<1>(GetParam()));
+}
+
+INSTANTIATE_TEST_CASE_P(
+    WorkerTest,
+    OrbExtractorTest,
+    Combine(Values(0, 1, 3), Values(2, 30, 64, 1000)));
+
+} /* namespace */
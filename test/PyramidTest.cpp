@@ -0,0 +1,114 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../include/Pyramid.h"
+#include "../include/Reference.h"
+#include "TestUtil.h"
+
+namespace {
+
+using ::testing::Combine;
+using ::testing::Values;
+
+class PyramidTest: public ::testing::TestWithParam<::testing::tuple<int, int>> {};
+
+constexpr int vstep = 640;
+
+typedef uint8_t (*image_t)[vstep];
+
+static void check(int width, int height, const uint8_t *img) {
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  int rows = pislam::pyramidLevels(width, height, levels);
+
+  // level 0 needs 16 rows of padding, in place needs the whole pyramid
+  std::vector<uint8_t> in(std::max(rows, height + 16) * vstep);
+  std::copy(img, img + height * vstep, in.begin());
+  std::vector<uint8_t> a(rows * vstep), b(rows * vstep);
+
+  pislam::ref::buildPyramid<vstep>(width, height,
+      (image_t)in.data(), (image_t)a.data());
+  pislam::buildPyramid<vstep>(width, height,
+      (image_t)in.data(), (image_t)b.data());
+
+  for (const pislam::PyramidLevel &level : levels) {
+    for (int y = 0; y < level.height; y += 1) {
+      for (int x = 0; x < level.width; x += 1) {
+        int i = (level.row + y) * vstep + x;
+        ASSERT_EQ(a[i], b[i]) << "first divergence at " << x << ", " << y
+          << " of level " << (&level - levels);
+      }
+    }
+  }
+
+  // in place
+  pislam::buildPyramid<vstep>(width, height,
+      (image_t)in.data(), (image_t)in.data());
+  for (int y = 0; y < height; y += 1) {
+    for (int x = 0; x < width; x += 1) {
+      ASSERT_EQ(a[y*vstep+x], in[y*vstep+x]) << "at " << x << ", " << y;
+    }
+  }
+}
+
+TEST(PyramidLevels, vga) {
+  static const int expected[pislam::pyramidLevelCount][2] = {
+    {640, 480}, {520, 390}, {455, 341}, {369, 277},
+    {299, 225}, {261, 196}, {212, 159}, {172, 129}
+  };
+
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  ASSERT_EQ(2197, pislam::pyramidLevels(640, 480, levels));
+
+  int row = 0;
+  for (int i = 0; i < pislam::pyramidLevelCount; i += 1) {
+    EXPECT_EQ(expected[i][0], levels[i].width);
+    EXPECT_EQ(expected[i][1], levels[i].height);
+    EXPECT_EQ(row, levels[i].row);
+    row += levels[i].height;
+  }
+}
+
+TEST_P(PyramidTest, spiral) {
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  std::vector<uint8_t> img(vstep * vstep);
+  test_util::fill_spiral(vstep, width, height, width/3, height/3, img.data());
+  check(width, height, img.data());
+}
+
+TEST_P(PyramidTest, random) {
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  std::vector<uint8_t> img(vstep * vstep);
+  test_util::fill_random(vstep, width, height, img.data());
+  check(width, height, img.data());
+}
+
+INSTANTIATE_TEST_CASE_P(
+    DimensionTest,
+    PyramidTest,
+    Combine(Values(48, 100, 333, 640), Values(40, 77, 251, 480)));
+
+} /* namespace */
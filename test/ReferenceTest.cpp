@@ -0,0 +1,691 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <cmath>
+#include <random>
+
+#include "gtest/gtest.h"
+#include "../include/Fast.h"
+#include "../include/Brief.h"
+#include "../include/BriefTable.h"
+#include "../include/OrbSteered.h"
+#include "../include/Reference.h"
+#include "TestUtil.h"
+
+#if defined(PISLAM_NEON)
+#include "../include/Orb.h"
+#endif
+
+// Differential tests of the optimized kernels against pislam::ref.
+// Stages which are only available as NEON are tested on ARM only.
+namespace {
+
+using ::testing::Combine;
+using ::testing::Range;
+using ::testing::Values;
+
+class ReferenceTest: public ::testing::TestWithParam<::testing::tuple<int, int>> {};
+
+constexpr int vstep = 64;
+
+typedef uint8_t (*image_t)[vstep];
+
+// Image kinds fed to every stage.
+enum { SPIRAL, RANDOM, NUM_KINDS };
+
+static void fill(int kind, int width, int height, uint8_t *img) {
+  std::fill(img, img+vstep*vstep, 0);
+  if (kind == SPIRAL) {
+    test_util::fill_spiral(vstep, width, height, vstep/3, vstep/3, img);
+  } else {
+    test_util::fill_random(vstep, width, height, img);
+  }
+}
+
+template <typename T>
+static void checkVectors(const std::vector<T> &a, const std::vector<T> &b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); i += 1) {
+    ASSERT_EQ(a[i], b[i]) << "first divergence at index " << i;
+  }
+}
+
+static std::vector<pislam::Keypoint> gridPoints(int width, int height, int border) {
+  std::vector<pislam::Keypoint> points;
+  for (int y = border; y < height - border; y += 3) {
+    for (int x = border; x < width - border; x += 5) {
+      points.push_back(pislam::encodeFast(0, x, y));
+    }
+  }
+  return points;
+}
+
+TEST_P(ReferenceTest, fastExtract) {
+  constexpr int border = 3;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t out[vstep*vstep];
+
+  // reused between images, as in a frame loop
+  pislam::OrbContext context;
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    std::fill(out, out+vstep*vstep, 0);
+
+    pislam::ref::fastDetect<vstep, border>(width, height,
+        (image_t)img, (image_t)out, 10);
+    pislam::ref::fastScoreHarris<vstep, border>(width, height,
+        (image_t)img, 0, (image_t)out);
+
+    std::vector<pislam::Keypoint> a, b;
+    pislam::ref::fastExtract<vstep, border>(width, height, (image_t)out, a);
+    pislam::fastExtract<vstep, border>(width, height, (image_t)out, b);
+    checkVectors(a, b);
+
+    a.clear(); b.clear();
+    pislam::ref::fastExtract<vstep, border, 2, 3>(width, height, (image_t)out, a);
+    pislam::fastExtract<vstep, border, 2, 3>(width, height, (image_t)out, b);
+    checkVectors(a, b);
+
+    b.clear();
+    pislam::fastExtract<vstep, border, 2, 3>(width, height, (image_t)out, b,
+        context);
+    checkVectors(a, b);
+  }
+
+  // Few distinct values stress the tie breaking.
+  std::mt19937_64 rng;
+  std::fill(out, out+vstep*vstep, 0);
+  for (int i = border; i < height - border; i += 1) {
+    for (int j = border; j < width - border; j += 1) {
+      out[i*vstep+j] = rng() % 4;
+    }
+  }
+
+  std::vector<pislam::Keypoint> a, b;
+  pislam::ref::fastExtract<vstep, border>(width, height, (image_t)out, a);
+  pislam::fastExtract<vstep, border>(width, height, (image_t)out, b);
+  checkVectors(a, b);
+}
+
+// Masked scoring and extraction of a masked detection plane give the
+// unmasked results, and masked extraction of any plane emits exactly the
+// unmasked points lying in enabled pixels.
+TEST_P(ReferenceTest, fastMasked) {
+  constexpr int border = 3;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t a[vstep*vstep];
+  uint8_t b[vstep*vstep];
+  fill(RANDOM, width, height, img);
+
+  pislam::FastMask mask(width, height);
+  mask.set(0, 0, width, 10, false);
+  mask.set(20, 16, 40, 30, false);
+  mask.set(0, height - 1, 1, height, false);
+
+  std::fill(a, a+vstep*vstep, 0);
+  std::fill(b, b+vstep*vstep, 0);
+  pislam::fastDetect<vstep, border>(width, height, (image_t)img,
+      (image_t)a, 10, mask);
+  std::copy(a, a+vstep*vstep, b);
+  pislam::ref::fastScoreHarris<vstep, border>(width, height,
+      (image_t)img, 0, (image_t)a);
+  pislam::fastScoreHarris<vstep, border>(width, height,
+      (image_t)img, 0, (image_t)b, mask);
+  for (int i = 0; i < vstep*vstep; i += 1) {
+    ASSERT_EQ(a[i], b[i]) << i;
+  }
+
+  pislam::OrbContext context;
+  std::vector<pislam::Keypoint> expected, actual;
+  pislam::ref::fastExtract<vstep, border, 2, 3>(width, height, (image_t)a,
+      expected);
+  pislam::fastExtract<vstep, border, 2, 3>(width, height, (image_t)b,
+      actual, context, mask);
+  checkVectors(expected, actual);
+
+  // Unmasked scores, so points next to masked pixels are suppressed by
+  // them, but never emitted from them.
+  std::fill(a, a+vstep*vstep, 0);
+  pislam::ref::fastDetect<vstep, border>(width, height,
+      (image_t)img, (image_t)a, 10);
+  pislam::ref::fastScoreHarris<vstep, border>(width, height,
+      (image_t)img, 0, (image_t)a);
+  expected.clear();
+  actual.clear();
+  pislam::ref::fastExtract<vstep, border>(width, height, (image_t)a,
+      expected);
+  expected.erase(std::remove_if(expected.begin(), expected.end(),
+        [&](pislam::Keypoint p) {
+          return !mask.enabled(pislam::decodeFastX(p), pislam::decodeFastY(p));
+        }), expected.end());
+  pislam::fastExtract<vstep, border>(width, height, (image_t)a, actual,
+      context, mask);
+  checkVectors(expected, actual);
+}
+
+// Redetecting some cells finds exactly the points a full pass finds in
+// them, and leaves the scratch plane zero.
+TEST_P(ReferenceTest, fastRedetect) {
+  constexpr int border = 4;
+  constexpr int logCellSize = 3;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t a[vstep*vstep];
+  uint8_t b[vstep*vstep];
+
+  const int columns = pislam::fastCellCount<logCellSize>(width);
+  const int rows = pislam::fastCellCount<logCellSize>(height);
+  std::vector<uint8_t> requested(columns * rows);
+  std::mt19937 rng(width * vstep + height);
+  for (uint8_t &r : requested) {
+    r = rng() % 3 == 0;
+  }
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    std::fill(a, a+vstep*vstep, 0);
+    pislam::ref::fastDetect<vstep, border>(width, height,
+        (image_t)img, (image_t)a, 10);
+    pislam::ref::fastScoreHarris<vstep, border>(width, height,
+        (image_t)img, 0, (image_t)a);
+    std::vector<pislam::Keypoint> expected, actual;
+    pislam::ref::fastExtract<vstep, border>(width, height, (image_t)a,
+        expected);
+    expected.erase(std::remove_if(expected.begin(), expected.end(),
+          [&](pislam::Keypoint p) {
+            return !requested[(pislam::decodeFastY(p) >> logCellSize) * columns
+              + (pislam::decodeFastX(p) >> logCellSize)];
+          }), expected.end());
+
+    std::fill(b, b+vstep*vstep, 0);
+    pislam::fastRedetectHarris<vstep, border, logCellSize>(width, height,
+        (image_t)img, (image_t)b, 10, 0, requested.data(), actual);
+
+    std::sort(expected.begin(), expected.end());
+    std::sort(actual.begin(), actual.end());
+    checkVectors(expected, actual);
+    ASSERT_EQ(vstep*vstep, std::count(b, b+vstep*vstep, 0));
+  }
+}
+
+// Scores of the points set in `bits`, with every other pixel zero.
+static void bitScores(int width, int height, int border, const uint8_t *scores,
+    uint64_t (*bits)[pislam::fastBitWords(vstep)], uint8_t *out) {
+  std::fill(bits[0], bits[0] + vstep*pislam::fastBitWords(vstep), 0);
+  std::fill(out, out+vstep*vstep, 0);
+  for (int y = border; y < height - border; y += 1) {
+    for (int x = border; x < width - border; x += 1) {
+      if (scores[y*vstep+x]) {
+        bits[y][x / 64] |= uint64_t(1) << (x % 64);
+        out[y*vstep+x] = scores[y*vstep+x];
+      }
+    }
+  }
+}
+
+TEST_P(ReferenceTest, fastExtractBits) {
+  constexpr int border = 3;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t scores[vstep*vstep];
+  uint8_t out[vstep*vstep];
+  uint64_t bits[vstep][pislam::fastBitWords(vstep)];
+
+  pislam::OrbContext context;
+
+  std::mt19937_64 rng;
+  for (int kind = 0; kind <= NUM_KINDS; kind += 1) {
+    std::fill(scores, scores+vstep*vstep, 0);
+    if (kind < NUM_KINDS) {
+      fill(kind, width, height, img);
+      pislam::ref::fastDetect<vstep, border>(width, height,
+          (image_t)img, (image_t)scores, 10);
+      pislam::ref::fastScoreHarris<vstep, border>(width, height,
+          (image_t)img, 0, (image_t)scores);
+    } else {
+      // Few distinct values stress the tie breaking.
+      for (int i = border; i < height - border; i += 1) {
+        for (int j = border; j < width - border; j += 1) {
+          scores[i*vstep+j] = rng() % 4;
+        }
+      }
+    }
+
+    std::vector<pislam::Keypoint> a, b;
+    pislam::ref::fastExtract<vstep, border>(width, height,
+        (image_t)scores, a);
+    bitScores(width, height, border, scores, bits, out);
+    pislam::fastExtractBits<vstep, border>(width, height, bits,
+        (image_t)out, b, context);
+    checkVectors(a, b);
+    for (int i = 0; i < vstep*vstep; i += 1) {
+      ASSERT_EQ(0, out[i]);
+    }
+
+    a.clear(); b.clear();
+    pislam::ref::fastExtract<vstep, border, 2, 3>(width, height,
+        (image_t)scores, a);
+    bitScores(width, height, border, scores, bits, out);
+    pislam::fastExtractBits<vstep, border, 2, 3>(width, height, bits,
+        (image_t)out, b, context);
+    checkVectors(a, b);
+  }
+}
+
+TEST_P(ReferenceTest, briefDescribe) {
+  constexpr int border = 16;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    for (pislam::Keypoint point : gridPoints(width, height, border)) {
+      int x = pislam::decodeFastX(point);
+      int y = pislam::decodeFastY(point);
+      for (int rot = 0; rot < 30; rot += 1) {
+        uint32_t a[8], b[8];
+        pislam::ref::briefDescribe<vstep, 8>((image_t)img, x, y, rot, a);
+        pislam::briefDescribe<vstep, 8>((image_t)img, x, y, rot, b);
+        for (int w = 0; w < 8; w += 1) {
+          ASSERT_EQ(a[w], b[w]) << "at " << x << ", " << y
+            << " rot " << rot << " word " << w;
+        }
+      }
+    }
+  }
+}
+
+TEST_P(ReferenceTest, briefDescribeTable) {
+  constexpr int border = 16;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  const pislam::BriefTable<vstep> &table = pislam::BriefTable<vstep>::get();
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    for (pislam::Keypoint point : gridPoints(width, height, border)) {
+      int x = pislam::decodeFastX(point);
+      int y = pislam::decodeFastY(point);
+      for (int rot = 0; rot < 30; rot += 1) {
+        uint32_t a[8], b[8], c[8];
+        pislam::briefDescribe<vstep, 8>((image_t)img, x, y, rot, a);
+        pislam::briefDescribeTable<vstep, 8>((image_t)img, x, y,
+            table.offsets[rot], b);
+        pislam::briefDescribeTableScalar<vstep, 8>((image_t)img, x, y,
+            table.offsets[rot], c);
+        for (int w = 0; w < 8; w += 1) {
+          ASSERT_EQ(a[w], b[w]) << "at " << x << ", " << y
+            << " rot " << rot << " word " << w;
+          ASSERT_EQ(a[w], c[w]) << "at " << x << ", " << y
+            << " rot " << rot << " word " << w;
+        }
+      }
+    }
+  }
+}
+
+TEST_P(ReferenceTest, orbComputeSteered) {
+  constexpr int border = 19;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    std::vector<pislam::Keypoint> points = gridPoints(width, height, border);
+
+    std::vector<uint32_t> a, b;
+    std::vector<float> angleA, angleB;
+    pislam::ref::orbComputeSteered<vstep, 8>((image_t)img, points, a, angleA);
+    pislam::orbComputeSteered<vstep, 8>((image_t)img, points, b, angleB);
+    checkVectors(angleA, angleB);
+    checkVectors(a, b);
+  }
+}
+
+TEST_P(ReferenceTest, harrisScoreSobel) {
+  constexpr int border = 4;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    for (int32_t threshold : {INT32_MIN, 0, 1 << 15}) {
+      for (int y = border; y < height - border; y += 1) {
+        for (int x = border; x < width - border; x += 1) {
+          ASSERT_EQ(
+              pislam::ref::harrisScoreSobel<vstep>((image_t)img, x, y, threshold),
+              pislam::harrisScoreSobel<vstep>((image_t)img, x, y, threshold))
+            << "first divergence at " << x << ", " << y;
+        }
+      }
+    }
+  }
+}
+
+TEST_P(ReferenceTest, harrisResponse7) {
+  constexpr int border = 5;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t out[vstep*vstep];
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    std::fill(out, out+vstep*vstep, 0);
+    for (int y = border; y < height - border; y += 1) {
+      for (int x = border; x < width - border; x += 1) {
+        ASSERT_EQ(
+            (pislam::ref::harrisResponse7<vstep, 41>((image_t)img, x, y)),
+            (pislam::harrisResponse7<vstep, 41>((image_t)img, x, y)))
+          << "first divergence at " << x << ", " << y;
+        ASSERT_EQ(
+            (pislam::ref::harrisResponse7<vstep, 0>((image_t)img, x, y)),
+            (pislam::harrisResponse7<vstep, 0>((image_t)img, x, y)))
+          << "first divergence at " << x << ", " << y;
+        out[y*vstep+x] = (x + y) % 3 == 0;
+      }
+    }
+
+    // fastScoreHarris selects the 7x7 window by template parameter
+    pislam::fastScoreHarris<vstep, border, 7>(width, height,
+        (image_t)img, 0, (image_t)out);
+    for (int y = border; y < height - border; y += 1) {
+      for (int x = border; x < width - border; x += 1) {
+        uint8_t expected = (x + y) % 3 == 0 ?
+          pislam::harrisScoreSobel7<vstep>((image_t)img, x, y, 0) : 0;
+        ASSERT_EQ(expected, out[y*vstep+x])
+          << "first divergence at " << x << ", " << y;
+      }
+    }
+  }
+}
+
+// Batches of every size up to two full groups, with repeated points.
+TEST_P(ReferenceTest, harrisScoreSobelBatch) {
+  constexpr int border = 4;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  std::mt19937_64 rng;
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    for (int n = 0; n <= 16; n += 1) {
+      int32_t xs[16], ys[16];
+      uint8_t scores[16];
+      for (int i = 0; i < n; i += 1) {
+        xs[i] = border + rng() % (width - 2*border);
+        ys[i] = border + rng() % (height - 2*border);
+      }
+      pislam::harrisScoreSobelBatch<vstep>((image_t)img, xs, ys, n,
+          0, scores);
+      for (int i = 0; i < n; i += 1) {
+        ASSERT_EQ(
+            pislam::ref::harrisScoreSobel<vstep>((image_t)img, xs[i], ys[i], 0),
+            scores[i]) << "first divergence at " << xs[i] << ", " << ys[i];
+      }
+    }
+  }
+}
+
+// Every detected point scored by each pluggable scorer, including the
+// threshold, which FastScorer takes in fastDetect units.
+TEST_P(ReferenceTest, fastScore) {
+  constexpr int border = 4;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t detected[vstep*vstep];
+  uint8_t shiTomasi[vstep*vstep];
+  uint8_t fast[vstep*vstep];
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    std::fill(detected, detected+vstep*vstep, 0);
+    pislam::ref::fastDetect<vstep, border>(width, height,
+        (image_t)img, (image_t)detected, 10);
+
+    for (int32_t threshold : {0, 20}) {
+      std::copy(detected, detected+vstep*vstep, shiTomasi);
+      std::copy(detected, detected+vstep*vstep, fast);
+      pislam::fastScore<vstep, border, pislam::ShiTomasiScorer>(width,
+          height, (image_t)img, threshold << 10, (image_t)shiTomasi);
+      pislam::fastScore<vstep, border, pislam::FastScorer>(width, height,
+          (image_t)img, threshold, (image_t)fast);
+
+      for (int y = border; y < height - border; y += 1) {
+        for (int x = border; x < width - border; x += 1) {
+          bool point = detected[y*vstep+x];
+          ASSERT_EQ(point ? pislam::ref::shiTomasiScoreSobel<vstep>(
+                (image_t)img, x, y, threshold << 10) : 0,
+              shiTomasi[y*vstep+x])
+            << "first divergence at " << x << ", " << y;
+          ASSERT_EQ(point ? pislam::ref::fastCornerScore<vstep>(
+                (image_t)img, x, y, threshold) : 0,
+              fast[y*vstep+x])
+            << "first divergence at " << x << ", " << y;
+        }
+      }
+    }
+  }
+}
+
+// Detection, scoring and extraction through the bit plane match the
+// byte plane end to end.
+TEST_P(ReferenceTest, fastBits) {
+  constexpr int border = 4;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t out[vstep*vstep];
+  uint8_t scores[vstep*vstep];
+  uint64_t bits[vstep][pislam::fastBitWords(vstep)];
+
+  // both planes are reused between images, as in a frame loop
+  std::fill(scores, scores+vstep*vstep, 0);
+  std::fill(bits[0], bits[0] + vstep*pislam::fastBitWords(vstep), 0);
+  pislam::OrbContext context;
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+
+    // fastDetect classifies pixels past the border too, which may wrap
+    // into the start of the next row
+    std::fill(out, out+vstep*vstep, 0);
+    pislam::fastDetect<vstep, border>(width, height,
+        (image_t)img, (image_t)out, 10);
+    for (int y = 0; y < vstep; y += 1) {
+      std::fill(&out[y*vstep], &out[y*vstep + border], 0);
+      std::fill(&out[y*vstep + width - border], &out[(y+1)*vstep], 0);
+    }
+    pislam::fastScoreHarris<vstep, border>(width, height,
+        (image_t)img, 0, (image_t)out);
+
+    std::vector<pislam::Keypoint> a, b;
+    pislam::fastExtract<vstep, border>(width, height, (image_t)out, a);
+
+    pislam::fastDetectBits<vstep, border>(width, height,
+        (image_t)img, bits, 10);
+    pislam::fastScoreHarrisBits<vstep, border>(width, height,
+        (image_t)img, 0, bits, (image_t)scores);
+    pislam::fastExtractBits<vstep, border>(width, height, bits,
+        (image_t)scores, b, context);
+    checkVectors(a, b);
+  }
+}
+
+#if defined(PISLAM_NEON)
+TEST_P(ReferenceTest, fastDetectScoreHarris) {
+  constexpr int border = 4;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+  uint8_t a[vstep*vstep];
+  uint8_t b[vstep*vstep];
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    for (int threshold : {10, 20, 40}) {
+      std::fill(a, a+vstep*vstep, 0);
+      std::fill(b, b+vstep*vstep, 0);
+      pislam::ref::fastDetect<vstep, border>(width, height,
+          (image_t)img, (image_t)a, threshold);
+      pislam::ref::fastScoreHarris<vstep, border>(width, height,
+          (image_t)img, 0, (image_t)a);
+      pislam::fastDetectScoreHarris<vstep, border>(width, height,
+          (image_t)img, threshold, 0, (image_t)b);
+
+      int x, y;
+      ASSERT_FALSE(test_util::first_divergence(vstep, border, width, height,
+            a, b, &x, &y)) << "first divergence at " << x << ", " << y;
+    }
+  }
+}
+
+TEST_P(ReferenceTest, orbCompute) {
+  constexpr int border = 16;
+
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+
+  uint8_t img[vstep*vstep];
+
+  // reused between images, as in a frame loop
+  pislam::OrbContext context;
+
+  for (int kind = 0; kind < NUM_KINDS; kind += 1) {
+    fill(kind, width, height, img);
+    std::vector<pislam::Keypoint> points = gridPoints(width, height, border);
+
+    std::vector<int32_t> ca = pislam::ref::orbCentroids<vstep>((image_t)img, points);
+    std::vector<int32_t> cb = pislam::orbCentroids<vstep>((image_t)img, points);
+    checkVectors(ca, cb);
+
+    checkVectors(pislam::ref::atan2(ca), pislam::atan2(cb));
+
+    std::vector<uint32_t> a, b;
+    pislam::ref::orbCompute<vstep, 8>((image_t)img, points, a);
+    pislam::orbCompute<vstep, 8>((image_t)img, points, b);
+    checkVectors(a, b);
+
+    // fewer points than the context last held
+    for (size_t n : {points.size(), points.size() / 2 + 1}) {
+      std::vector<pislam::Keypoint> subset(points.begin(), points.begin() + n);
+      a.clear(); b.clear();
+      pislam::ref::orbCompute<vstep, 8>((image_t)img, subset, a);
+      pislam::orbCompute<vstep, 8>((image_t)img, subset, b, context);
+      checkVectors(a, b);
+
+      b.clear();
+      pislam::orbCompute<vstep, 8, true>((image_t)img, subset, b, context);
+      checkVectors(a, b);
+    }
+  }
+}
+#endif
+
+TEST(FastAtan2Test, accuracy) {
+  for (int i = 0; i < 3600; i += 1) {
+    float theta = i * M_PI / 1800;
+    float degrees = pislam::fastAtan2(1000 * sinf(theta), 1000 * cosf(theta));
+    float error = std::fabs(degrees - i / 10.f);
+    ASSERT_LT(std::min(error, 360 - error), 0.02f) << "at " << i / 10.f;
+  }
+}
+
+// Horizontal stripes of period 4 have the largest gradient in every row
+// of the window, the most negative response of any image. With the
+// largest k it must score as an edge, not wrap around to a corner.
+TEST(HarrisScoreSobel7Test, edge) {
+  uint8_t img[vstep*vstep];
+  for (int y = 0; y < vstep; y += 1) {
+    for (int x = 0; x < vstep; x += 1) {
+      img[y*vstep+x] = y % 4 < 2 ? 0 : 255;
+    }
+  }
+  for (int y = 5; y < 9; y += 1) {
+    ASSERT_GT(0, (pislam::ref::harrisResponse7<vstep, 255>((image_t)img,
+            vstep / 2, y)));
+    ASSERT_EQ(0, (pislam::harrisScoreSobel7<vstep, 255>((image_t)img,
+            vstep / 2, y, 0)));
+  }
+}
+
+// The dispatched steering kernel against the portable one.
+TEST(BriefSteerTest, kernels) {
+  const pislam::BriefPatternFloat &pattern = pislam::BriefPatternFloat::get();
+  for (float degrees = 0; degrees < 360; degrees += 0.37f) {
+    int32_t a[2][256], b[2][256];
+    pislam::briefSteerPattern(degrees, vstep, a);
+
+    float angle = degrees * (float)(M_PI/180.f);
+    for (int i = 0; i < 2; i += 1) {
+      pislam::briefSteerScalar(pattern.x[i], pattern.y[i],
+          (float)std::cos((double)angle), (float)std::sin((double)angle),
+          vstep, b[i]);
+      for (int j = 0; j < 256; j += 1) {
+        ASSERT_EQ(b[i][j], a[i][j]) << "at " << degrees << " degrees";
+      }
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    DimensionTest,
+    ReferenceTest,
+    Combine(Range(33, 64, 3), Range(33, 64, 3)));
+
+} /* namespace */
@@ -0,0 +1,168 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../include/Resample.h"
+#include "../include/Reference.h"
+#include "TestUtil.h"
+
+namespace {
+
+using ::testing::Combine;
+using ::testing::Range;
+using ::testing::Values;
+
+constexpr int vstep = 640;
+
+typedef uint8_t (*image_t)[vstep];
+
+// The fixed ratio kernels sample at the same positions. The one exception
+// is bilinear13_16 weighting output 10 by 138, where the position
+// (10.5 * 16/13 - 0.5 = 12.42) gives 148.
+TEST(ResampleTaps, bilinear) {
+  static const uint8_t filter7_8[] = {238, 201, 165, 128, 91, 55, 18};
+  static const uint8_t filter13_16[] = {
+    226, 167, 108, 49, 246, 187, 128, 69, 10, 207, 138, 89, 30
+  };
+  static const int map13_16[] = {0, 1, 2, 3, 5, 6, 7, 8, 9, 11, 12, 13, 14};
+
+  for (int i = 0; i < 7; i += 1) {
+    int i0, i1;
+    uint8_t w0, w1;
+    pislam::resampleTaps(i, 8, 7, &i0, &i1, &w0, &w1);
+    EXPECT_EQ(i, i0);
+    EXPECT_EQ(filter7_8[i], w0);
+  }
+
+  for (int i = 0; i < 13; i += 1) {
+    int i0, i1;
+    uint8_t w0, w1;
+    pislam::resampleTaps(i, 16, 13, &i0, &i1, &w0, &w1);
+    EXPECT_EQ(map13_16[i], i0);
+    EXPECT_EQ(i == 10 ? 148 : filter13_16[i], w0);
+  }
+}
+
+TEST(ResampleTable, blocks) {
+  for (int width : {40, 333, 640}) {
+    for (int outWidth : {(width + 3)/4, width/2, width*4/5, width*5/6, width}) {
+      pislam::ResampleTable table;
+      pislam::resampleTable(width, 16, outWidth, 16, table);
+      ASSERT_EQ((outWidth + 7) / 8, (int)table.blocks.size());
+
+      for (int x = 0; x < outWidth; x += 1) {
+        const pislam::ResampleBlock &block = table.blocks[x / 8];
+        int i0, i1;
+        uint8_t w0, w1;
+        pislam::resampleTaps(x, width, outWidth, &i0, &i1, &w0, &w1);
+        ASSERT_EQ(i0, block.base + block.i0[x % 8]);
+        ASSERT_EQ(i1, block.base + block.i1[x % 8]);
+        ASSERT_EQ(w0, block.w0[x % 8]);
+        ASSERT_EQ(w1, block.w1[x % 8]);
+        ASSERT_EQ(256, w0 + w1);
+        ASSERT_LT(i1, width);
+      }
+    }
+  }
+}
+
+#if defined(PISLAM_NEON)
+class ResampleTest: public ::testing::TestWithParam<
+    ::testing::tuple<int, int, ::testing::tuple<int, int>>> {};
+
+static void check(int width, int height, int outWidth, int outHeight,
+    const uint8_t *img) {
+  std::vector<uint8_t> a(img, img + vstep*vstep);
+  std::vector<uint8_t> b(img, img + vstep*vstep);
+  std::vector<uint8_t> c(vstep*vstep);
+
+  pislam::ResampleTable table;
+  pislam::resampleTable(width, height, outWidth, outHeight, table);
+
+  pislam::ref::resample<vstep>(width, height, outWidth, outHeight,
+      (image_t)a.data(), (image_t)a.data());
+  pislam::resample<vstep>(table, (image_t)b.data(), (image_t)b.data());
+  pislam::resample<vstep>(table, (image_t)img, (image_t)c.data());
+
+  for (int y = 0; y < outHeight; y += 1) {
+    for (int x = 0; x < outWidth; x += 1) {
+      ASSERT_EQ(a[y*vstep+x], b[y*vstep+x]) << "first divergence at "
+        << x << ", " << y << " scaling to " << outWidth << "x" << outHeight;
+      ASSERT_EQ(a[y*vstep+x], c[y*vstep+x]) << "first divergence at "
+        << x << ", " << y << " scaling to " << outWidth << "x" << outHeight;
+    }
+  }
+}
+
+TEST_P(ResampleTest, spiral) {
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+  int num = ::testing::get<0>(::testing::get<2>(GetParam()));
+  int den = ::testing::get<1>(::testing::get<2>(GetParam()));
+
+  uint8_t img[vstep*vstep];
+  std::fill(img, img+vstep*vstep, 0);
+  test_util::fill_spiral(vstep, width, height, width/3, height/3, img);
+
+  check(width, height, width*num/den, height*num/den, img);
+}
+
+TEST_P(ResampleTest, random) {
+  int width = ::testing::get<0>(GetParam());
+  int height = ::testing::get<1>(GetParam());
+  int num = ::testing::get<0>(::testing::get<2>(GetParam()));
+  int den = ::testing::get<1>(::testing::get<2>(GetParam()));
+
+  uint8_t img[vstep*vstep];
+  std::fill(img, img+vstep*vstep, 0);
+  test_util::fill_random(vstep, width, height, img);
+
+  check(width, height, width*num/den, height*num/den, img);
+}
+
+// The level sizes of the pislam pyramid, each computed from the first
+// level, as expected by ORB-SLAM style consumers.
+TEST(ResamplePyramid, levels) {
+  static const int levels[8][2] = {
+    {640, 480}, {533, 400}, {444, 333}, {370, 278},
+    {309, 231}, {257, 193}, {214, 161}, {179, 134}
+  };
+
+  uint8_t img[vstep*vstep];
+  std::fill(img, img+vstep*vstep, 0);
+  test_util::fill_random(vstep, 640, 480, img);
+
+  for (int i = 1; i < 8; i += 1) {
+    check(levels[i-1][0], levels[i-1][1], levels[i][0], levels[i][1], img);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    DimensionTest,
+    ResampleTest,
+    Combine(Range(16, 64, 5), Range(16, 64, 5),
+      Values(::testing::make_tuple(5, 6), ::testing::make_tuple(4, 5),
+        ::testing::make_tuple(1, 2), ::testing::make_tuple(13, 16),
+        ::testing::make_tuple(1, 4), ::testing::make_tuple(1, 1))));
+#endif
+
+} /* namespace */
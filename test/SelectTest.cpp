@@ -0,0 +1,199 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../include/Reference.h"
+#include "../include/Select.h"
+
+namespace {
+
+using ::testing::Combine;
+using ::testing::Values;
+
+class SelectTest: public ::testing::TestWithParam<::testing::tuple<int, int>> {};
+
+TEST(LevelQuotasTest, proportionalToArea) {
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  pislam::pyramidLevels(640, 480, levels);
+
+  int64_t area = 0;
+  for (const pislam::PyramidLevel &level : levels) {
+    area += level.width * level.height;
+  }
+  for (int total : {0, 1, 7, 1000, 2000, 12345}) {
+    int quotas[pislam::pyramidLevelCount];
+    pislam::levelQuotas(levels, pislam::pyramidLevelCount, total, quotas);
+    ASSERT_EQ(total, std::accumulate(quotas, quotas + 8, 0));
+    for (int l = 0; l < pislam::pyramidLevelCount; l += 1) {
+      double share = (double)total * levels[l].width * levels[l].height / area;
+      ASSERT_LE(std::abs(quotas[l] - share), 1.0) << total << " " << l;
+    }
+  }
+}
+
+TEST(LevelQuotasTest, cappedByAvailable) {
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  pislam::pyramidLevels(640, 480, levels);
+  int available[pislam::pyramidLevelCount] = {10, 1000, 0, 1000, 5, 1000, 1000, 1000};
+  int quotas[pislam::pyramidLevelCount];
+
+  pislam::levelQuotas(levels, pislam::pyramidLevelCount, 1000, quotas, available);
+  ASSERT_EQ(1000, std::accumulate(quotas, quotas + 8, 0));
+  ASSERT_EQ(10, quotas[0]);
+  ASSERT_EQ(0, quotas[2]);
+  ASSERT_EQ(5, quotas[4]);
+  for (int l = 0; l < pislam::pyramidLevelCount; l += 1) {
+    ASSERT_LE(quotas[l], available[l]);
+  }
+  // The rest is still divided by area.
+  ASSERT_GT(quotas[1], quotas[3]);
+  ASSERT_GT(quotas[3], quotas[5]);
+
+  // Asking for more than is available takes everything.
+  pislam::levelQuotas(levels, pislam::pyramidLevelCount, 100000, quotas, available);
+  for (int l = 0; l < pislam::pyramidLevelCount; l += 1) {
+    ASSERT_EQ(available[l], quotas[l]);
+  }
+}
+
+// Random points over a 640x480 pyramid, with `scores` distinct scores so
+// that a small range forces many ties, compared with the sorting
+// reference.
+TEST_P(SelectTest, matchesReference) {
+  const int total = ::testing::get<0>(GetParam());
+  const int scores = ::testing::get<1>(GetParam());
+
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  const int rows = pislam::pyramidLevels(640, 480, levels);
+
+  std::mt19937 rng(total * 31 + scores);
+  std::vector<pislam::Keypoint> keypoints;
+  for (int y = 0; y < rows; y += 1) {
+    for (int x = 0; x < 640; x += 1) {
+      if (rng() % 100 == 0) {
+        keypoints.push_back(pislam::encodeFast(1 + rng() % scores, x, y));
+      }
+    }
+  }
+
+  std::vector<pislam::Keypoint> expected = keypoints;
+  pislam::ref::selectLevels(expected, levels, pislam::pyramidLevelCount, total);
+
+  pislam::OrbContext context;
+  for (int repeat = 0; repeat < 2; repeat += 1) {
+    std::vector<pislam::Keypoint> actual = keypoints;
+    pislam::selectLevels(actual, levels, pislam::pyramidLevelCount, total,
+        context);
+    ASSERT_EQ(std::min<size_t>(total, keypoints.size()), actual.size());
+    ASSERT_EQ(expected, actual);
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    TotalTest,
+    SelectTest,
+    Combine(Values(0, 1, 500, 1000, 20000), Values(2, 255)));
+
+// Level 0 holds a dense, strongly textured patch in one corner and weak
+// points scattered over the rest, as from a poster on a blank wall.
+static std::vector<pislam::Keypoint> clustered(int rows, std::mt19937 &rng) {
+  std::vector<pislam::Keypoint> keypoints;
+  for (int y = 0; y < rows; y += 1) {
+    for (int x = 0; x < 640; x += 1) {
+      bool patch = x < 100 && y < 100;
+      if (rng() % (patch ? 4 : 200) == 0) {
+        int score = patch ? 200 + rng() % 50 : 1 + rng() % 100;
+        keypoints.push_back(pislam::encodeFast(score, x, y));
+      }
+    }
+  }
+  return keypoints;
+}
+
+// Number of 32x32 cells of level 0 holding a point.
+static int occupancy(const std::vector<pislam::Keypoint> &keypoints) {
+  std::vector<bool> cells(20 * 15);
+  for (pislam::Keypoint p : keypoints) {
+    if (pislam::decodeFastY(p) < 480) {
+      cells[pislam::decodeFastY(p) / 32 * 20 + pislam::decodeFastX(p) / 32] = true;
+    }
+  }
+  return std::count(cells.begin(), cells.end(), true);
+}
+
+class DistributeTest: public ::testing::TestWithParam<int> {};
+
+TEST_P(DistributeTest, spreadsPoints) {
+  const int total = GetParam();
+  pislam::PyramidLevel levels[pislam::pyramidLevelCount];
+  const int rows = pislam::pyramidLevels(640, 480, levels);
+  std::mt19937 rng(total);
+  const std::vector<pislam::Keypoint> keypoints = clustered(rows, rng);
+
+  std::vector<pislam::Keypoint> best = keypoints;
+  pislam::selectLevels(best, levels, pislam::pyramidLevelCount, total);
+
+  pislam::OrbContext context;
+  std::vector<pislam::Keypoint> first;
+  for (int repeat = 0; repeat < 2; repeat += 1) {
+    std::vector<pislam::Keypoint> spread = keypoints;
+    pislam::distributeLevels(spread, levels, pislam::pyramidLevelCount, total,
+        context);
+    ASSERT_EQ(std::min<size_t>(total, keypoints.size()), spread.size());
+
+    // A subsequence of the input, with the same count per level as
+    // selectLevels.
+    auto p = keypoints.begin();
+    for (pislam::Keypoint k : spread) {
+      p = std::find(p, keypoints.end(), k);
+      ASSERT_NE(keypoints.end(), p);
+    }
+    for (const pislam::PyramidLevel &level : levels) {
+      auto inLevel = [&](pislam::Keypoint k) {
+        int y = pislam::decodeFastY(k);
+        return level.row <= y && y < level.row + level.height;
+      };
+      ASSERT_EQ(std::count_if(best.begin(), best.end(), inLevel),
+          std::count_if(spread.begin(), spread.end(), inLevel));
+    }
+
+    if (total >= (int)keypoints.size()) {
+      ASSERT_EQ(keypoints, spread);
+    } else if (total > 0) {
+      ASSERT_LT(occupancy(best) + 20, occupancy(spread));
+    }
+    if (repeat == 0) {
+      first = spread;
+    } else {
+      ASSERT_EQ(first, spread);
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    TotalTest,
+    DistributeTest,
+    Values(0, 300, 1000, 100000));
+
+} /* namespace */
@@ -0,0 +1,123 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../include/SpscQueue.h"
+
+namespace {
+
+TEST(SpscQueue, capacity) {
+  pislam::SpscQueue<int> queue(5);
+  ASSERT_EQ(8u, queue.capacity());
+
+  int item;
+  ASSERT_FALSE(queue.pop(item));
+
+  // wrap around the ring several times
+  int next = 0, expected = 0;
+  for (int round = 0; round < 5; round += 1) {
+    while (queue.push(next)) {
+      next += 1;
+    }
+    ASSERT_EQ(8u, queue.size());
+    for (int i = 0; i < 3; i += 1) {
+      ASSERT_TRUE(queue.pop(item));
+      ASSERT_EQ(expected++, item);
+    }
+    ASSERT_EQ(5u, queue.size());
+  }
+  while (queue.pop(item)) {
+    ASSERT_EQ(expected++, item);
+  }
+  ASSERT_EQ(next, expected);
+  ASSERT_EQ(0u, queue.size());
+}
+
+TEST(SpscQueue, threads) {
+  constexpr int count = 1000000;
+  pislam::SpscQueue<int> queue(16);
+
+  std::thread producer([&queue] {
+    for (int i = 0; i < count; ) {
+      if (queue.push(i)) {
+        i += 1;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  int item, expected = 0;
+  bool ordered = true;
+  while (expected < count) {
+    if (queue.pop(item)) {
+      ordered = ordered && item == expected;
+      expected += 1;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  producer.join();
+  ASSERT_TRUE(ordered);
+  ASSERT_EQ(0u, queue.size());
+}
+
+TEST(SpscQueue, observer) {
+  pislam::SpscQueue<int> queue(16);
+  std::atomic<bool> done(false);
+
+  std::thread producer([&queue, &done] {
+    for (int i = 0; !done.load(std::memory_order_relaxed); ) {
+      if (queue.push(i)) {
+        i += 1;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+  std::thread consumer([&queue, &done] {
+    int item;
+    while (!done.load(std::memory_order_relaxed)) {
+      if (!queue.pop(item)) {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  // size from a third thread, as FramePipeline::stats, stays in range
+  // while the producer and consumer move both ends of the queue
+  size_t largest = 0;
+  const auto stop = std::chrono::steady_clock::now() +
+    std::chrono::milliseconds(200);
+  while (std::chrono::steady_clock::now() < stop) {
+    largest = std::max(largest, queue.size());
+  }
+  done.store(true);
+  producer.join();
+  consumer.join();
+  ASSERT_LE(largest, queue.capacity());
+}
+
+} /* namespace */
@@ -71,4 +71,18 @@ void print_buffer(int vstep, int width, int height, uint8_t *buffer, int fw) {
   std::cout << std::endl;
 }
 
+bool first_divergence(int vstep, int border, int width, int height,
+    const uint8_t *a, const uint8_t *b, int *x, int *y) {
+  for (int i = border; i < height - border; i += 1) {
+    for (int j = border; j < width - border; j += 1) {
+      if (a[i*vstep+j] != b[i*vstep+j]) {
+        *x = j;
+        *y = i;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 } /* namespace test_util */
@@ -32,6 +32,11 @@ void fill_random(int vstep, int width, int height, uint8_t *buffer);
 
 void print_buffer(int vstep, int width, int height, uint8_t *buffer, int fw);
 
+/// Find the first pixel in raster order, inside `border`, at which
+/// `a` and `b` differ. Returns false if they agree everywhere.
+bool first_divergence(int vstep, int border, int width, int height,
+    const uint8_t *a, const uint8_t *b, int *x, int *y);
+
 } /* namespace test_util */
 
 #endif /* PISLAM_TEST_UTIL_H__ */
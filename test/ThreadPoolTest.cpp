@@ -0,0 +1,104 @@
+/**
+ * This file is part of PiSlam.
+ *
+ * PiSlam is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * PiSlam is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PiSlam.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright 2017 Carl Chatfield
+ */
+
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../include/ThreadPool.h"
+
+namespace {
+
+using ::testing::Values;
+
+class ThreadPoolTest: public ::testing::TestWithParam<int> {};
+
+struct Counter {
+  pislam::ThreadPool *pool;
+  std::vector<std::atomic<int>> runs;
+  std::atomic<int> total{0};
+
+  explicit Counter(int n) : runs(n) {}
+};
+
+static void count(void *context, int index) {
+  Counter &counter = *static_cast<Counter *>(context);
+  counter.runs[index] += 1;
+  counter.total += 1;
+}
+
+// Each task pushes two children, forming a binary tree.
+static void spawn(void *context, int index) {
+  Counter &counter = *static_cast<Counter *>(context);
+  counter.runs[index] += 1;
+  for (int child : {2*index + 1, 2*index + 2}) {
+    if (child < (int)counter.runs.size()) {
+      counter.pool->push(spawn, context, child);
+    }
+  }
+}
+
+TEST_P(ThreadPoolTest, runsEveryTaskOnce) {
+  pislam::ThreadPool pool(GetParam());
+  Counter counter(5000);
+  counter.pool = &pool;
+
+  for (int frame = 0; frame < 3; frame += 1) {
+    for (int i = 0; i < 5000; i += 1) {
+      pool.push(count, &counter, i);
+    }
+    pool.wait();
+    ASSERT_EQ(5000*(frame + 1), counter.total.load());
+  }
+  for (int i = 0; i < 5000; i += 1) {
+    ASSERT_EQ(3, counter.runs[i].load());
+  }
+}
+
+TEST_P(ThreadPoolTest, nestedPush) {
+  pislam::ThreadPool pool(GetParam());
+  Counter counter(1000);
+  counter.pool = &pool;
+
+  pool.push(spawn, &counter, 0);
+  pool.wait();
+  for (int i = 0; i < 1000; i += 1) {
+    ASSERT_EQ(1, counter.runs[i].load());
+  }
+}
+
+// Queues holding a single task overflow constantly.
+TEST_P(ThreadPoolTest, overflow) {
+  pislam::ThreadPool pool(GetParam(), 1);
+  Counter counter(1000);
+  counter.pool = &pool;
+
+  pool.push(spawn, &counter, 0);
+  pool.wait();
+  for (int i = 0; i < 1000; i += 1) {
+    ASSERT_EQ(1, counter.runs[i].load());
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(
+    WorkerTest,
+    ThreadPoolTest,
+    Values(0, 1, 3, 8));
+
+} /* namespace */